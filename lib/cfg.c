@@ -27,6 +27,7 @@
 #include <unistd.h>
 
 #include "cfg.h"
+#include "formats/binary.h"
 #include "utilities.h"
 
 static void rm_path_free(RmPath *rmpath) {
@@ -92,6 +93,7 @@ void rm_cfg_set_default(RmCfg *cfg) {
     cfg->total_mem = (RmOff)1024 * 1024 * 1024;
     cfg->sweep_size = 1024 * 1024 * 1024;
     cfg->sweep_count = 1024 * 16;
+    cfg->spill_count = 1024 * 1024;
 
     cfg->skip_start_factor = 0.0;
     cfg->skip_end_factor = 1.0;
@@ -101,6 +103,7 @@ void rm_cfg_set_default(RmCfg *cfg) {
     cfg->skip_start_offset = 0;
     cfg->skip_end_offset = 0;
     cfg->mtime_window = -1;
+    cfg->similar_dirs_threshold = 0.8;
 
     rm_trie_init(&cfg->file_trie);
 }
@@ -149,7 +152,8 @@ guint rm_cfg_add_path(RmCfg *cfg, bool is_prefd, const char *path) {
     rmpath->treat_as_single_vol = strncmp(path, "//", 2) == 0;
     rmpath->realpath_worked = realpath_worked;
 
-    if(cfg->replay && g_str_has_suffix(rmpath->path, ".json")) {
+    if(cfg->replay && (g_str_has_suffix(rmpath->path, ".json") ||
+                       g_str_has_suffix(rmpath->path, RM_FMT_BIN_SUFFIX))) {
         cfg->json_paths = g_slist_prepend(cfg->json_paths, rmpath);
         return 1;
     }
@@ -80,6 +80,8 @@ typedef struct RmCfg {
     gboolean match_without_extension;
     gboolean merge_directories;
     gboolean honour_dir_layout;
+    gboolean find_similar_dirs;
+    gboolean chunk_savings;
     gboolean write_cksum_to_xattr;
     gboolean read_cksum_from_xattr;
     gboolean clear_xattr_fields;
@@ -98,6 +100,7 @@ typedef struct RmCfg {
 
     gdouble min_mtime;
     gdouble mtime_window;
+    gdouble similar_dirs_threshold;
     gint depth;
     gint verbosity;
 
@@ -162,8 +165,14 @@ typedef struct RmCfg {
     RmOff sweep_size;
     RmOff sweep_count;
 
+    /* number of held back files after which they are spilled to disk */
+    RmOff spill_count;
+
     gboolean shred_always_wait;
     gboolean shred_never_wait;
+
+    /* with -pp: compare in windows bounded by memory / group members */
+    gboolean paranoid_lockstep;
     gboolean fake_pathindex_as_disk;
     gboolean fake_abort;
 
@@ -181,6 +190,7 @@ typedef struct RmCfg {
     bool dedupe;
     bool dedupe_check_xattr;
     bool dedupe_readonly;
+    bool dedupe_partial;
 
     /* for --is-reflink option */
     bool is_reflink;
@@ -0,0 +1,534 @@
+/*
+ *  This file is part of rmlint.
+ *
+ *  rmlint is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  rmlint is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with rmlint.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *
+ *  - Christopher <sahib> Pahl 2010-2020 (https://github.com/sahib)
+ *  - Daniel <SeeSpotRun> T.   2014-2020 (https://github.com/SeeSpotRun)
+ *
+ * Hosted on http://github.com/sahib/rmlint
+ *
+ */
+
+/* Content defined chunking to estimate what block level deduplication
+ * (e.g. partial reflinks) could save beyond whole duplicate files.
+ *
+ * Cut points are found with a gear hash: h = (h << 1) + gear[byte].
+ * Bit k of h only depends on the last k + 1 bytes, so the cut condition
+ * looks at the upper bits, which see a window of 64 bytes. As in FastCDC,
+ * nothing is hashed below the minimum chunk size and a harder condition is
+ * used before the average size than after it, which narrows the chunk
+ * size distribution around the average ("normalized chunking").
+ *
+ * Files are read through a RmHasher with a buffer callback, so the usual
+ * read path (buffered or preadv, readahead hints) is used. The chunking
+ * itself runs in the hasher's background thread while the next block is
+ * read in the foreground.
+ */
+
+#include <glib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "checksum.h"
+#include "chunker.h"
+#include "hasher.h"
+#include "session.h"
+#include "utilities.h"
+
+/* Chunk size limits in bytes */
+#define RM_CHUNK_MIN_SIZE (2 * 1024)
+#define RM_CHUNK_AVG_SIZE (8 * 1024)
+#define RM_CHUNK_MAX_SIZE (64 * 1024)
+
+/* 15 upper bits must be zero for a cut before the average size, 11 after it */
+#define RM_CHUNK_MASK_S ((((guint64)1 << 15) - 1) << 49)
+#define RM_CHUNK_MASK_L ((((guint64)1 << 11) - 1) << 53)
+
+/* Digest used to identify chunks; needs to be 128 bit */
+#define RM_CHUNK_DIGEST RM_DIGEST_METRO
+
+/* Chunk table is doubled when more than this fraction of slots is used */
+#define RM_CHUNK_TABLE_LOAD (0.7)
+#define RM_CHUNK_TABLE_MIN_SLOTS (4096)
+
+typedef struct RmChunkSlot {
+    /* digest of the chunk's data */
+    guint64 id[2];
+
+    /* index of the file the chunk was seen first in; 0 for empty slots */
+    guint32 owner;
+
+    /* chunk length in bytes */
+    guint32 len;
+} RmChunkSlot;
+
+/* Open addressing hash table with linear probing.
+ * 24 bytes per chunk, i.e. about 0.3% of the chunked data.
+ * The slots live in a mapped temporary file if possible,
+ * so the kernel can write them out instead of swapping.
+ */
+typedef struct RmChunkTable {
+    RmChunkSlot *slots;
+    gsize n_slots;
+    gsize n_used;
+
+    /* backing file of slots or NULL if they were allocated in memory */
+    FILE *fd;
+} RmChunkTable;
+
+typedef struct RmChunkFile {
+    char *path;
+    RmOff size;
+
+    /* 1-based position in path order */
+    guint32 index;
+
+    /* Chunking state; only used by the hashing thread */
+    guint64 gear;
+    gsize chunk_len;
+    RmDigest *chunk_digest;
+
+    /* owner index -> RmOff * with bytes shared with that file */
+    GHashTable *shared;
+
+    /* bytes of chunks that were seen before (in any file) */
+    RmOff dedupable_bytes;
+} RmChunkFile;
+
+struct RmChunker {
+    RmSession *session;
+
+    /* RmChunkFile's that were added */
+    GPtrArray *files;
+
+    /* random value for each byte, used by the gear hash */
+    guint64 gear[256];
+
+    RmChunkTable table;
+
+    /* RmChunkFile's that were completely chunked */
+    GAsyncQueue *done;
+
+    /* dirname -> RmOff * with dedupable bytes */
+    GHashTable *dir_bytes;
+
+    RmChunkReport report;
+};
+
+//////////////////////////////
+//  ON-DISK CHUNK TABLE     //
+//////////////////////////////
+
+static void rm_chunk_table_alloc(RmChunkTable *table, gsize n_slots) {
+    gsize bytes = n_slots * sizeof(RmChunkSlot);
+
+    table->n_slots = n_slots;
+    table->n_used = 0;
+    table->slots = NULL;
+    table->fd = tmpfile();
+
+    if(table->fd != NULL && ftruncate(fileno(table->fd), bytes) == 0) {
+        void *map = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED,
+                         fileno(table->fd), 0);
+        if(map != MAP_FAILED) {
+            /* ftruncate() fills with zeros, so all slots are empty */
+            table->slots = map;
+            return;
+        }
+    }
+
+    rm_log_perror(_("Unable to map chunk table; keeping it in memory"));
+    if(table->fd != NULL) {
+        fclose(table->fd);
+        table->fd = NULL;
+    }
+
+    table->slots = g_malloc0(bytes);
+}
+
+static void rm_chunk_table_free(RmChunkTable *table) {
+    if(table->slots == NULL) {
+        return;
+    }
+
+    if(table->fd != NULL) {
+        munmap(table->slots, table->n_slots * sizeof(RmChunkSlot));
+        fclose(table->fd);
+    } else {
+        g_free(table->slots);
+    }
+
+    memset(table, 0, sizeof(RmChunkTable));
+}
+
+/* Return the slot of id, or the empty slot where it belongs */
+static RmChunkSlot *rm_chunk_table_lookup(RmChunkTable *table, const guint64 id[2]) {
+    gsize mask = table->n_slots - 1;
+
+    for(gsize i = id[0] & mask;; i = (i + 1) & mask) {
+        RmChunkSlot *slot = &table->slots[i];
+        if(slot->owner == 0 || (slot->id[0] == id[0] && slot->id[1] == id[1])) {
+            return slot;
+        }
+    }
+}
+
+static void rm_chunk_table_grow(RmChunkTable *table) {
+    RmChunkTable old = *table;
+    rm_chunk_table_alloc(table, old.n_slots * 2);
+
+    for(gsize i = 0; i < old.n_slots; ++i) {
+        RmChunkSlot *slot = &old.slots[i];
+        if(slot->owner != 0) {
+            *rm_chunk_table_lookup(table, slot->id) = *slot;
+        }
+    }
+
+    table->n_used = old.n_used;
+    rm_chunk_table_free(&old);
+}
+
+static gsize rm_chunk_table_initial_slots(RmOff total_bytes) {
+    /* size for the expected number of chunks, so it rarely needs to grow */
+    RmOff expected = total_bytes / RM_CHUNK_AVG_SIZE / RM_CHUNK_TABLE_LOAD;
+
+    gsize n_slots = RM_CHUNK_TABLE_MIN_SLOTS;
+    while(n_slots < expected) {
+        n_slots *= 2;
+    }
+    return n_slots;
+}
+
+//////////////////////////////
+//  CHUNKING                //
+//////////////////////////////
+
+static RmOff *rm_chunk_counter_new(void) {
+    return g_slice_new0(RmOff);
+}
+
+static void rm_chunk_counter_free(RmOff *counter) {
+    g_slice_free(RmOff, counter);
+}
+
+static RmOff *rm_chunk_counter_get(GHashTable *table, gpointer key) {
+    RmOff *counter = g_hash_table_lookup(table, key);
+    if(counter == NULL) {
+        counter = rm_chunk_counter_new();
+        g_hash_table_insert(table, key, counter);
+    }
+    return counter;
+}
+
+/* Called when file's current chunk is complete */
+static void rm_chunk_emit(RmChunker *self, RmChunkFile *file) {
+    guint64 id[2];
+    guint8 *id_bytes = rm_digest_steal(file->chunk_digest);
+    memcpy(id, id_bytes, sizeof(id));
+    g_slice_free1(file->chunk_digest->bytes, id_bytes);
+
+    rm_digest_free(file->chunk_digest);
+    file->chunk_digest = NULL;
+
+    RmChunkTable *table = &self->table;
+    RmChunkSlot *slot = rm_chunk_table_lookup(table, id);
+    self->report.chunks++;
+
+    if(slot->owner == 0) {
+        slot->id[0] = id[0];
+        slot->id[1] = id[1];
+        slot->owner = file->index;
+        slot->len = file->chunk_len;
+        self->report.unique_bytes += file->chunk_len;
+
+        if(++table->n_used > table->n_slots * RM_CHUNK_TABLE_LOAD) {
+            rm_chunk_table_grow(table);
+        }
+    } else {
+        file->dedupable_bytes += file->chunk_len;
+        if(slot->owner != file->index) {
+            /* repeated chunks within the same file are not a pair */
+            *rm_chunk_counter_get(file->shared, GUINT_TO_POINTER(slot->owner)) +=
+                file->chunk_len;
+        }
+    }
+
+    file->chunk_len = 0;
+    file->gear = 0;
+}
+
+/* RmHasherBufferCallback; called with the file's data in order */
+static void rm_chunk_buffer_callback(_UNUSED RmHasher *hasher, const guint8 *data,
+                                     gsize len, RmChunker *self, RmChunkFile *file) {
+    /* start of the data that was not yet added to chunk_digest */
+    gsize start = 0;
+    gsize i = 0;
+
+    while(i < len) {
+        if(file->chunk_digest == NULL) {
+            file->chunk_digest = rm_digest_new(RM_CHUNK_DIGEST, 0);
+        }
+
+        if(file->chunk_len < RM_CHUNK_MIN_SIZE) {
+            /* No cut point is allowed here; do not even hash */
+            gsize skip = MIN(RM_CHUNK_MIN_SIZE - file->chunk_len, len - i);
+            file->chunk_len += skip;
+            i += skip;
+            continue;
+        }
+
+        guint64 mask = (file->chunk_len < RM_CHUNK_AVG_SIZE) ? RM_CHUNK_MASK_S
+                                                              : RM_CHUNK_MASK_L;
+
+        file->gear = (file->gear << 1) + self->gear[data[i++]];
+        file->chunk_len++;
+
+        if((file->gear & mask) == 0 || file->chunk_len >= RM_CHUNK_MAX_SIZE) {
+            rm_digest_update(file->chunk_digest, data + start, i - start);
+            start = i;
+            rm_chunk_emit(self, file);
+        }
+    }
+
+    if(start < len) {
+        rm_digest_update(file->chunk_digest, data + start, len - start);
+    }
+}
+
+/* RmHasherCallback; called after the last buffer of file */
+static int rm_chunk_hash_callback(_UNUSED RmHasher *hasher, RmDigest *digest,
+                                  RmChunker *self, RmChunkFile *file) {
+    if(file->chunk_len > 0) {
+        /* the tail of the file is the last chunk */
+        rm_chunk_emit(self, file);
+    }
+
+    /* The whole file digest is not needed */
+    rm_digest_free(digest);
+
+    g_async_queue_push(self->done, file);
+    return 0;
+}
+
+//////////////////////////////
+//  REPORT                  //
+//////////////////////////////
+
+static gint rm_chunk_cmp_path(const RmChunkFile **a, const RmChunkFile **b) {
+    return g_strcmp0((*a)->path, (*b)->path);
+}
+
+static gint rm_chunk_cmp_pair(const RmChunkPair *a, const RmChunkPair *b) {
+    RETURN_IF_NONZERO(SIGN_DIFF(b->shared_bytes, a->shared_bytes));
+    RETURN_IF_NONZERO(g_strcmp0(a->paths[0], b->paths[0]));
+    return g_strcmp0(a->paths[1], b->paths[1]);
+}
+
+static gint rm_chunk_cmp_dir(const RmChunkDir *a, const RmChunkDir *b) {
+    RETURN_IF_NONZERO(SIGN_DIFF(b->dedupable_bytes, a->dedupable_bytes));
+    return g_strcmp0(a->path, b->path);
+}
+
+/* Move the numbers of a chunked file to the report */
+static void rm_chunk_collect(RmChunker *self, RmChunkFile *file) {
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_hash_table_iter_init(&iter, file->shared);
+    while(g_hash_table_iter_next(&iter, &key, &value)) {
+        RmChunkFile *owner = g_ptr_array_index(self->files, GPOINTER_TO_UINT(key) - 1);
+
+        RmChunkPair *pair = g_slice_new0(RmChunkPair);
+        pair->paths[0] = g_strdup(owner->path);
+        pair->paths[1] = g_strdup(file->path);
+        pair->shared_bytes = *(RmOff *)value;
+        g_queue_push_tail(&self->report.pairs, pair);
+    }
+
+    g_hash_table_destroy(file->shared);
+    file->shared = NULL;
+
+    if(file->dedupable_bytes > 0) {
+        char *dirname = g_path_get_dirname(file->path);
+        RmOff *counter = g_hash_table_lookup(self->dir_bytes, dirname);
+        if(counter == NULL) {
+            counter = rm_chunk_counter_new();
+            g_hash_table_insert(self->dir_bytes, dirname, counter);
+        } else {
+            g_free(dirname);
+        }
+        *counter += file->dedupable_bytes;
+    }
+}
+
+static void rm_chunk_collect_dirs(RmChunker *self) {
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_hash_table_iter_init(&iter, self->dir_bytes);
+    while(g_hash_table_iter_next(&iter, &key, &value)) {
+        RmChunkDir *dir = g_slice_new0(RmChunkDir);
+        dir->path = g_strdup(key);
+        dir->dedupable_bytes = *(RmOff *)value;
+        g_queue_push_tail(&self->report.dirs, dir);
+    }
+
+    g_queue_sort(&self->report.dirs, (GCompareDataFunc)rm_chunk_cmp_dir, NULL);
+    g_queue_sort(&self->report.pairs, (GCompareDataFunc)rm_chunk_cmp_pair, NULL);
+}
+
+//////////////////////////////
+//  API                     //
+//////////////////////////////
+
+static void rm_chunk_file_free(RmChunkFile *file) {
+    if(file->shared) {
+        g_hash_table_destroy(file->shared);
+    }
+    if(file->chunk_digest) {
+        rm_digest_free(file->chunk_digest);
+    }
+    g_free(file->path);
+    g_slice_free(RmChunkFile, file);
+}
+
+RmChunker *rm_chunk_new(RmSession *session) {
+    RmChunker *self = g_slice_new0(RmChunker);
+    self->session = session;
+    self->files = g_ptr_array_new_with_free_func((GDestroyNotify)rm_chunk_file_free);
+    self->done = g_async_queue_new();
+    self->dir_bytes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                            (GDestroyNotify)rm_chunk_counter_free);
+
+    /* Fixed seed, so cut points (and the report) are the same on every run */
+    guint64 seed = 0x726d6c696e74;
+    for(int i = 0; i < 256; ++i) {
+        /* splitmix64 */
+        guint64 z = (seed += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        self->gear[i] = z ^ (z >> 31);
+    }
+
+    g_queue_init(&self->report.pairs);
+    g_queue_init(&self->report.dirs);
+    return self;
+}
+
+void rm_chunk_add_file(RmChunker *self, RmFile *file) {
+    if(file->is_symlink || file->actual_file_size < RM_CHUNK_MIN_SIZE) {
+        return;
+    }
+
+    RM_DEFINE_PATH(file);
+
+    RmChunkFile *chunk_file = g_slice_new0(RmChunkFile);
+    chunk_file->path = g_strdup(file_path);
+    chunk_file->size = file->actual_file_size;
+    chunk_file->shared = g_hash_table_new_full(NULL, NULL, NULL,
+                                               (GDestroyNotify)rm_chunk_counter_free);
+    g_ptr_array_add(self->files, chunk_file);
+}
+
+void rm_chunk_run(RmChunker *self) {
+    RmCfg *cfg = self->session->cfg;
+    RmChunkReport *report = &self->report;
+
+    if(self->files->len == 0) {
+        return;
+    }
+
+    /* Chunks are owned by the first file in path order */
+    g_ptr_array_sort(self->files, (GCompareFunc)rm_chunk_cmp_path);
+
+    RmOff total_bytes = 0;
+    for(guint i = 0; i < self->files->len; ++i) {
+        RmChunkFile *file = g_ptr_array_index(self->files, i);
+        file->index = i + 1;
+        total_bytes += file->size;
+    }
+
+    rm_chunk_table_alloc(&self->table, rm_chunk_table_initial_slots(total_bytes));
+
+    /* One hashing thread: the table is not locked, and chunks must be
+     * inserted in file order so the owner of a chunk is well defined. */
+    RmHasher *hasher = rm_hasher_new(RM_DIGEST_XXHASH, 1, cfg->use_buffered_read,
+                                     cfg->read_buf_len, 0,
+                                     (RmHasherCallback)rm_chunk_hash_callback, self);
+    rm_hasher_set_buffer_callback(hasher,
+                                  (RmHasherBufferCallback)rm_chunk_buffer_callback);
+
+    for(guint i = 0; i < self->files->len && !rm_session_was_aborted(); ++i) {
+        RmChunkFile *file = g_ptr_array_index(self->files, i);
+        gsize bytes_read = 0;
+
+        RmHasherTask *task = rm_hasher_task_new(hasher, NULL, file);
+        rm_hasher_task_hash(task, file->path, -1, 0, file->size, FALSE, &bytes_read);
+        rm_hasher_task_finish(task);
+
+        /* wait for the hashing thread, it touches the table */
+        RmChunkFile *done = g_async_queue_pop(self->done);
+        g_assert(done == file);
+
+        report->total_bytes += bytes_read;
+        rm_chunk_collect(self, file);
+    }
+
+    rm_hasher_free(hasher, TRUE);
+
+    report->dedupable_bytes = report->total_bytes - report->unique_bytes;
+    rm_chunk_collect_dirs(self);
+
+    rm_log_debug_line("Chunked %u files (%" LLU " bytes) into %" LLU " chunks; %" LLU
+                      " bytes dedupable",
+                      self->files->len, report->total_bytes, report->chunks,
+                      report->dedupable_bytes);
+
+    /* Not needed for the report */
+    rm_chunk_table_free(&self->table);
+}
+
+const RmChunkReport *rm_chunk_get_report(RmChunker *self) {
+    return &self->report;
+}
+
+static void rm_chunk_pair_free(RmChunkPair *pair) {
+    g_free(pair->paths[0]);
+    g_free(pair->paths[1]);
+    g_slice_free(RmChunkPair, pair);
+}
+
+static void rm_chunk_dir_free(RmChunkDir *dir) {
+    g_free(dir->path);
+    g_slice_free(RmChunkDir, dir);
+}
+
+void rm_chunk_destroy(RmChunker *self) {
+    rm_chunk_table_free(&self->table);
+    g_ptr_array_free(self->files, TRUE);
+    g_async_queue_unref(self->done);
+    g_hash_table_destroy(self->dir_bytes);
+
+    g_queue_foreach(&self->report.pairs, (GFunc)rm_chunk_pair_free, NULL);
+    g_queue_clear(&self->report.pairs);
+    g_queue_foreach(&self->report.dirs, (GFunc)rm_chunk_dir_free, NULL);
+    g_queue_clear(&self->report.dirs);
+
+    g_slice_free(RmChunker, self);
+}
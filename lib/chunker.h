@@ -0,0 +1,107 @@
+/**
+ *  This file is part of rmlint.
+ *
+ *  rmlint is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  rmlint is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with rmlint.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *
+ *  - Christopher <sahib> Pahl 2010-2020 (https://github.com/sahib)
+ *  - Daniel <SeeSpotRun> T.   2014-2020 (https://github.com/SeeSpotRun)
+ *
+ * Hosted on http://github.com/sahib/rmlint
+ *
+ */
+
+#ifndef RM_CHUNKER_H
+#define RM_CHUNKER_H
+
+#include <glib.h>
+#include "file.h"
+
+/**
+ * Module to estimate block level duplicate savings (--chunk-savings).
+ *
+ * Candidate files are cut into content defined chunks (FastCDC style gear
+ * hash with normalized chunking), so that inserted or removed data only
+ * changes the chunks around it. Every chunk is identified by a 128 bit digest
+ * that is kept in an open addressing hash table in a temporary file.
+ * A chunk that was seen before in another file could be shared with it
+ * by a (partial) reflink; those bytes are reported per file pair and per
+ * directory.
+ */
+
+/* Opaque structure, details do not matter to caller */
+struct RmChunker;
+typedef struct RmChunker RmChunker;
+
+/* RmChunker is part of RmSession, therefore prototype it here */
+struct RmSession;
+typedef struct RmSession RmSession;
+
+/**
+ * Bytes two files have in common on chunk level.
+ */
+typedef struct RmChunkPair {
+    char *paths[2];      /* The file first seen with the chunks and the other one */
+    RmOff shared_bytes;  /* Bytes of paths[1] that are also in paths[0]           */
+} RmChunkPair;
+
+/**
+ * Bytes of a directory's files that are chunks seen before.
+ */
+typedef struct RmChunkDir {
+    char *path;
+    RmOff dedupable_bytes;
+} RmChunkDir;
+
+typedef struct RmChunkReport {
+    RmOff total_bytes;      /* Bytes of all chunked files                    */
+    RmOff unique_bytes;     /* Bytes of chunks that were seen only once      */
+    RmOff dedupable_bytes;  /* total_bytes - unique_bytes                    */
+    RmOff chunks;           /* Number of chunks, including repeated ones     */
+    GQueue pairs;           /* RmChunkPair, most shared bytes first          */
+    GQueue dirs;            /* RmChunkDir, most dedupable bytes first        */
+} RmChunkReport;
+
+/**
+ * @brief Allocate a new RmChunker.
+ */
+RmChunker *rm_chunk_new(RmSession *session);
+
+/**
+ * @brief Remember file for chunking; called once per inode from the main thread.
+ *
+ * Files smaller than the minimum chunk size are ignored.
+ */
+void rm_chunk_add_file(RmChunker *self, RmFile *file);
+
+/**
+ * @brief Read and chunk all added files and build the report.
+ *
+ * Files are processed one after another in path order, so the report does
+ * not depend on thread timing.
+ */
+void rm_chunk_run(RmChunker *self);
+
+/**
+ * @brief Get the report built by rm_chunk_run(). Owned by the RmChunker.
+ */
+const RmChunkReport *rm_chunk_get_report(RmChunker *self);
+
+/**
+ * @brief Free all memory allocated previously.
+ */
+void rm_chunk_destroy(RmChunker *self);
+
+#endif /* end of include guard */
@@ -39,6 +39,7 @@
 #include <search.h>
 #include <sys/time.h>
 
+#include "chunker.h"
 #include "cmdline.h"
 #include "formats.h"
 #include "hash-utility.h"
@@ -593,6 +594,19 @@ static double rm_cmd_parse_clamp_factor(const char *string, GError **error) {
     return factor;
 }
 
+static gboolean rm_cmd_parse_similar_dirs(_UNUSED const char *option_name,
+                                          const gchar *threshold, RmSession *session,
+                                          GError **error) {
+    RmCfg *cfg = session->cfg;
+    cfg->find_similar_dirs = true;
+
+    if(threshold != NULL) {
+        cfg->similar_dirs_threshold = rm_cmd_parse_clamp_factor(threshold, error);
+    }
+
+    return (error && *error == NULL);
+}
+
 static RmOff rm_cmd_parse_clamp_offset(const char *string, GError **error) {
     RmOff offset = rm_cmd_size_string_to_bytes(string, error);
 
@@ -1001,6 +1015,12 @@ static gboolean rm_cmd_parse_sweep_count(_UNUSED const char *option_name,
     return (rm_cmd_parse_mem(size_spec, error, &session->cfg->sweep_count));
 }
 
+static gboolean rm_cmd_parse_spill_count(_UNUSED const char *option_name,
+                                         const gchar *size_spec, RmSession *session,
+                                         GError **error) {
+    return (rm_cmd_parse_mem(size_spec, error, &session->cfg->spill_count));
+}
+
 static gboolean rm_cmd_parse_clamp_low(_UNUSED const char *option_name, const gchar *spec,
                                        RmSession *session, _UNUSED GError **error) {
     rm_cmd_parse_clamp_option(session, spec, true, error);
@@ -1432,6 +1452,8 @@ bool rm_cmd_parse_args(int argc, char **argv, RmSession *session) {
         {"match-without-extension"  , 'i'  , 0         , G_OPTION_ARG_NONE      , &cfg->match_without_extension  , _("Only find twins with same basename minus extension")                   , NULL}     ,
         {"merge-directories"        , 'D'  , EMPTY     , G_OPTION_ARG_CALLBACK  , FUNC(merge_directories)        , _("Find duplicate directories")                                           , NULL}     ,
         {"honour-dir-layout"        , 'j'  , EMPTY     , G_OPTION_ARG_CALLBACK  , FUNC(honour_dir_layout)        , _("Only find directories with same file layout")                          , NULL}     ,
+        {"similar-dirs"             , 0    , OPTIONAL  , G_OPTION_ARG_CALLBACK  , FUNC(similar_dirs)             , _("Also report directories that share most of their files")               , "J"}      ,
+        {"chunk-savings"            , 0    , 0         , G_OPTION_ARG_NONE      , &cfg->chunk_savings            , _("Estimate block level savings between files")                           , NULL}     ,
         {"perms"                    , 'z'  , OPTIONAL  , G_OPTION_ARG_CALLBACK  , FUNC(permissions)              , _("Only use files with certain permissions")                              , "[RWX]+"} ,
         {"no-hardlinked"            , 'L'  , DISABLE   , G_OPTION_ARG_NONE      , &cfg->find_hardlinked_dupes    , _("Ignore hardlink twins")                                                , NULL}     ,
         {"keep-hardlinked"          , 0    , 0         , G_OPTION_ARG_NONE      , &cfg->keep_hardlinked_dupes    , _("Keep hardlink that are linked to any original")                        , NULL}     ,
@@ -1444,6 +1466,7 @@ bool rm_cmd_parse_args(int argc, char **argv, RmSession *session) {
         {"dedupe"                   , 0    , 0         , G_OPTION_ARG_NONE      , &cfg->dedupe                   , _("Dedupe matching extents from source to dest (if filesystem supports)") , NULL}     ,
         {"dedupe-xattr"             , 0    , 0         , G_OPTION_ARG_NONE      , &cfg->dedupe_check_xattr       , _("Check extended attributes to see if the file is already deduplicated") , NULL}     ,
         {"dedupe-readonly"          , 0    , 0         , G_OPTION_ARG_NONE      , &cfg->dedupe_readonly          , _("(--dedupe option) even dedupe read-only snapshots (needs root)")       , NULL}     ,
+        {"dedupe-partial"           , 0    , 0         , G_OPTION_ARG_NONE      , &cfg->dedupe_partial           , _("(--dedupe option) also dedupe equal blocks of different files")        , NULL}     ,
         {"is-reflink"               , 0    , 0         , G_OPTION_ARG_NONE      , &cfg->is_reflink               , _("Test if two files are reflinks (share same data extents)")             , NULL}     ,
 
         /* Callback */
@@ -1483,6 +1506,7 @@ bool rm_cmd_parse_args(int argc, char **argv, RmSession *session) {
         {"read-buffer-len"        , 0   , HIDDEN           , G_OPTION_ARG_CALLBACK , FUNC(read_buf_len)           , "Specify read buffer length in bytes"                         , "S"}    ,
         {"sweep-size"             , 0   , HIDDEN           , G_OPTION_ARG_CALLBACK , FUNC(sweep_size)             , "Specify max. bytes per pass when scanning disks"             , "S"}    ,
         {"sweep-files"            , 0   , HIDDEN           , G_OPTION_ARG_CALLBACK , FUNC(sweep_count)            , "Specify max. file count per pass when scanning disks"        , "S"}    ,
+        {"spill-files"            , 0   , HIDDEN           , G_OPTION_ARG_CALLBACK , FUNC(spill_count)            , "Specify max. number of held back files before spilling to disk", "S"}    ,
         {"threads"                , 't' , HIDDEN           , G_OPTION_ARG_INT64    , &cfg->threads                , "Specify max. number of hasher threads"                       , "N"}    ,
         {"threads-per-disk"       , 0   , HIDDEN           , G_OPTION_ARG_INT      , &cfg->threads_per_disk       , "Specify number of reader threads per physical disk"          , NULL}   ,
         {"write-unfinished"       , 'U' , HIDDEN           , G_OPTION_ARG_NONE     , &cfg->write_unfinished       , "Output unfinished checksums"                                 , NULL}   ,
@@ -1498,6 +1522,7 @@ bool rm_cmd_parse_args(int argc, char **argv, RmSession *session) {
         {"fake-abort"             , 0   , HIDDEN           , G_OPTION_ARG_NONE     , &cfg->fake_abort             , "Simulate interrupt after 10% shredder progress"              , NULL}   ,
         {"buffered-read"          , 0   , HIDDEN           , G_OPTION_ARG_NONE     , &cfg->use_buffered_read      , "Default to buffered reading calls (fread) during reading."   , NULL}   ,
         {"shred-never-wait"       , 0   , HIDDEN           , G_OPTION_ARG_NONE     , &cfg->shred_never_wait       , "Never waits for file increment to finish hashing"            , NULL}   ,
+        {"lockstep-paranoid"      , 0   , HIDDEN           , G_OPTION_ARG_NONE     , &cfg->paranoid_lockstep      , _("With -pp, compare in lockstep windows of bounded memory")  , NULL}   ,
         {"no-sse"                 , 0   , HIDDEN           , G_OPTION_ARG_NONE     , &cfg->no_sse                 , "Don't use SSE accelerations"                                 , NULL}   ,
         {"no-mount-table"         , 0   , DISABLE | HIDDEN , G_OPTION_ARG_NONE     , &cfg->list_mounts            , "Do not try to optimize by listing mounted volumes"           , NULL}   ,
         {NULL                     , 0   , HIDDEN           , 0                     , NULL                         , NULL                                                          , NULL}
@@ -1624,6 +1649,16 @@ bool rm_cmd_parse_args(int argc, char **argv, RmSession *session) {
         rm_log_warning_line(_("will also disable --merge-directories and trigger this warning."));
     }
 
+    if(cfg->find_similar_dirs && !cfg->merge_directories) {
+        rm_log_warning_line(_("--similar-dirs makes no sense without --merge-directories (-D)"));
+        cfg->find_similar_dirs = false;
+    }
+
+    if(cfg->chunk_savings && !cfg->find_duplicates && !cfg->merge_directories) {
+        rm_log_warning_line(_("--chunk-savings needs the duplicate search; ignoring it"));
+        cfg->chunk_savings = false;
+    }
+
     if(cfg->progress_enabled) {
         if(!rm_fmt_has_formatter(session->formats, "sh")) {
             rm_fmt_add(session->formats, "sh", "rmlint.sh");
@@ -1700,6 +1735,11 @@ static int rm_cmd_replay_main(RmSession *session) {
     bool one_valid_json = false;
     RmCfg *cfg = session->cfg;
 
+    /* Used to schedule the stat() calls of the json entries per disk */
+    if(cfg->list_mounts) {
+        session->mounts = rm_mounts_table_new(cfg->fake_fiemap);
+    }
+
     for(GSList *iter = cfg->json_paths; iter; iter = iter->next) {
         RmPath *jsonpath = iter->data;
 
@@ -1776,6 +1816,11 @@ int rm_cmd_main(RmSession *session) {
             rm_log_error_line(_("Failed to complete setup for merging directories"));
             return EXIT_FAILURE;
         }
+        rm_tm_set_callback(session->dir_merger, (RmTreeMergeOutputFunc)rm_shred_output_tm_results, session);
+    }
+
+    if(cfg->chunk_savings) {
+        session->chunker = rm_chunk_new(session);
     }
 
     if(session->total_files < 2 && session->cfg->run_equal_mode) {
@@ -1824,10 +1869,16 @@ int rm_cmd_main(RmSession *session) {
 
     if(cfg->merge_directories) {
         rm_fmt_set_state(session->formats, RM_PROGRESS_STATE_MERGE);
-        rm_tm_set_callback(session->dir_merger, (RmTreeMergeOutputFunc)rm_shred_output_tm_results, session);
         rm_tm_finish(session->dir_merger);
     }
 
+    if(cfg->chunk_savings) {
+        rm_chunk_run(session->chunker);
+
+        rm_log_debug_line("Chunk analysis finished at time %.3f",
+                          g_timer_elapsed(session->timer, NULL));
+    }
+
     rm_fmt_flush(session->formats);
     rm_fmt_set_state(session->formats, RM_PROGRESS_STATE_PRE_SHUTDOWN);
     rm_fmt_set_state(session->formats, RM_PROGRESS_STATE_SUMMARY);
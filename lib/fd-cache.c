@@ -0,0 +1,276 @@
+/*
+ *  This file is part of rmlint.
+ *
+ *  rmlint is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  rmlint is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with rmlint.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *
+ *  - Christopher <sahib> Pahl 2010-2020 (https://github.com/sahib)
+ *  - Daniel <SeeSpotRun> T.   2014-2020 (https://github.com/SeeSpotRun)
+ *
+ * Hosted on http://github.com/sahib/rmlint
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <sys/resource.h>
+
+#include "fd-cache.h"
+#include "utilities.h"
+
+/* Number of descriptors left for everything else (output files, traversal...) */
+#define RM_FD_CACHE_RESERVED (64)
+
+/* Upper limit if RLIMIT_NOFILE is unlimited or very high */
+#define RM_FD_CACHE_MAX (4096)
+
+/* Directories are only used as anchor for openat(); O_PATH avoids
+ * permission checks and is cheaper where available. */
+#ifdef O_PATH
+#define RM_FD_CACHE_DIR_FLAGS (O_PATH | O_DIRECTORY)
+#else
+#define RM_FD_CACHE_DIR_FLAGS (O_RDONLY | O_DIRECTORY)
+#endif
+
+typedef struct RmFdCacheEntry {
+    gpointer key;
+    int fd;
+
+    /* Number of callers currently using fd; directories can have several */
+    guint users;
+
+    /* close fd once it is released */
+    bool dropped;
+
+    /* link in RmFdCache.lru; NULL while in use */
+    GList *link;
+} RmFdCacheEntry;
+
+struct _RmFdCache {
+    /* key (file or directory RmNode) -> RmFdCacheEntry */
+    GHashTable *entries;
+
+    /* idle entries, least recently used first */
+    GQueue lru;
+
+    guint max_fds;
+    GMutex lock;
+};
+
+static guint rm_fd_cache_default_limit(void) {
+    struct rlimit limit;
+    if(getrlimit(RLIMIT_NOFILE, &limit) == -1) {
+        rm_log_perror("getrlimit(RLIMIT_NOFILE) failed");
+        return RM_FD_CACHE_RESERVED;
+    }
+
+    if(limit.rlim_cur == RLIM_INFINITY) {
+        return RM_FD_CACHE_MAX;
+    }
+
+    /* Use at most half of what is allowed */
+    rlim_t usable = limit.rlim_cur / 2;
+    if(usable <= RM_FD_CACHE_RESERVED) {
+        return 0;
+    }
+
+    return MIN(usable - RM_FD_CACHE_RESERVED, RM_FD_CACHE_MAX);
+}
+
+static void rm_fd_cache_entry_free(RmFdCacheEntry *entry) {
+    rm_sys_close(entry->fd);
+    g_slice_free(RmFdCacheEntry, entry);
+}
+
+RmFdCache *rm_fd_cache_new(guint max_fds) {
+    RmFdCache *self = g_slice_new0(RmFdCache);
+    self->entries = g_hash_table_new_full(NULL, NULL, NULL,
+                                          (GDestroyNotify)rm_fd_cache_entry_free);
+    g_queue_init(&self->lru);
+    g_mutex_init(&self->lock);
+
+    self->max_fds = (max_fds) ? max_fds : rm_fd_cache_default_limit();
+    rm_log_debug_line("Caching up to %u open files", self->max_fds);
+    return self;
+}
+
+void rm_fd_cache_free(RmFdCache *self) {
+    g_queue_clear(&self->lru);
+    g_hash_table_unref(self->entries);
+    g_mutex_clear(&self->lock);
+    g_slice_free(RmFdCache, self);
+}
+
+/* Close idle descriptors until there is space for a new one.
+ * Call with self->lock held. */
+static void rm_fd_cache_make_room(RmFdCache *self) {
+    while(g_hash_table_size(self->entries) >= self->max_fds && self->lru.length > 0) {
+        RmFdCacheEntry *victim = g_queue_pop_head(&self->lru);
+        g_hash_table_remove(self->entries, victim->key);
+    }
+}
+
+/* Return the cached descriptor of key (marking it used) or -1 */
+static int rm_fd_cache_lookup(RmFdCache *self, gpointer key) {
+    int fd = -1;
+
+    g_mutex_lock(&self->lock);
+    {
+        RmFdCacheEntry *entry = g_hash_table_lookup(self->entries, key);
+        if(entry != NULL) {
+            if(entry->link) {
+                g_queue_delete_link(&self->lru, entry->link);
+                entry->link = NULL;
+            }
+            /* dropped while in use, but wanted again after all */
+            entry->dropped = false;
+            entry->users++;
+            fd = entry->fd;
+        }
+    }
+    g_mutex_unlock(&self->lock);
+
+    return fd;
+}
+
+/* Add a freshly opened fd for key (marked used) and return the descriptor
+ * to use. If another thread was faster, fd is closed and theirs is used. */
+static int rm_fd_cache_insert(RmFdCache *self, gpointer key, int fd) {
+    g_mutex_lock(&self->lock);
+    {
+        RmFdCacheEntry *entry = g_hash_table_lookup(self->entries, key);
+        if(entry != NULL) {
+            /* another thread was faster, or the entry was dropped meanwhile
+             * but is still in use; either way it is the same file */
+            if(entry->link) {
+                g_queue_delete_link(&self->lru, entry->link);
+                entry->link = NULL;
+            }
+            entry->dropped = false;
+            entry->users++;
+            rm_sys_close(fd);
+            fd = entry->fd;
+        } else {
+            rm_fd_cache_make_room(self);
+
+            entry = g_slice_new0(RmFdCacheEntry);
+            entry->key = key;
+            entry->fd = fd;
+            entry->users = 1;
+            g_hash_table_insert(self->entries, key, entry);
+        }
+    }
+    g_mutex_unlock(&self->lock);
+
+    return fd;
+}
+
+/* Get a descriptor of the directory node, opening it relative to its
+ * parent (recursively) if needed. Release with rm_fd_cache_release(). */
+static int rm_fd_cache_get_dir(RmFdCache *self, RmNode *node) {
+    int fd = rm_fd_cache_lookup(self, node);
+    if(fd != -1) {
+        return fd;
+    }
+
+    if(node->parent == NULL) {
+        /* root of the trie */
+        fd = rm_sys_open("/", RM_FD_CACHE_DIR_FLAGS);
+    } else {
+        int parent_fd = rm_fd_cache_get_dir(self, node->parent);
+        if(parent_fd == -1) {
+            return -1;
+        }
+
+        fd = rm_sys_openat(parent_fd, node->basename, RM_FD_CACHE_DIR_FLAGS);
+        rm_fd_cache_release(self, node->parent);
+    }
+
+    if(fd == -1) {
+        return -1;
+    }
+
+    return rm_fd_cache_insert(self, node, fd);
+}
+
+int rm_fd_cache_get(RmFdCache *self, gpointer key, const char *path) {
+    int fd = rm_fd_cache_lookup(self, key);
+    if(fd != -1 || path == NULL) {
+        return fd;
+    }
+
+    /* open() may be slow (network filesystems), so do not hold the lock.
+     * The same key is never requested by two threads at once. */
+    fd = rm_sys_open(path, O_RDONLY);
+    if(fd == -1) {
+        return -1;
+    }
+
+    return rm_fd_cache_insert(self, key, fd);
+}
+
+int rm_fd_cache_get_at(RmFdCache *self, gpointer key, RmNode *node) {
+    int fd = rm_fd_cache_lookup(self, key);
+    if(fd != -1 || node == NULL || node->parent == NULL) {
+        return fd;
+    }
+
+    int dir_fd = rm_fd_cache_get_dir(self, node->parent);
+    if(dir_fd == -1) {
+        return -1;
+    }
+
+    fd = rm_sys_openat(dir_fd, node->basename, O_RDONLY);
+    rm_fd_cache_release(self, node->parent);
+
+    if(fd == -1) {
+        return -1;
+    }
+
+    return rm_fd_cache_insert(self, key, fd);
+}
+
+void rm_fd_cache_release(RmFdCache *self, gpointer key) {
+    g_mutex_lock(&self->lock);
+    {
+        RmFdCacheEntry *entry = g_hash_table_lookup(self->entries, key);
+        if(entry != NULL && entry->users > 0 && --entry->users == 0) {
+            if(entry->dropped || self->max_fds == 0) {
+                g_hash_table_remove(self->entries, key);
+            } else {
+                g_queue_push_tail(&self->lru, entry);
+                entry->link = self->lru.tail;
+            }
+        }
+    }
+    g_mutex_unlock(&self->lock);
+}
+
+void rm_fd_cache_drop(RmFdCache *self, gpointer key) {
+    g_mutex_lock(&self->lock);
+    {
+        RmFdCacheEntry *entry = g_hash_table_lookup(self->entries, key);
+        if(entry == NULL) {
+            /* nothing to do */
+        } else if(entry->users > 0) {
+            entry->dropped = true;
+        } else {
+            g_queue_delete_link(&self->lru, entry->link);
+            g_hash_table_remove(self->entries, key);
+        }
+    }
+    g_mutex_unlock(&self->lock);
+}
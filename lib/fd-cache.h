@@ -0,0 +1,115 @@
+/*
+ *  This file is part of rmlint.
+ *
+ *  rmlint is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  rmlint is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with rmlint.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *
+ *  - Christopher <sahib> Pahl 2010-2020 (https://github.com/sahib)
+ *  - Daniel <SeeSpotRun> T.   2014-2020 (https://github.com/SeeSpotRun)
+ *
+ * Hosted on http://github.com/sahib/rmlint
+ *
+ */
+
+#ifndef RM_FD_CACHE_H
+#define RM_FD_CACHE_H
+
+#include <glib.h>
+
+#include "pathtricia.h"
+
+/**
+ * @file fd-cache.h
+ * @brief Bounded cache of open file descriptors.
+ *
+ * Files that are read in several increments (e.g. by the shredder) are
+ * otherwise opened and closed once per increment. On network filesystems
+ * every open(2) is a round-trip, so the descriptors are kept open here
+ * between increments.
+ *
+ * Files can also be opened relative to the directory they are in
+ * (rm_fd_cache_get_at()). Descriptors of those directories are cached
+ * as well, so the kernel does not need to resolve every component of
+ * a (deep) path again and the path does not need to be built at all.
+ *
+ * Descriptors are identified by an arbitrary key (usually a RmFile).
+ * A descriptor handed out by rm_fd_cache_get() is marked busy and will
+ * not be closed until rm_fd_cache_release() is called. If the cache is
+ * full, the least recently used idle descriptor is closed.
+ *
+ * Typical workflow:
+ *
+ *     RmFdCache *cache = rm_fd_cache_new(0);
+ *     int fd = rm_fd_cache_get(cache, file, file_path);
+ *     ...read from fd...
+ *     rm_fd_cache_release(cache, file);
+ *     ...
+ *     rm_fd_cache_drop(cache, file);   // file not needed anymore
+ *     rm_fd_cache_free(cache);
+ *
+ * All functions are threadsafe.
+ **/
+
+typedef struct _RmFdCache RmFdCache;
+
+/**
+ * @brief Allocate a new cache.
+ *
+ * @param max_fds Maximum number of open descriptors; if 0, a limit
+ *        is derived from RLIMIT_NOFILE.
+ **/
+RmFdCache *rm_fd_cache_new(guint max_fds);
+
+/**
+ * @brief Close all cached descriptors and free the cache.
+ **/
+void rm_fd_cache_free(RmFdCache *self);
+
+/**
+ * @brief Get a (read-only) descriptor for key, opening path if needed.
+ *
+ * The descriptor is marked busy until rm_fd_cache_release() is called.
+ *
+ * @param path Path to open if key has no descriptor yet; if NULL only
+ *        an already open descriptor is returned.
+ * @retval the descriptor or -1 on error (errno is set by open(2)).
+ **/
+int rm_fd_cache_get(RmFdCache *self, gpointer key, const char *path);
+
+/**
+ * @brief Like rm_fd_cache_get(), but open the file relative to its directory.
+ *
+ * @param node The file's node in the path trie (RmFile.folder). The
+ *        descriptors of node's parent directories are cached too.
+ * @retval the descriptor or -1 on error; callers may retry by path then.
+ **/
+int rm_fd_cache_get_at(RmFdCache *self, gpointer key, RmNode *node);
+
+/**
+ * @brief Mark the descriptor of key as idle; it may be closed from now on.
+ **/
+void rm_fd_cache_release(RmFdCache *self, gpointer key);
+
+/**
+ * @brief Close the descriptor of key (if any).
+ *
+ * If it is still busy, it is closed on rm_fd_cache_release(), unless key
+ * is requested again before that.
+ * Keys must be dropped before the object they point to is freed; otherwise
+ * a new object at the same address would get the old descriptor.
+ **/
+void rm_fd_cache_drop(RmFdCache *self, gpointer key);
+
+#endif /* end of include guard */
@@ -31,8 +31,9 @@
 #include <sys/file.h>
 #include <unistd.h>
 
-RmFile *rm_file_new(struct RmSession *session, const char *path, RmStat *statp,
-                    RmLintType type, bool is_ppath, unsigned path_index, short depth) {
+RmFile *rm_file_new(struct RmSession *session, const char *path, RmNode *parent,
+                    RmStat *statp, RmLintType type, bool is_ppath, unsigned path_index,
+                    short depth) {
     RmCfg *cfg = session->cfg;
     RmOff actual_file_size = statp->st_size;
     RmOff start_seek = 0;
@@ -59,7 +60,14 @@ RmFile *rm_file_new(struct RmSession *session, const char *path, RmStat *statp,
     RmFile *self = g_slice_new0(RmFile);
     self->session = session;
 
-    rm_file_set_path(self, (char *)path);
+    if(parent) {
+        /* saves walking the trie down from the root */
+        const char *basename = strrchr(path, '/');
+        self->folder = rm_trie_insert_at(&cfg->file_trie, parent,
+                                         (basename) ? basename + 1 : path, self);
+    } else {
+        rm_file_set_path(self, (char *)path);
+    }
 
     self->depth = depth;
     self->path_depth = rm_util_path_depth(path);
@@ -188,6 +188,13 @@ typedef struct RmFile {
     /* Set to true if file belongs to a subvolume-capable filesystem eg btrfs */
     bool is_on_subvol_fs : 1;
 
+    /* Set to true once disk_offset holds the physical offset of the file */
+    bool has_disk_offset : 1;
+
+    /* Set if the next increment has to be hashed from the start of the file
+     * (switch from the fast to the strong digest in the shredder) */
+    bool rehash_from_start : 1;
+
     /* The pre-matched file cluster that this file belongs to (or NULL) */
     GQueue *cluster;
 
@@ -236,11 +243,13 @@ typedef struct RmFile {
          */
         gint64 twin_count;
 
-        /* Disk fiemap / physical offset at start of file (tests mapping subsequent
-         * file fragments did not deliver any significant additionl benefit) */
+        /* Disk fiemap / physical offset of the next hash increment */
         RmOff disk_offset;
     };
 
+    /* Logical offset where the fragment containing disk_offset ends */
+    RmOff fragment_end;
+
     /* What kind of lint this file is.
      */
     RmLintType lint_type;
@@ -303,9 +312,13 @@ typedef struct RmFile {
 
 /**
  * @brief Create a new RmFile handle.
+ *
+ * @param parent trie node of the directory containing path; if NULL, the
+ *        full path is inserted into the file trie.
  */
-RmFile *rm_file_new(struct RmSession *session, const char *path, RmStat *statp,
-                    RmLintType type, bool is_ppath, unsigned pnum, short depth);
+RmFile *rm_file_new(struct RmSession *session, const char *path, RmNode *parent,
+                    RmStat *statp, RmLintType type, bool is_ppath, unsigned pnum,
+                    short depth);
 
 /**
  * @brief Deallocate the memory allocated by rm_file_new.
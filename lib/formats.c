@@ -56,6 +56,167 @@ static void rm_fmt_group_destroy(_UNUSED RmFmtTable *self, RmFmtGroup *group) {
     g_slice_free(RmFmtGroup, group);
 }
 
+static gint rm_fmt_rank(const RmFmtGroup *ga, const RmFmtGroup *gb, RmFmtTable *self);
+
+/* A sorted run of groups that was written to a temporary file.
+ * The RmFiles are dumped as raw structs, which is fine since the run
+ * is read back by the same process: pointers to the path trie and digests
+ * stay valid, only the RmFile itself is freed.
+ * Files with hardlinks stay in memory and only their address is dumped:
+ * they are members of a shared file->hardlinks queue, whose head is printed
+ * by other groups (json, binary) at any time.
+ */
+typedef struct RmFmtRun {
+    /* Temporary file holding the dumped groups, NULL for the in-memory run */
+    FILE *fd;
+
+    /* Next group of this run, waiting to be merged */
+    RmFmtGroup *head;
+} RmFmtRun;
+
+static bool rm_fmt_needs_sort(RmFmtTable *self) {
+    RmCfg *cfg = self->session->cfg;
+    return *(cfg->rank_criteria) || cfg->replay;
+}
+
+static void rm_fmt_group_dump(RmFmtGroup *group, FILE *fd) {
+    guint32 n_files = group->files.length;
+    fwrite(&n_files, sizeof(n_files), 1, fd);
+    fwrite(&group->index, sizeof(group->index), 1, fd);
+
+    for(GList *iter = group->files.head; iter; iter = iter->next) {
+        RmFile *file = iter->data;
+        guint8 resident = (file->hardlinks != NULL);
+
+        fwrite(&file, sizeof(file), 1, fd);
+        fwrite(&resident, sizeof(resident), 1, fd);
+        if(!resident) {
+            fwrite(file, sizeof(RmFile), 1, fd);
+        }
+    }
+}
+
+static RmFmtGroup *rm_fmt_group_load(FILE *fd) {
+    guint32 n_files = 0;
+    if(fread(&n_files, sizeof(n_files), 1, fd) != 1) {
+        return NULL;
+    }
+
+    RmFmtGroup *group = rm_fmt_group_new();
+    if(fread(&group->index, sizeof(group->index), 1, fd) != 1) {
+        n_files = 0;
+    }
+
+    for(guint32 i = 0; i < n_files; ++i) {
+        RmFile *file = NULL;
+        guint8 resident = 0;
+
+        if(fread(&file, sizeof(file), 1, fd) != 1 ||
+           fread(&resident, sizeof(resident), 1, fd) != 1) {
+            rm_log_error_line(_("Truncated spill file; some results are missing."));
+            break;
+        }
+
+        if(!resident) {
+            file = g_slice_new(RmFile);
+            if(fread(file, sizeof(RmFile), 1, fd) != 1) {
+                rm_log_error_line(_("Truncated spill file; some results are missing."));
+                g_slice_free(RmFile, file);
+                break;
+            }
+        }
+
+        g_queue_push_tail(&group->files, file);
+    }
+
+    if(group->files.length == 0) {
+        g_slice_free(RmFmtGroup, group);
+        return NULL;
+    }
+
+    return group;
+}
+
+/* Write all currently held groups (sorted if needed) to a temporary file
+ * and free the RmFiles. This keeps memory bounded if there are very many
+ * results to hold back until rm_fmt_flush().
+ */
+static void rm_fmt_spill(RmFmtTable *self) {
+    if(self->spill_failed || self->groups.length == 0) {
+        return;
+    }
+
+    FILE *fd = tmpfile();
+    if(fd == NULL) {
+        rm_log_perror(_("Unable to create spill file; holding results in memory"));
+        self->spill_failed = true;
+        return;
+    }
+
+    if(rm_fmt_needs_sort(self)) {
+        g_queue_sort(&self->groups, (GCompareDataFunc)rm_fmt_rank, self);
+    }
+
+    for(GList *iter = self->groups.head; iter; iter = iter->next) {
+        rm_fmt_group_dump(iter->data, fd);
+    }
+
+    if(fflush(fd) != 0 || ferror(fd)) {
+        rm_log_perror(_("Unable to write spill file; holding results in memory"));
+        self->spill_failed = true;
+        fclose(fd);
+        return;
+    }
+
+    rewind(fd);
+
+    rm_log_debug_line("Spilled %" LLU " held back files in %u groups to disk",
+                      self->n_cached, self->groups.length);
+
+    for(GList *iter = self->groups.head; iter; iter = iter->next) {
+        RmFmtGroup *group = iter->data;
+
+        /* Do not use rm_file_destroy(): the owned fields live on in the run */
+        for(GList *file_iter = group->files.head; file_iter; file_iter = file_iter->next) {
+            RmFile *file = file_iter->data;
+            if(file->hardlinks == NULL) {
+                g_slice_free(RmFile, file);
+            }
+        }
+
+        g_queue_clear(&group->files);
+        g_slice_free(RmFmtGroup, group);
+    }
+
+    g_queue_clear(&self->groups);
+    self->n_cached = 0;
+
+    RmFmtRun *run = g_slice_new0(RmFmtRun);
+    run->fd = fd;
+    g_queue_push_tail(&self->runs, run);
+}
+
+static RmFmtGroup *rm_fmt_run_next(RmFmtTable *self, RmFmtRun *run) {
+    if(run->fd == NULL) {
+        return g_queue_pop_head(&self->groups);
+    }
+
+    return rm_fmt_group_load(run->fd);
+}
+
+static void rm_fmt_run_free(RmFmtTable *self, RmFmtRun *run) {
+    /* Drain the run, so the files and their fields are freed properly */
+    for(; run->head; run->head = rm_fmt_run_next(self, run)) {
+        rm_fmt_group_destroy(self, run->head);
+    }
+
+    if(run->fd) {
+        fclose(run->fd);
+    }
+
+    g_slice_free(RmFmtRun, run);
+}
+
 static void rm_fmt_handler_free(RmFmtHandler *handler) {
     g_assert(handler);
     g_free(handler->path);
@@ -82,6 +243,8 @@ RmFmtTable *rm_fmt_open(RmSession *session) {
 
     self->session = session;
     g_queue_init(&self->groups);
+    g_queue_init(&self->runs);
+    g_queue_init(&self->resident);
     g_rec_mutex_init(&self->state_mtx);
 
     extern RmFmtHandler *PROGRESS_HANDLER;
@@ -105,6 +268,9 @@ RmFmtTable *rm_fmt_open(RmSession *session) {
     extern RmFmtHandler *JSON_HANDLER;
     rm_fmt_register(self, JSON_HANDLER);
 
+    extern RmFmtHandler *BINARY_HANDLER;
+    rm_fmt_register(self, BINARY_HANDLER);
+
     extern RmFmtHandler *PY_HANDLER;
     rm_fmt_register(self, PY_HANDLER);
 
@@ -416,23 +582,106 @@ static gint rm_fmt_rank(const RmFmtGroup *ga, const RmFmtGroup *gb, RmFmtTable *
     return 0;
 }
 
+/* Write a group that was merged from the runs. Files without hardlinks are
+ * freed right away (nothing else refers to them); the others are kept until
+ * rm_fmt_close(), since later groups might still print them as hardlink head.
+ */
+static void rm_fmt_write_group(RmFmtTable *self, RmFmtGroup *group) {
+    g_queue_foreach(&group->files, (GFunc)rm_fmt_write_impl, self);
+
+    for(GList *iter = group->files.head; iter; iter = iter->next) {
+        RmFile *file = iter->data;
+        if(file->hardlinks) {
+            g_queue_push_tail(&self->resident, file);
+        } else {
+            rm_file_destroy(file);
+        }
+    }
+
+    g_queue_clear(&group->files);
+    g_slice_free(RmFmtGroup, group);
+}
+
 void rm_fmt_flush(RmFmtTable *self) {
     RmCfg *cfg = self->session->cfg;
     if(!cfg->cache_file_structs) {
         return;
     }
 
-    if(*(cfg->rank_criteria) || cfg->replay) {
+    bool needs_sort = rm_fmt_needs_sort(self);
+    if(needs_sort) {
         g_queue_sort(&self->groups, (GCompareDataFunc)rm_fmt_rank, self);
     }
 
-    for(GList *iter = self->groups.head; iter; iter = iter->next) {
-        RmFmtGroup *group = iter->data;
-        g_queue_foreach(&group->files, (GFunc)rm_fmt_write_impl, self);
+    if(self->runs.length == 0) {
+        /* nothing was spilled; the groups are freed by rm_fmt_close() */
+        for(GList *iter = self->groups.head; iter; iter = iter->next) {
+            RmFmtGroup *group = iter->data;
+            g_queue_foreach(&group->files, (GFunc)rm_fmt_write_impl, self);
+        }
+        return;
+    }
+
+    /* The groups still in memory form the last run */
+    RmFmtRun *mem_run = g_slice_new0(RmFmtRun);
+    g_queue_push_tail(&self->runs, mem_run);
+
+    for(GList *iter = self->runs.head; iter; iter = iter->next) {
+        RmFmtRun *run = iter->data;
+        run->head = rm_fmt_run_next(self, run);
     }
+
+    /* k-way merge of the runs. On equal rank the earlier run wins,
+     * so the output is the same as sorting everything in memory.
+     * Without sorting the runs are just concatenated.
+     */
+    while(true) {
+        RmFmtRun *best = NULL;
+        for(GList *iter = self->runs.head; iter; iter = iter->next) {
+            RmFmtRun *run = iter->data;
+            if(run->head == NULL) {
+                continue;
+            }
+
+            if(best == NULL) {
+                best = run;
+                if(!needs_sort) {
+                    break;
+                }
+            } else if(rm_fmt_rank(run->head, best->head, self) < 0) {
+                best = run;
+            }
+        }
+
+        if(best == NULL) {
+            break;
+        }
+
+        rm_fmt_write_group(self, best->head);
+        best->head = rm_fmt_run_next(self, best);
+    }
+
+    for(GList *iter = self->runs.head; iter; iter = iter->next) {
+        rm_fmt_run_free(self, iter->data);
+    }
+
+    g_queue_clear(&self->runs);
+    self->n_cached = 0;
 }
 
 void rm_fmt_close(RmFmtTable *self) {
+    for(GList *iter = self->runs.head; iter; iter = iter->next) {
+        RmFmtRun *run = iter->data;
+        if(run->fd) {
+            run->head = rm_fmt_run_next(self, run);
+            rm_fmt_run_free(self, run);
+        } else {
+            g_slice_free(RmFmtRun, run);
+        }
+    }
+
+    g_queue_clear(&self->runs);
+
     for(GList *iter = self->groups.head; iter; iter = iter->next) {
         RmFmtGroup *group = iter->data;
         rm_fmt_group_destroy(self, group);
@@ -440,6 +689,9 @@ void rm_fmt_close(RmFmtTable *self) {
 
     g_queue_clear(&self->groups);
 
+    g_queue_foreach(&self->resident, (GFunc)rm_file_destroy, NULL);
+    g_queue_clear(&self->resident);
+
     RM_FMT_FOR_EACH_HANDLER_BEGIN(self) {
         RM_FMT_CALLBACK(handler->foot);
         fclose(file);
@@ -469,13 +721,19 @@ void rm_fmt_write(RmFile *result, RmFmtTable *self) {
         rm_fmt_write_impl(result, self);
     } else {
         if(result->is_original || self->groups.length == 0) {
-            g_queue_push_tail(&self->groups, rm_fmt_group_new());
+            /* The last group is complete now; a good time to spill */
+            if(self->n_cached >= self->session->cfg->spill_count) {
+                rm_fmt_spill(self);
+            }
+
+            RmFmtGroup *group = rm_fmt_group_new();
+            group->index = self->n_groups++;
+            g_queue_push_tail(&self->groups, group);
         }
 
         RmFmtGroup *group = self->groups.tail->data;
-        group->index = self->groups.length - 1;
-
         g_queue_push_tail(&group->files, result);
+        self->n_cached++;
     }
 }
 
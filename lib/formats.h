@@ -63,6 +63,22 @@ typedef struct RmFmtTable {
 
     /* Group of RmFiles that will be cached until exit */
     GQueue groups;
+
+    /* Number of RmFiles currently held in groups */
+    RmOff n_cached;
+
+    /* Total number of groups created so far (used as group index) */
+    gint n_groups;
+
+    /* Sorted runs of groups that were spilled to disk to save memory */
+    GQueue runs;
+
+    /* Files with hardlinks that were written by rm_fmt_flush(); they are
+     * kept until rm_fmt_close(), see rm_fmt_write_group() */
+    GQueue resident;
+
+    /* Set when spilling failed once; everything is held in memory then */
+    bool spill_failed;
 } RmFmtTable;
 
 /* Callback definitions */
@@ -142,6 +158,9 @@ void rm_fmt_close(RmFmtTable *self);
  *        all files written by rm_fmt_write can
  *        be flushed at once with this function.
  *
+ * Groups that were spilled to disk during rm_fmt_write() are merged
+ * back in rank order. Every group is freed right after it was written.
+ *
  * @param self
  */
 void rm_fmt_flush(RmFmtTable *self);
@@ -0,0 +1,249 @@
+/*
+ *  This file is part of rmlint.
+ *
+ *  rmlint is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  rmlint is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with rmlint.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *
+ *  - Christopher <sahib> Pahl 2010-2020 (https://github.com/sahib)
+ *  - Daniel <SeeSpotRun> T.   2014-2020 (https://github.com/SeeSpotRun)
+ *
+ * Hosted on http://github.com/sahib/rmlint
+ *
+ */
+
+#include "../formats.h"
+#include "../preprocess.h"
+#include "../treemerge.h"
+#include "binary.h"
+
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef struct RmFmtHandlerBinary {
+    /* must be first */
+    RmFmtHandler parent;
+
+    /* Map of RmNode (directory) to its id */
+    GHashTable *dir_ids;
+    guint32 last_dir_id;
+
+    /* Number of bytes written so far (ftell() does not work on pipes) */
+    guint64 offset;
+
+    /* Offsets of all GROUP records */
+    GArray *group_offsets;
+
+    /* Type of the last written file; a change starts a new group */
+    RmLintType last_type;
+} RmFmtHandlerBinary;
+
+//////////////////////////////////////////
+//       LOW LEVEL WRITE HELPERS        //
+//////////////////////////////////////////
+
+static void rm_fmt_bin_write(RmFmtHandlerBinary *self, FILE *out, const void *data,
+                             size_t len) {
+    self->offset += fwrite(data, 1, len, out);
+}
+
+#define RM_FMT_BIN_WRITE_FUNC(name, type)                                   \
+    static void rm_fmt_bin_##name(RmFmtHandlerBinary *self, FILE *out, \
+                                  type value) {                        \
+        rm_fmt_bin_write(self, out, &value, sizeof(value));            \
+    }
+
+RM_FMT_BIN_WRITE_FUNC(u8, guint8)
+RM_FMT_BIN_WRITE_FUNC(u16, guint16)
+RM_FMT_BIN_WRITE_FUNC(u32, guint32)
+RM_FMT_BIN_WRITE_FUNC(u64, guint64)
+RM_FMT_BIN_WRITE_FUNC(i16, gint16)
+RM_FMT_BIN_WRITE_FUNC(f64, gdouble)
+
+static void rm_fmt_bin_string(RmFmtHandlerBinary *self, FILE *out, const char *string) {
+    guint16 len = (string) ? MIN(strlen(string), G_MAXUINT16) : 0;
+    rm_fmt_bin_u16(self, out, len);
+    rm_fmt_bin_write(self, out, string, len);
+}
+
+//////////////////////////////////////////
+//     DIRECTORY AND GROUP RECORDS      //
+//////////////////////////////////////////
+
+/* Return the id of the directory node, writing a DIR record (and the
+ * ones of its parents) if it was not seen before. Each directory is
+ * written only once, files only store the id and their basename.
+ */
+static guint32 rm_fmt_bin_dir_id(RmFmtHandlerBinary *self, FILE *out, RmNode *node) {
+    if(node == NULL || node->parent == NULL) {
+        /* The root node */
+        return 0;
+    }
+
+    guint32 id = GPOINTER_TO_UINT(g_hash_table_lookup(self->dir_ids, node));
+    if(id != 0) {
+        return id;
+    }
+
+    guint32 parent_id = rm_fmt_bin_dir_id(self, out, node->parent);
+    id = ++self->last_dir_id;
+    g_hash_table_insert(self->dir_ids, node, GUINT_TO_POINTER(id));
+
+    rm_fmt_bin_u8(self, out, RM_FMT_BIN_TAG_DIR);
+    rm_fmt_bin_u32(self, out, id);
+    rm_fmt_bin_u32(self, out, parent_id);
+    rm_fmt_bin_string(self, out, node->basename);
+    return id;
+}
+
+static void rm_fmt_bin_group(RmFmtHandlerBinary *self, FILE *out) {
+    g_array_append_val(self->group_offsets, self->offset);
+    rm_fmt_bin_u8(self, out, RM_FMT_BIN_TAG_GROUP);
+}
+
+//////////////////////////////////////////
+//          HANDLER CALLBACKS           //
+//////////////////////////////////////////
+
+static void rm_fmt_head(RmSession *session, RmFmtHandler *parent, FILE *out) {
+    RmFmtHandlerBinary *self = (RmFmtHandlerBinary *)parent;
+
+    self->dir_ids = g_hash_table_new(NULL, NULL);
+    self->group_offsets = g_array_new(FALSE, FALSE, sizeof(guint64));
+    self->last_type = RM_LINT_TYPE_UNKNOWN;
+
+    rm_fmt_bin_write(self, out, RM_FMT_BIN_MAGIC, RM_FMT_BIN_MAGIC_LEN);
+    rm_fmt_bin_u32(self, out, RM_FMT_BIN_VERSION);
+    rm_fmt_bin_u32(self, out, RM_FMT_BIN_BYTE_ORDER);
+    rm_fmt_bin_u8(self, out, session->cfg->merge_directories);
+
+    const char *checksum_type = rm_digest_type_to_string(session->cfg->checksum_type);
+    rm_fmt_bin_u8(self, out, strlen(checksum_type));
+    rm_fmt_bin_write(self, out, checksum_type, strlen(checksum_type));
+}
+
+static void rm_fmt_elem(RmSession *session, RmFmtHandler *parent, FILE *out,
+                        RmFile *file) {
+    RmFmtHandlerBinary *self = (RmFmtHandlerBinary *)parent;
+
+    if(file->lint_type == RM_LINT_TYPE_UNIQUE_FILE) {
+        if(!rm_fmt_get_config_value(session->formats, "binary", "unique")) {
+            if(!file->digest || !session->cfg->write_unfinished) {
+                return;
+            }
+        }
+
+        if(session->cfg->keep_all_tagged && !file->is_prefd) {
+            /* don't list 'untagged' files as unique */
+            file->is_original = false;
+        } else if(session->cfg->keep_all_untagged && file->is_prefd) {
+            /* don't list 'tagged' files as unique */
+            file->is_original = false;
+        } else {
+            file->is_original = true;
+        }
+    }
+
+    if(file->folder == NULL) {
+        return;
+    }
+
+    if(file->is_original || file->lint_type != self->last_type) {
+        rm_fmt_bin_group(self, out);
+        self->last_type = file->lint_type;
+    }
+
+    guint32 dir_id = rm_fmt_bin_dir_id(self, out, file->folder->parent);
+
+    guint8 flags = 0;
+    if(file->is_original) {
+        flags |= RM_FMT_BIN_FLAG_ORIGINAL;
+    }
+
+    if(file->is_symlink) {
+        flags |= RM_FMT_BIN_FLAG_SYMLINK;
+    }
+
+    if(session->cfg->find_hardlinked_dupes && file->digest) {
+        RmFile *hardlink_head = RM_FILE_HARDLINK_HEAD(file);
+        if(hardlink_head && hardlink_head != file) {
+            flags |= RM_FMT_BIN_FLAG_HARDLINK;
+        }
+    }
+
+    rm_fmt_bin_u8(self, out, RM_FMT_BIN_TAG_FILE);
+    rm_fmt_bin_u32(self, out, dir_id);
+    rm_fmt_bin_string(self, out, file->folder->basename);
+    rm_fmt_bin_u8(self, out, file->lint_type);
+    rm_fmt_bin_u8(self, out, flags);
+    rm_fmt_bin_u64(self, out, file->actual_file_size);
+    rm_fmt_bin_u64(self, out, file->inode);
+    rm_fmt_bin_u64(self, out, file->dev);
+    rm_fmt_bin_f64(self, out, file->mtime);
+    rm_fmt_bin_i16(self, out, file->depth);
+    rm_fmt_bin_u64(self, out, file->n_children);
+
+    if(file->digest) {
+        /* Raw bytes instead of hex; half the size of the json checksum */
+        guint32 digest_len = rm_digest_get_bytes(file->digest);
+        guint8 *digest_buf = rm_digest_steal(file->digest);
+        rm_fmt_bin_u32(self, out, digest_len);
+        rm_fmt_bin_write(self, out, digest_buf, digest_len);
+        g_slice_free1(digest_len, digest_buf);
+    } else {
+        rm_fmt_bin_u32(self, out, 0);
+    }
+
+    if(file->lint_type == RM_LINT_TYPE_PART_OF_DIRECTORY && file->parent_dir) {
+        rm_fmt_bin_string(self, out, rm_directory_get_dirname(file->parent_dir));
+    } else {
+        rm_fmt_bin_string(self, out, NULL);
+    }
+}
+
+static void rm_fmt_foot(_UNUSED RmSession *session, RmFmtHandler *parent, FILE *out) {
+    RmFmtHandlerBinary *self = (RmFmtHandlerBinary *)parent;
+
+    guint64 end_offset = self->offset;
+    rm_fmt_bin_u8(self, out, RM_FMT_BIN_TAG_END);
+    rm_fmt_bin_u8(self, out, rm_session_was_aborted());
+    rm_fmt_bin_u64(self, out, self->group_offsets->len);
+    rm_fmt_bin_write(self, out, self->group_offsets->data,
+                     self->group_offsets->len * sizeof(guint64));
+    rm_fmt_bin_u64(self, out, end_offset);
+
+    g_hash_table_unref(self->dir_ids);
+    g_array_free(self->group_offsets, TRUE);
+}
+
+static RmFmtHandlerBinary BINARY_HANDLER_IMPL = {
+    /* Initialize parent */
+    .parent =
+        {
+            .size = sizeof(BINARY_HANDLER_IMPL),
+            .name = "binary",
+            .head = rm_fmt_head,
+            .elem = rm_fmt_elem,
+            .prog = NULL,
+            .foot = rm_fmt_foot,
+            .valid_keys = {"unique", NULL},
+        },
+    .dir_ids = NULL,
+    .last_dir_id = 0,
+    .offset = 0,
+    .group_offsets = NULL,
+    .last_type = RM_LINT_TYPE_UNKNOWN};
+
+RmFmtHandler *BINARY_HANDLER = (RmFmtHandler *)&BINARY_HANDLER_IMPL;
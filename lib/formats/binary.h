@@ -0,0 +1,82 @@
+/*
+ *  This file is part of rmlint.
+ *
+ *  rmlint is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  rmlint is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with rmlint.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *
+ *  - Christopher <sahib> Pahl 2010-2020 (https://github.com/sahib)
+ *  - Daniel <SeeSpotRun> T.   2014-2020 (https://github.com/SeeSpotRun)
+ *
+ * Hosted on http://github.com/sahib/rmlint
+ *
+ */
+
+#ifndef RM_FMT_BINARY_H
+#define RM_FMT_BINARY_H
+
+/* Layout of the binary result format written by the "binary" formatter
+ * and read back by --replay. All integers are in host byte order; the
+ * header contains RM_FMT_BIN_BYTE_ORDER so readers can detect a mismatch.
+ *
+ * Header:
+ *   char[8]  RM_FMT_BIN_MAGIC
+ *   guint32  RM_FMT_BIN_VERSION
+ *   guint32  RM_FMT_BIN_BYTE_ORDER
+ *   guint8   merge_directories (0 or 1)
+ *   guint8   length of the checksum type name, followed by the name
+ *
+ * Records; each starts with one RmFmtBinTag byte:
+ *
+ *   DIR:   guint32 id, guint32 parent_id, guint16 len, char[len] basename
+ *          Written once before the first file in it. Id 0 is "/".
+ *   GROUP: (no payload) Starts a new group of files.
+ *   FILE:  guint32 dir_id, guint16 len, char[len] basename,
+ *          guint8 lint_type, guint8 flags (RmFmtBinFlags),
+ *          guint64 size, guint64 inode, guint64 dev, gdouble mtime,
+ *          gint16 depth, guint64 n_children,
+ *          guint32 len, guint8[len] raw checksum,
+ *          guint16 len, char[len] parent_path (part_of_directory only)
+ *   END:   guint8 aborted, guint64 n_groups, guint64[n_groups] offsets
+ *          of the GROUP records, guint64 offset of the END record.
+ *
+ * The last 8 bytes make it possible to find the group index from the end.
+ */
+
+#define RM_FMT_BIN_MAGIC "RMLINTB\n"
+#define RM_FMT_BIN_MAGIC_LEN 8
+#define RM_FMT_BIN_VERSION 1
+#define RM_FMT_BIN_BYTE_ORDER 0x01020304
+
+/* Longest raw checksum in a FILE record; ext digests keep their length in a
+ * guint8, all others are shorter */
+#define RM_FMT_BIN_MAX_CKSUM_LEN (G_MAXUINT8)
+
+/* Suffix of binary files that are accepted by --replay */
+#define RM_FMT_BIN_SUFFIX ".rmbin"
+
+typedef enum RmFmtBinTag {
+    RM_FMT_BIN_TAG_DIR = 'D',
+    RM_FMT_BIN_TAG_GROUP = 'G',
+    RM_FMT_BIN_TAG_FILE = 'F',
+    RM_FMT_BIN_TAG_END = 'E',
+} RmFmtBinTag;
+
+typedef enum RmFmtBinFlags {
+    RM_FMT_BIN_FLAG_ORIGINAL = 1 << 0,
+    RM_FMT_BIN_FLAG_HARDLINK = 1 << 1,
+    RM_FMT_BIN_FLAG_SYMLINK = 1 << 2,
+} RmFmtBinFlags;
+
+#endif /* end of include guard */
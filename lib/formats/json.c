@@ -24,6 +24,7 @@
  */
 
 #include "../checksums/murmur3.h"
+#include "../chunker.h"
 #include "../formats.h"
 #include "../preprocess.h"
 #include "../utilities.h"
@@ -144,18 +145,34 @@ static bool rm_fmt_json_fix(const char *string, char *fixed, size_t fixed_len) {
     return (size_t)(safe_iter - fixed) < fixed_len;
 }
 
-static void rm_fmt_json_key_unsafe(FILE *out, const char *key, const char *value) {
+static void rm_fmt_json_string_unsafe(FILE *out, const char *value) {
     char safe_value[PATH_MAX + 4 + 1];
     memset(safe_value, 0, sizeof(safe_value));
 
     if(rm_fmt_json_fix(value, safe_value, sizeof(safe_value))) {
-        fprintf(out, "\"%s\": \"%s\"", key, safe_value);
+        fprintf(out, "\"%s\"", safe_value);
     } else {
         /* This should never happen but give at least means of debugging */
-        fprintf(out, "\"%s\": \"<BROKEN PATH>\"", key);
+        fprintf(out, "\"<BROKEN PATH>\"");
     }
 }
 
+static void rm_fmt_json_key_unsafe(FILE *out, const char *key, const char *value) {
+    fprintf(out, "\"%s\": ", key);
+    rm_fmt_json_string_unsafe(out, value);
+}
+
+static void rm_fmt_json_path_list(FILE *out, const GQueue *paths) {
+    fprintf(out, "[");
+    for(GList *iter = paths->head; iter; iter = iter->next) {
+        rm_fmt_json_string_unsafe(out, iter->data);
+        if(iter->next) {
+            fprintf(out, ", ");
+        }
+    }
+    fprintf(out, "]");
+}
+
 static void rm_fmt_json_open(RmFmtHandlerJSON *self, FILE *out) {
     fprintf(out, "{%s", self->pretty ? "\n  " : "");
 }
@@ -215,6 +232,66 @@ static void rm_fmt_head(RmSession *session, _UNUSED RmFmtHandler *parent, FILE *
     }
 }
 
+static void rm_fmt_json_similar_dirs(RmFmtHandlerJSON *self, FILE *out,
+                                     const GQueue *similar_dirs) {
+    fprintf(out, "\"similar_directories\": [");
+    for(GList *iter = similar_dirs->head; iter; iter = iter->next) {
+        RmSimilarDirs *similar = iter->data;
+        fprintf(out, "%s{", self->pretty ? "\n    " : "");
+        fprintf(out, "\"paths\": [");
+        rm_fmt_json_string_unsafe(out, similar->paths[0]);
+        fprintf(out, ", ");
+        rm_fmt_json_string_unsafe(out, similar->paths[1]);
+        fprintf(out, "], ");
+        rm_fmt_json_key_float(out, "similarity", similar->similarity);
+        fprintf(out, ", ");
+        rm_fmt_json_key_int(out, "shared_files", similar->shared);
+        fprintf(out, ", \"differing\": [");
+        rm_fmt_json_path_list(out, &similar->differing[0]);
+        fprintf(out, ", ");
+        rm_fmt_json_path_list(out, &similar->differing[1]);
+        fprintf(out, "]}%s", iter->next ? "," : "");
+    }
+    fprintf(out, "%s]", (self->pretty && similar_dirs->length) ? "\n  " : "");
+}
+
+static void rm_fmt_json_chunk_savings(RmFmtHandlerJSON *self, FILE *out,
+                                      const RmChunkReport *report) {
+    const char *indent = self->pretty ? "\n    " : "";
+
+    fprintf(out, "\"chunk_savings\": {");
+    rm_fmt_json_key_int(out, "total_bytes", report->total_bytes);
+    fprintf(out, ", ");
+    rm_fmt_json_key_int(out, "unique_bytes", report->unique_bytes);
+    fprintf(out, ", ");
+    rm_fmt_json_key_int(out, "dedupable_bytes", report->dedupable_bytes);
+    fprintf(out, ", ");
+    rm_fmt_json_key_int(out, "chunks", report->chunks);
+
+    fprintf(out, ", \"pairs\": [");
+    for(GList *iter = report->pairs.head; iter; iter = iter->next) {
+        RmChunkPair *pair = iter->data;
+        fprintf(out, "%s{\"paths\": [", indent);
+        rm_fmt_json_string_unsafe(out, pair->paths[0]);
+        fprintf(out, ", ");
+        rm_fmt_json_string_unsafe(out, pair->paths[1]);
+        fprintf(out, "], ");
+        rm_fmt_json_key_int(out, "shared_bytes", pair->shared_bytes);
+        fprintf(out, "}%s", iter->next ? "," : "");
+    }
+
+    fprintf(out, "], \"directories\": [");
+    for(GList *iter = report->dirs.head; iter; iter = iter->next) {
+        RmChunkDir *dir = iter->data;
+        fprintf(out, "%s{", indent);
+        rm_fmt_json_key_unsafe(out, "path", dir->path);
+        fprintf(out, ", ");
+        rm_fmt_json_key_int(out, "dedupable_bytes", dir->dedupable_bytes);
+        fprintf(out, "}%s", iter->next ? "," : "");
+    }
+    fprintf(out, "]}");
+}
+
 static void rm_fmt_foot(_UNUSED RmSession *session, RmFmtHandler *parent, FILE *out) {
     RmFmtHandlerJSON *self = (RmFmtHandlerJSON *)parent;
 
@@ -238,6 +315,17 @@ static void rm_fmt_foot(_UNUSED RmSession *session, RmFmtHandler *parent, FILE *
             rm_fmt_json_key_int(out, "duplicate_sets", session->dup_group_counter);
             rm_fmt_json_sep(self, out);
             rm_fmt_json_key_int(out, "total_lint_size", session->total_lint_size);
+
+            if(session->cfg->find_similar_dirs && session->dir_merger) {
+                rm_fmt_json_sep(self, out);
+                rm_fmt_json_similar_dirs(self, out,
+                                         rm_tm_get_similar_dirs(session->dir_merger));
+            }
+
+            if(session->cfg->chunk_savings && session->chunker) {
+                rm_fmt_json_sep(self, out);
+                rm_fmt_json_chunk_savings(self, out, rm_chunk_get_report(session->chunker));
+            }
         }
         if(self->pretty) {
             fprintf(out, "\n}");
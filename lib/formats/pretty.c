@@ -23,6 +23,7 @@
  *
  */
 
+#include "../chunker.h"
 #include "../formats.h"
 #include "../preprocess.h"
 
@@ -151,10 +152,99 @@ static void rm_fmt_elem(_UNUSED RmSession *session, RmFmtHandler *parent, FILE *
     g_free(esc_path);
 }
 
-static void rm_fmt_prog(_UNUSED RmSession *session, RmFmtHandler *parent, FILE *out,
+static void rm_fmt_print_quoted(FILE *out, const char *path) {
+    char *esc_path = rm_util_strsub(path, "'", "'\"'\"'");
+    fprintf(out, "'%s'", esc_path);
+    g_free(esc_path);
+}
+
+static void rm_fmt_similar_dirs(RmSession *session, RmFmtHandlerProgress *self,
+                                FILE *out) {
+    const GQueue *similar_dirs = rm_tm_get_similar_dirs(session->dir_merger);
+    if(similar_dirs->length == 0) {
+        return;
+    }
+
+    fprintf(out, "\n%s#%s %s:\n", MAYBE_YELLOW(out, session), MAYBE_RESET(out, session),
+            _("Similar Directorie(s)"));
+
+    for(GList *iter = similar_dirs->head; iter; iter = iter->next) {
+        RmSimilarDirs *similar = iter->data;
+        self->elems_written++;
+
+        fprintf(out, "    %s%5.1f%%%s ", MAYBE_BLUE(out, session),
+                similar->similarity * 100, MAYBE_RESET(out, session));
+        rm_fmt_print_quoted(out, similar->paths[0]);
+        fprintf(out, " ");
+        rm_fmt_print_quoted(out, similar->paths[1]);
+        fprintf(out, "\n");
+
+        for(int i = 0; i < 2; ++i) {
+            for(GList *diff = similar->differing[i].head; diff; diff = diff->next) {
+                fprintf(out, "        %s%s%s ", MAYBE_RED(out, session),
+                        (i == 0) ? "<" : ">", MAYBE_RESET(out, session));
+                rm_fmt_print_quoted(out, diff->data);
+                fprintf(out, "\n");
+            }
+        }
+    }
+}
+
+static void rm_fmt_chunk_savings(RmSession *session, RmFmtHandlerProgress *self,
+                                 FILE *out) {
+    const RmChunkReport *report = rm_chunk_get_report(session->chunker);
+    if(report->dedupable_bytes == 0) {
+        return;
+    }
+
+    char size[64];
+    rm_util_size_to_human_readable(report->dedupable_bytes, size, sizeof(size));
+
+    fprintf(out, "\n%s#%s %s %s%s%s:\n", MAYBE_YELLOW(out, session),
+            MAYBE_RESET(out, session), _("Block Level Savings of"),
+            MAYBE_BLUE(out, session), size, MAYBE_RESET(out, session));
+
+    for(GList *iter = report->pairs.head; iter; iter = iter->next) {
+        RmChunkPair *pair = iter->data;
+        self->elems_written++;
+
+        rm_util_size_to_human_readable(pair->shared_bytes, size, sizeof(size));
+        fprintf(out, "    %s%10s%s ", MAYBE_BLUE(out, session), size,
+                MAYBE_RESET(out, session));
+        rm_fmt_print_quoted(out, pair->paths[0]);
+        fprintf(out, " ");
+        rm_fmt_print_quoted(out, pair->paths[1]);
+        fprintf(out, "\n");
+    }
+
+    fprintf(out, "\n%s#%s %s:\n", MAYBE_YELLOW(out, session), MAYBE_RESET(out, session),
+            _("Block Level Savings per Directory"));
+
+    for(GList *iter = report->dirs.head; iter; iter = iter->next) {
+        RmChunkDir *dir = iter->data;
+
+        rm_util_size_to_human_readable(dir->dedupable_bytes, size, sizeof(size));
+        fprintf(out, "    %s%10s%s ", MAYBE_BLUE(out, session), size,
+                MAYBE_RESET(out, session));
+        rm_fmt_print_quoted(out, dir->path);
+        fprintf(out, "\n");
+    }
+}
+
+static void rm_fmt_prog(RmSession *session, RmFmtHandler *parent, FILE *out,
                         RmFmtProgressState state) {
     RmFmtHandlerProgress *self = (RmFmtHandlerProgress *)parent;
 
+    if(state == RM_PROGRESS_STATE_PRE_SHUTDOWN && session->cfg->find_similar_dirs &&
+       session->dir_merger) {
+        rm_fmt_similar_dirs(session, self, out);
+    }
+
+    if(state == RM_PROGRESS_STATE_PRE_SHUTDOWN && session->cfg->chunk_savings &&
+       session->chunker) {
+        rm_fmt_chunk_savings(session, self, out);
+    }
+
     if(state == RM_PROGRESS_STATE_PRE_SHUTDOWN && self->elems_written) {
         fprintf(out, "\n");
     }
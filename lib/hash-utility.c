@@ -30,19 +30,60 @@
 
 #include "../lib/config.h"
 #include "../lib/hasher.h"
+#include "../lib/md-scheduler.h"
 #include "../lib/utilities.h"
 
+typedef struct RmHasherEntry {
+    /* Path as it will be printed */
+    char *path;
+
+    /* Checksum to verify against (--check) or NULL */
+    char *expected;
+
+    RmOff size;
+    dev_t dev;
+    ino_t inode;
+
+    /* Device the entry is read from */
+    RmMDSDevice *disk;
+
+    /* Result; set by rm_hasher_callback() */
+    RmDigest *digest;
+
+    /* Set once the digest is final (or the entry failed) */
+    bool done;
+
+    /* Set if the file could not be stat'ed or read */
+    bool failed;
+} RmHasherEntry;
+
 typedef struct RmHasherSession {
     /* Internal */
-    char **paths;
-    gint path_index;
+    RmHasher *hasher;
+    RmMDS *mds;
+
+    /* Entries in input order that were not printed yet
+     * (only used with print_in_order) */
+    GQueue pending;
+
+    /* Number of entries pushed but not printed yet */
+    gint n_pending;
+
+    /* Number of files that failed to read or verify;
+     * incremented atomically from the main and the hasher threads */
+    gint n_failed;
+
     GMutex lock;
-    RmDigest **completed_digests_buffer;
-    bool *read_succesful;
+    GCond cond;
 
     /* Options */
+    char **paths;
+    char *check_path;
     RmDigestType digest_type;
     gboolean print_in_order;
+    gboolean recursive;
+    gboolean null_separated;
+    gint max_pending;
 } RmHasherSession;
 
 static gboolean rm_hasher_parse_type(_UNUSED const char *option_name,
@@ -58,67 +99,292 @@ static gboolean rm_hasher_parse_type(_UNUSED const char *option_name,
     return TRUE;
 }
 
-static void rm_hasher_print(RmDigest *digest, char *path) {
-    gsize size = rm_digest_get_bytes(digest) * 2 + 1;
+static void rm_hasher_entry_free(RmHasherEntry *entry) {
+    if(entry->digest) {
+        rm_digest_free(entry->digest);
+    }
+    g_free(entry->path);
+    g_free(entry->expected);
+    g_slice_free(RmHasherEntry, entry);
+}
+
+/* Print (or verify) a finished entry; call with session->lock held */
+static void rm_hasher_print(RmHasherSession *session, RmHasherEntry *entry) {
+    if(entry->failed || entry->digest == NULL) {
+        g_atomic_int_inc(&session->n_failed);
+        if(entry->expected) {
+            g_print(_("%s: FAILED open or read\n"), entry->path);
+        }
+        return;
+    }
+
+    gsize size = rm_digest_get_bytes(entry->digest) * 2 + 1;
 
     char checksum_str[size];
     memset(checksum_str, '0', size);
     checksum_str[size - 1] = 0;
 
-    rm_digest_hexstring(digest, checksum_str);
+    rm_digest_hexstring(entry->digest, checksum_str);
 
-    g_print("%s  %s\n", checksum_str, path);
+    if(entry->expected == NULL) {
+        g_print("%s  %s\n", checksum_str, entry->path);
+    } else if(g_ascii_strcasecmp(checksum_str, entry->expected) == 0) {
+        g_print(_("%s: OK\n"), entry->path);
+    } else {
+        g_print(_("%s: FAILED\n"), entry->path);
+        g_atomic_int_inc(&session->n_failed);
+    }
 }
 
 static int rm_hasher_callback(_UNUSED RmHasher *hasher,
                               RmDigest *digest,
                               RmHasherSession *session,
-                              gpointer index_ptr) {
-    gint index = GPOINTER_TO_INT(index_ptr);
-
+                              RmHasherEntry *entry) {
     g_mutex_lock(&session->lock);
     {
-        if(session->print_in_order && digest) {
-            /* add digest in buffer array */
-            session->completed_digests_buffer[index] = digest;
-
-            /* check if the next due digest has been completed; if yes then print
-             * it (and possibly any following digests) */
-            while(session->completed_digests_buffer[session->path_index]) {
-                if(session->paths[session->path_index]) {
-                    if(session->read_succesful[session->path_index]) {
-                        rm_hasher_print(
-                            session->completed_digests_buffer[session->path_index],
-                            session->paths[session->path_index]);
-                    }
-                    rm_digest_free(
-                        session->completed_digests_buffer[session->path_index]);
-                }
-                session->completed_digests_buffer[session->path_index] = NULL;
-                session->path_index++;
-            }
-        } else if(digest) {
-            if(session->read_succesful[session->path_index]) {
-                rm_hasher_print(digest, session->paths[index]);
+        entry->digest = digest;
+        entry->done = true;
+
+        if(session->print_in_order) {
+            /* print the head of the queue (and any finished entries after it) */
+            while((entry = g_queue_peek_head(&session->pending)) && entry->done) {
+                g_queue_pop_head(&session->pending);
+                rm_hasher_print(session, entry);
+                rm_hasher_entry_free(entry);
+                session->n_pending--;
             }
+        } else {
+            rm_hasher_print(session, entry);
+            rm_hasher_entry_free(entry);
+            session->n_pending--;
         }
+
+        /* wake up rm_hasher_push_entry() */
+        g_cond_signal(&session->cond);
     }
     g_mutex_unlock(&session->lock);
     return 0;
 }
 
+/* RmMDSFunc; called from the device worker threads */
+static gint rm_hasher_entry_hash(RmHasherEntry *entry, RmHasherSession *session) {
+    /* entry might be freed as soon as the task is finished */
+    RmMDSDevice *disk = entry->disk;
+
+    RmHasherTask *task = rm_hasher_task_new(session->hasher, NULL, entry);
+    if(!rm_hasher_task_hash(task, entry->path, -1, 0, entry->size, FALSE, NULL)) {
+        entry->failed = true;
+    }
+    rm_hasher_task_finish(task);
+
+    rm_mds_device_ref(disk, -1);
+    return 1;
+}
+
+/* Queue an entry for hashing; blocks while too many entries are waiting to
+ * be printed, so the reorder buffer stays bounded. */
+static void rm_hasher_push_entry(RmHasherSession *session, RmHasherEntry *entry) {
+    g_mutex_lock(&session->lock);
+    {
+        while(session->n_pending >= session->max_pending) {
+            g_cond_wait(&session->cond, &session->lock);
+        }
+        session->n_pending++;
+        if(session->print_in_order) {
+            g_queue_push_tail(&session->pending, entry);
+        }
+    }
+    g_mutex_unlock(&session->lock);
+
+    if(entry->failed) {
+        /* nothing to read; just keep its place in the output */
+        rm_hasher_callback(NULL, NULL, session, entry);
+        return;
+    }
+
+    entry->disk = rm_mds_device_get_ref(session->mds, entry->path, entry->dev, 1);
+    rm_mds_push_task(entry->disk, entry->dev, entry->inode, NULL, entry);
+}
+
+static void rm_hasher_add_path(RmHasherSession *session, const char *path,
+                               const char *expected, bool in_dir);
+
+static gint rm_hasher_cmp_names(const char **a, const char **b) {
+    return strcmp(*a, *b);
+}
+
+/* Add all files below path in the order of their names */
+static void rm_hasher_add_dir(RmHasherSession *session, const char *path) {
+    GError *error = NULL;
+    GDir *dir = g_dir_open(path, 0, &error);
+    if(dir == NULL) {
+        rm_log_warning_line(_("Can't open directory or file \"%s\": %s"), path,
+                            error->message);
+        g_error_free(error);
+        g_atomic_int_inc(&session->n_failed);
+        return;
+    }
+
+    GPtrArray *names = g_ptr_array_new_with_free_func(g_free);
+    const char *name = NULL;
+    while((name = g_dir_read_name(dir))) {
+        g_ptr_array_add(names, g_strdup(name));
+    }
+    g_dir_close(dir);
+
+    g_ptr_array_sort(names, (GCompareFunc)rm_hasher_cmp_names);
+
+    for(guint i = 0; i < names->len; ++i) {
+        char *child = g_build_filename(path, g_ptr_array_index(names, i), NULL);
+        rm_hasher_add_path(session, child, NULL, true);
+        g_free(child);
+    }
+    g_ptr_array_free(names, TRUE);
+}
+
+/* Count path as failed; in --check mode also report it in the verification
+ * output, in the order of the check file */
+static void rm_hasher_add_failed(RmHasherSession *session, const char *path,
+                                 const char *expected) {
+    if(expected) {
+        RmHasherEntry *entry = g_slice_new0(RmHasherEntry);
+        entry->path = g_strdup(path);
+        entry->expected = g_strdup(expected);
+        entry->failed = true;
+        rm_hasher_push_entry(session, entry);
+    } else {
+        g_atomic_int_inc(&session->n_failed);
+    }
+}
+
+static void rm_hasher_add_path(RmHasherSession *session, const char *path,
+                               const char *expected, bool in_dir) {
+    RmStat stat_buf;
+
+    if(in_dir) {
+        /* don't follow symbolic links to directories; they might loop */
+        if(rm_sys_lstat(path, &stat_buf) == -1) {
+            rm_log_warning_line(_("Can't open directory or file \"%s\": %s"), path,
+                                strerror(errno));
+            g_atomic_int_inc(&session->n_failed);
+            return;
+        }
+        if(S_ISLNK(stat_buf.st_mode) &&
+           (rm_sys_stat(path, &stat_buf) == -1 || S_ISDIR(stat_buf.st_mode))) {
+            rm_log_debug_line("Skipping symbolic link %s", path);
+            return;
+        }
+    } else if(rm_sys_stat(path, &stat_buf) == -1) {
+        rm_log_warning_line(_("Can't open directory or file \"%s\": %s"), path,
+                            strerror(errno));
+        rm_hasher_add_failed(session, path, expected);
+        return;
+    }
+
+    if(S_ISDIR(stat_buf.st_mode)) {
+        if(session->recursive && expected == NULL) {
+            rm_hasher_add_dir(session, path);
+        } else if(expected) {
+            /* a checksum can't match a directory */
+            rm_log_warning_line(_("%s: Is a directory"), path);
+            rm_hasher_add_failed(session, path, expected);
+        } else {
+            rm_log_warning_line(_("Directories are not supported without --recursive: %s"),
+                                path);
+        }
+    } else if(S_ISREG(stat_buf.st_mode)) {
+        RmHasherEntry *entry = g_slice_new0(RmHasherEntry);
+        entry->path = g_strdup(path);
+        entry->expected = g_strdup(expected);
+        entry->size = stat_buf.st_size;
+        entry->dev = stat_buf.st_dev;
+        entry->inode = stat_buf.st_ino;
+        rm_hasher_push_entry(session, entry);
+    } else {
+        rm_log_warning_line(_("%s: Unknown file type"), path);
+    }
+}
+
+/* Read paths from stdin, one per line or null-separated */
+static void rm_hasher_add_stdin(RmHasherSession *session) {
+    char *line = NULL;
+    size_t line_len = 0;
+    ssize_t n_read = 0;
+    int delim = (session->null_separated) ? '\0' : '\n';
+
+    while((n_read = getdelim(&line, &line_len, delim, stdin)) != -1) {
+        if(n_read > 0 && line[n_read - 1] == delim) {
+            line[n_read - 1] = 0;
+        }
+        if(*line == 0) {
+            continue;
+        }
+
+        char *abs_path = realpath(line, NULL);
+        rm_hasher_add_path(session, (abs_path) ? abs_path : line, NULL, false);
+        free(abs_path);
+    }
+    free(line);
+}
+
+/* Read "<checksum>  <path>" lines as written by --hash (or sha256sum & co.)
+ * and verify every listed file */
+static bool rm_hasher_add_check_file(RmHasherSession *session, const char *check_path) {
+    FILE *check_file = stdin;
+    if(g_strcmp0(check_path, "-") != 0) {
+        check_file = fopen(check_path, "r");
+        if(check_file == NULL) {
+            rm_log_perror(check_path);
+            return false;
+        }
+    }
+
+    char *line = NULL;
+    size_t line_len = 0;
+    ssize_t n_read = 0;
+    gint line_num = 0;
+
+    while((n_read = getline(&line, &line_len, check_file)) != -1) {
+        line_num++;
+        g_strchomp(line);
+        if(*line == 0 || *line == '#') {
+            continue;
+        }
+
+        char *path = strchr(line, ' ');
+        if(path == NULL || (path[1] != ' ' && path[1] != '*') || path[2] == 0) {
+            rm_log_warning_line(_("%s:%d: improperly formatted checksum line"),
+                                check_path, line_num);
+            g_atomic_int_inc(&session->n_failed);
+            continue;
+        }
+
+        /* split "<checksum>" from " <path>" or "*<path>" (binary marker) */
+        *path = 0;
+        path += 2;
+
+        rm_hasher_add_path(session, path, line, false);
+    }
+
+    free(line);
+    if(check_file != stdin) {
+        fclose(check_file);
+    }
+    return true;
+}
+
 int rm_hasher_main(int argc, const char **argv) {
     RmHasherSession tag;
-
-    /* List of paths we got passed (or NULL)   */
-    tag.paths = NULL;
+    memset(&tag, 0, sizeof(tag));
 
     /* Print hashes in the same order as files in command line args */
     tag.print_in_order = TRUE;
 
     /* Digest type */
     tag.digest_type = RM_DEFAULT_DIGEST;
+    tag.max_pending = 4096;
     gint threads = 8;
+    gint threads_per_disk = 2;
     gint64 buffer_mbytes = 256;
     guint64 increment = 4096;
 
@@ -127,13 +393,18 @@ int rm_hasher_main(int argc, const char **argv) {
     /* clang-format off */
 
     const GOptionEntry entries[] = {
-        {"algorithm"      , 'a'  , 0                      , G_OPTION_ARG_CALLBACK        , (GOptionArgFunc)rm_hasher_parse_type  , _("Digest type [BLAKE2B]")                                                        , "[TYPE]"}   ,
-        {"num-threads"    , 't'  , 0                      , G_OPTION_ARG_INT             , &threads                              , _("Number of hashing threads [8]")                                                 , "N"}        ,
-        {"buffer-mbytes"  , 'b'  , 0                      , G_OPTION_ARG_INT64           , &buffer_mbytes                        , _("Megabytes read buffer [256 MB]")                                                , "MB"}       ,
-        {"increment"      , 'x'  , G_OPTION_FLAG_HIDDEN   , G_OPTION_ARG_INT64           , &increment                            , _("bytes to hash at a time [4096]")                                                , "MB"}       ,
-        {"ignore-order"   , 'i'  , G_OPTION_FLAG_REVERSE  , G_OPTION_ARG_NONE            , &tag.print_in_order                   , _("Print hashes in order completed, not in order entered (reduces memory usage)")  , NULL}       ,
-        {""               , 0    , 0                      , G_OPTION_ARG_FILENAME_ARRAY  , &tag.paths                            , _("Space-separated list of files")                                                 , "[FILE…]"}  ,
-        {NULL             , 0    , 0                      , 0                            , NULL                                  , NULL                                                                               , NULL}};
+        {"algorithm"        , 'a'  , 0                      , G_OPTION_ARG_CALLBACK        , (GOptionArgFunc)rm_hasher_parse_type  , _("Digest type [BLAKE2B]")                                                        , "[TYPE]"}   ,
+        {"num-threads"      , 't'  , 0                      , G_OPTION_ARG_INT             , &threads                              , _("Number of hashing threads [8]")                                                 , "N"}        ,
+        {"threads-per-disk" , 'd'  , 0                      , G_OPTION_ARG_INT             , &threads_per_disk                     , _("Number of files read at the same time from one disk [2]")                       , "N"}        ,
+        {"buffer-mbytes"    , 'b'  , 0                      , G_OPTION_ARG_INT64           , &buffer_mbytes                        , _("Megabytes read buffer [256 MB]")                                                , "MB"}       ,
+        {"increment"        , 'x'  , G_OPTION_FLAG_HIDDEN   , G_OPTION_ARG_INT64           , &increment                            , _("bytes to hash at a time [4096]")                                                , "MB"}       ,
+        {"ignore-order"     , 'i'  , G_OPTION_FLAG_REVERSE  , G_OPTION_ARG_NONE            , &tag.print_in_order                   , _("Print hashes in order completed, not in order entered (reduces memory usage)")  , NULL}       ,
+        {"max-pending"      , 'm'  , 0                      , G_OPTION_ARG_INT             , &tag.max_pending                      , _("Max. number of files hashed ahead of the printed output [4096]")               , "N"}        ,
+        {"recursive"        , 'r'  , 0                      , G_OPTION_ARG_NONE            , &tag.recursive                        , _("Hash all files below directories")                                              , NULL}       ,
+        {"null"             , '0'  , 0                      , G_OPTION_ARG_NONE            , &tag.null_separated                   , _("Paths read from stdin are separated by null bytes")                             , NULL}       ,
+        {"check"            , 'c'  , 0                      , G_OPTION_ARG_FILENAME        , &tag.check_path                       , _("Read checksums from FILE ('-' for stdin) and verify them")                      , "FILE"}     ,
+        {""                 , 0    , 0                      , G_OPTION_ARG_FILENAME_ARRAY  , &tag.paths                            , _("Space-separated list of files")                                                 , "[FILE…]"}  ,
+        {NULL               , 0    , 0                      , 0                            , NULL                                  , NULL                                                                               , NULL}};
 
     /* clang-format on */
 
@@ -171,26 +442,16 @@ int rm_hasher_main(int argc, const char **argv) {
         exit(EXIT_FAILURE);
     }
 
-    if(tag.paths == NULL) {
-        /* read paths from stdin */
-        char path_buf[PATH_MAX];
-        char *tokbuf = NULL;
-        GPtrArray *paths = g_ptr_array_new();
-
-        while(fgets(path_buf, PATH_MAX, stdin)) {
-            char *abs_path = realpath(strtok_r(path_buf, "\n", &tokbuf), NULL);
-            g_ptr_array_add(paths, abs_path);
-        }
-
-        tag.paths = (char **)g_ptr_array_free(paths, FALSE);
-    }
+    g_option_context_free(context);
 
-    if(tag.paths == NULL || tag.paths[0] == NULL) {
-        rm_log_error_line(_("No valid paths given"));
+    if(tag.check_path && tag.paths) {
+        rm_log_error_line(_("--check does not take any further paths"));
         exit(EXIT_FAILURE);
     }
 
-    g_option_context_free(context);
+    tag.max_pending = MAX(1, tag.max_pending);
+    threads = MAX(1, threads);
+    threads_per_disk = MAX(1, threads_per_disk);
 
     ////////// Implementation //////
 
@@ -198,62 +459,53 @@ int rm_hasher_main(int argc, const char **argv) {
     rm_digest_enable_sse(TRUE);
 #endif
 
-    int buf_size = (g_strv_length(tag.paths) + 1) * sizeof(RmDigest *);
-    tag.read_succesful = g_slice_alloc0(buf_size);
-
-    if(tag.print_in_order) {
-        /* allocate buffer to collect results */
-        tag.completed_digests_buffer = g_slice_alloc0(buf_size);
-        tag.path_index = 0;
-    }
-
     /* initialise structures */
     g_mutex_init(&tag.lock);
-    RmHasher *hasher = rm_hasher_new(tag.digest_type,
-                                     threads,
-                                     FALSE,
-                                     increment,
-                                     1024 * 1024 * buffer_mbytes,
-                                     (RmHasherCallback)rm_hasher_callback,
-                                     &tag);
-
-    /* Iterate over paths, pushing to hasher threads */
-    for(int i = 0; tag.paths && tag.paths[i]; ++i) {
-        /* check it is a regular file */
-
-        RmStat stat_buf;
-        if(rm_sys_stat(tag.paths[i], &stat_buf) == -1) {
-            rm_log_warning_line(_("Can't open directory or file \"%s\": %s"),
-                                tag.paths[i], strerror(errno));
-        } else if(S_ISDIR(stat_buf.st_mode)) {
-            rm_log_warning_line(_("Directories are not supported: %s"), tag.paths[i]);
-        } else if(S_ISREG(stat_buf.st_mode)) {
-            RmHasherTask *task = rm_hasher_task_new(hasher, NULL, GINT_TO_POINTER(i));
-            tag.read_succesful[i] =
-                rm_hasher_task_hash(task, tag.paths[i], 0, stat_buf.st_size, FALSE, NULL);
-
-            rm_hasher_task_finish(task);
-            continue;
-        } else {
-            rm_log_warning_line(_("%s: Unknown file type"), tag.paths[i]);
+    g_cond_init(&tag.cond);
+    g_queue_init(&tag.pending);
+
+    tag.hasher = rm_hasher_new(tag.digest_type,
+                               threads,
+                               FALSE,
+                               increment,
+                               1024 * 1024 * buffer_mbytes,
+                               (RmHasherCallback)rm_hasher_callback,
+                               &tag);
+
+    /* one reader per disk (or threads_per_disk), files of a disk in inode order */
+    tag.mds = rm_mds_new(threads, NULL, false);
+    rm_mds_configure(tag.mds,
+                     (RmMDSFunc)rm_hasher_entry_hash,
+                     &tag,
+                     0,
+                     threads_per_disk,
+                     (RmMDSSortFunc)rm_mds_elevator_cmp);
+    rm_mds_start(tag.mds);
+
+    /* Push paths to the disk workers while they are running */
+    bool success = true;
+    if(tag.check_path) {
+        success = rm_hasher_add_check_file(&tag, tag.check_path);
+    } else if(tag.paths) {
+        for(int i = 0; tag.paths[i]; ++i) {
+            rm_hasher_add_path(&tag, tag.paths[i], NULL, false);
         }
-
-        /* dummy callback for failed paths */
-        g_free(tag.paths[i]);
-        tag.paths[i] = NULL;
-        rm_hasher_callback(hasher, NULL, &tag, GINT_TO_POINTER(i));
+    } else {
+        rm_hasher_add_stdin(&tag);
     }
 
-    /* wait for all hasher threads to finish... */
-    rm_hasher_free(hasher, TRUE);
+    /* wait for all reads, then for all hasher threads to finish... */
+    rm_mds_free(tag.mds, TRUE);
+    rm_hasher_free(tag.hasher, TRUE);
 
-    /* tidy up */
-    g_slice_free1(buf_size, tag.read_succesful);
-    if(tag.print_in_order) {
-        g_slice_free1(buf_size, tag.completed_digests_buffer);
-    }
+    g_assert(tag.n_pending == 0);
+    g_assert(g_queue_is_empty(&tag.pending));
 
+    /* tidy up */
+    g_mutex_clear(&tag.lock);
+    g_cond_clear(&tag.cond);
     g_strfreev(tag.paths);
+    g_free(tag.check_path);
 
-    return EXIT_SUCCESS;
+    return (success && tag.n_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
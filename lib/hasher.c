@@ -58,6 +58,7 @@ struct _RmHasher {
     guint64 cache_quota_bytes;
     gpointer session_user_data;
     RmHasherCallback callback;
+    RmHasherBufferCallback buffer_callback;
 
     GAsyncQueue *hashpipe_pool;
     gint unalloc_hashpipes;
@@ -97,8 +98,14 @@ static void rm_hasher_task_free(RmHasherTask *self) {
 static void rm_hasher_hashpipe_worker(RmBuffer *buffer, RmHasher *hasher) {
     g_assert(buffer);
     if(buffer->len > 0) {
+        if(hasher->buffer_callback) {
+            /* let the caller see the data before the digest may keep the buffer */
+            RmHasherTask *task = buffer->user_data;
+            hasher->buffer_callback(hasher, buffer->data, buffer->len,
+                                    hasher->session_user_data, task->task_user_data);
+        }
+
         /* Update digest with buffer->data */
-        g_assert(buffer->user_data == NULL);
         rm_digest_buffered_update(hasher->buf_sem, buffer);
     } else if(buffer->user_data) {
         /* finalise via callback */
@@ -137,10 +144,10 @@ static void rm_hasher_request_readahead(int fd, RmOff seek_offset, RmOff bytes_t
 #endif
 }
 
-static gboolean rm_hasher_symlink_read(RmHasher *hasher, GThreadPool *hashpipe,
-                                       RmDigest *digest, char *path,
+static gboolean rm_hasher_symlink_read(RmHasherTask *task, char *path,
                                        gsize *bytes_actually_read) {
     /* Read contents of symlink (i.e. path of symlink's target).  */
+    RmHasher *hasher = task->hasher;
 
     RmBuffer *buffer = rm_buffer_new(hasher->buf_sem, hasher->buf_size);
     gint len = readlink(path, (char *)buffer->data, hasher->buf_size);
@@ -153,9 +160,9 @@ static gboolean rm_hasher_symlink_read(RmHasher *hasher, GThreadPool *hashpipe,
 
     *bytes_actually_read = len;
     buffer->len = len;
-    buffer->digest = digest;
-    buffer->user_data = NULL;
-    rm_util_thread_pool_push(hashpipe, buffer);
+    buffer->digest = task->digest;
+    buffer->user_data = task;
+    rm_util_thread_pool_push(task->hashpipe, buffer);
 
     return TRUE;
 }
@@ -164,9 +171,10 @@ static gboolean rm_hasher_symlink_read(RmHasher *hasher, GThreadPool *hashpipe,
  * returns true if no errors encountered;
  * increments *bytes_read by the actual bytes read */
 
-static gboolean rm_hasher_buffered_read(RmHasher *hasher, GThreadPool *hashpipe,
-                                        RmDigest *digest, char *path, gsize start_offset,
-                                        gsize bytes_to_read, gsize *bytes_actually_read) {
+static gboolean rm_hasher_buffered_read(RmHasherTask *task, char *path,
+                                        gsize start_offset, gsize bytes_to_read,
+                                        gsize *bytes_actually_read) {
+    RmHasher *hasher = task->hasher;
     FILE *fd = NULL;
     fd = fopen(path, "rb");
     if(fd == NULL) {
@@ -201,10 +209,15 @@ static gboolean rm_hasher_buffered_read(RmHasher *hasher, GThreadPool *hashpipe,
         bytes_remaining -= bytes_read;
         *bytes_actually_read += bytes_read;
 
-        buffer->len = bytes_read;
-        buffer->digest = digest;
-        buffer->user_data = NULL;
-        rm_util_thread_pool_push(hashpipe, buffer);
+        if(bytes_read > 0) {
+            buffer->len = bytes_read;
+            buffer->digest = task->digest;
+            buffer->user_data = task;
+            rm_util_thread_pool_push(task->hashpipe, buffer);
+        } else {
+            /* an empty buffer with user_data would look like the finisher */
+            rm_buffer_free(hasher->buf_sem, buffer);
+        }
 
         if(read_to_eof && feof(fd)) {
             success = TRUE;
@@ -229,18 +242,23 @@ static gboolean rm_hasher_buffered_read(RmHasher *hasher, GThreadPool *hashpipe,
 
 /* Reads data from file and sends to hasher threadpool
  * returns true if no errors encountered;
- * increments *bytes_read by the actual bytes read */
+ * increments *bytes_read by the actual bytes read.
+ * If open_fd is not -1 it is used (and not closed) instead of opening path. */
 
-static gboolean rm_hasher_unbuffered_read(RmHasher *hasher, GThreadPool *hashpipe,
-                                          RmDigest *digest, char *path,
+static gboolean rm_hasher_unbuffered_read(RmHasherTask *task, char *path, int open_fd,
                                           gint64 start_offset, gint64 bytes_to_read,
                                           gsize *bytes_actually_read) {
+    RmHasher *hasher = task->hasher;
     gint32 bytes_read = 0;
     guint64 file_offset = start_offset;
 
     gboolean read_to_eof = (bytes_to_read == 0);
 
-    int fd = rm_sys_open(path, O_RDONLY);
+    int fd = open_fd;
+    if(fd == -1) {
+        fd = rm_sys_open(path, O_RDONLY);
+    }
+
     if(fd == -1) {
         rm_log_info("open(2) failed for %s: %s\n", path, g_strerror(errno));
         return FALSE;
@@ -311,9 +329,9 @@ static gboolean rm_hasher_unbuffered_read(RmHasher *hasher, GThreadPool *hashpip
                                 (gint32)hasher->buf_size);
             if(buffer->len > 0) {
                 /* Send it to the hasher */
-                buffer->digest = digest;
-                buffer->user_data = NULL;
-                rm_util_thread_pool_push(hashpipe, buffer);
+                buffer->digest = task->digest;
+                buffer->user_data = task;
+                rm_util_thread_pool_push(task->hashpipe, buffer);
             } else {
                 rm_buffer_free(hasher->buf_sem,  buffer);
             }
@@ -335,7 +353,9 @@ static gboolean rm_hasher_unbuffered_read(RmHasher *hasher, GThreadPool *hashpip
     }
 
     g_slice_free1(sizeof(*buffers) * n_preadv_buffers, buffers);
-    rm_sys_close(fd);
+    if(open_fd == -1) {
+        rm_sys_close(fd);
+    }
 
     return success;
 }
@@ -410,6 +430,10 @@ RmHasher *rm_hasher_new(RmDigestType digest_type,
     return self;
 }
 
+void rm_hasher_set_buffer_callback(RmHasher *hasher, RmHasherBufferCallback callback) {
+    hasher->buffer_callback = callback;
+}
+
 void rm_hasher_free(RmHasher *hasher, gboolean wait) {
     /* Note that hasher may be multi-threaded, both at the reader level and at
      * the hashpipe level.  To ensure graceful exit, the hasher is reference counted
@@ -471,22 +495,20 @@ RmHasherTask *rm_hasher_task_new(RmHasher *hasher, RmDigest *digest,
     return self;
 }
 
-gboolean rm_hasher_task_hash(RmHasherTask *task, char *path, guint64 start_offset,
-                             gsize bytes_to_read, gboolean is_symlink,
-                             gsize *bytes_read_out) {
+gboolean rm_hasher_task_hash(RmHasherTask *task, char *path, int fd,
+                             guint64 start_offset, gsize bytes_to_read,
+                             gboolean is_symlink, gsize *bytes_read_out) {
     gsize bytes_read = 0;
     gboolean success = false;
 
     if(is_symlink) {
-        success = rm_hasher_symlink_read(task->hasher, task->hashpipe, task->digest,
-                                         path, &bytes_read);
+        success = rm_hasher_symlink_read(task, path, &bytes_read);
     } else if(task->hasher->use_buffered_read) {
-        success = rm_hasher_buffered_read(task->hasher, task->hashpipe, task->digest,
-                                          path, start_offset, bytes_to_read, &bytes_read);
+        success = rm_hasher_buffered_read(task, path, start_offset, bytes_to_read,
+                                          &bytes_read);
     } else {
-        success =
-            rm_hasher_unbuffered_read(task->hasher, task->hashpipe, task->digest, path,
-                                      start_offset, bytes_to_read, &bytes_read);
+        success = rm_hasher_unbuffered_read(task, path, fd, start_offset, bytes_to_read,
+                                            &bytes_read);
     }
 
     if(bytes_read_out != NULL) {
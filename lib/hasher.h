@@ -79,6 +79,23 @@ typedef int (*RmHasherCallback)(RmHasher *hasher,
                                 gpointer session_user_data,
                                 gpointer task_user_data);
 
+/**
+ * @brief RmHasherBufferCallback function prototype for rm_hasher_set_buffer_callback()
+ *
+ * Called from the hashing thread of a task for every block of data, in file order,
+ * before the block is added to the task's digest.
+ *
+ * @param data The data that was read
+ * @param len Number of valid bytes in data
+ * @param session_user_data User data passed to rm_hasher_new()
+ * @param task_user_data User data passed to rm_hasher_task_new()
+ **/
+typedef void (*RmHasherBufferCallback)(RmHasher *hasher,
+                                       const guint8 *data,
+                                       gsize len,
+                                       gpointer session_user_data,
+                                       gpointer task_user_data);
+
 /**
  * @brief Allocate and initialise a new hashing object
  *
@@ -106,6 +123,13 @@ RmHasher *rm_hasher_new(RmDigestType digest_type,
                         RmHasherCallback joiner,
                         gpointer session_user_data);
 
+/**
+ * @brief Let callback see all data read by the hasher's tasks.
+ *
+ * Must be set before the first task is created.
+ **/
+void rm_hasher_set_buffer_callback(RmHasher *hasher, RmHasherBufferCallback callback);
+
 /**
  * @brief Free a hashing object
  *
@@ -131,6 +155,8 @@ RmHasherTask *rm_hasher_task_new(RmHasher *hasher,
  *
  * @param task  An existing RmHasherTask
  * @param path  The file path to read from
+ * @param fd  An already open descriptor of path or -1 to open path.
+ *            Only used for unbuffered reads; it is not closed.
  * @param start_offset  Where to start reading the file (number of bytes from start)
  * @param bytes_to_read  How many bytes to read (pass 0 to read whole file)
  * @param is_symlink  If path is a symlink, pass TRUE to read the symlink itself rather
@@ -140,6 +166,7 @@ RmHasherTask *rm_hasher_task_new(RmHasher *hasher,
  **/
 gboolean rm_hasher_task_hash(RmHasherTask *task,
                              char *path,
+                             int fd,
                              guint64 start_offset,
                              size_t bytes_to_read,
                              gboolean is_symlink,
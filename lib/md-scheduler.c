@@ -25,16 +25,32 @@
 
 #include "md-scheduler.h"
 
-/* How many milliseconds to sleep if we encounter an empty file queue.
- * This prevents a "starving" RmShredDevice from hogging cpu and cluttering up
- * debug messages by continually recycling back to the joiner.
+/* How long a device waits for other devices to make progress if none of its
+ * tasks could be processed during a pass (e.g. paranoid memory is exhausted).
+ * The wait ends earlier as soon as any task is pushed or a reference dropped.
  */
 #if _RM_MDS_DEBUG
-#define MDS_EMPTYQUEUE_SLEEP_US (60 * 1000 * 1000) /* 60 seconds */
+#define MDS_STALLED_WAIT_US (60 * 1000 * 1000) /* 60 seconds */
 #else
-#define MDS_EMPTYQUEUE_SLEEP_US (50 * 1000) /* 0.05 second */
+#define MDS_STALLED_WAIT_US (50 * 1000) /* 0.05 second */
 #endif
 
+/* Tasks that waited longer than this are served next, regardless of where
+ * the elevator is. Keeps files of late arriving groups from starving.
+ */
+#define MDS_TASK_DEADLINE_US (1000 * 1000) /* 1 second */
+
+/* At most this many overdue tasks are served out of elevator order per sweep.
+ * When everything is queued at once (as the shredder does), a rotational disk
+ * needs much longer than the deadline to drain its queue; without a limit
+ * nearly every task would be overdue and be read in order of arrival.
+ */
+#define MDS_OVERDUE_PER_SWEEP (16)
+
+/* Device that is processed by the current thread (NULL outside of a pass);
+ * used to tell requeued tasks apart from new ones. */
+static GPrivate rm_mds_current_device = G_PRIVATE_INIT(NULL);
+
 ///////////////////////////////////////
 //            Structures             //
 ///////////////////////////////////////
@@ -63,10 +79,20 @@ struct _RmMDS {
 
     /* Lock for access to:
      *  self->disks
+     *  self->n_stalled
      */
     GMutex lock;
     GCond cond;
 
+    /* Signalled on events (see events) if n_stalled > 0 */
+    GCond stalled_cond;
+
+    /* Counts pushed tasks and dropped device references */
+    gint events;
+
+    /* Number of devices waiting for events in a stalled pass */
+    gint n_stalled;
+
     /* flag for whether threadpool is running */
     gboolean running;
 
@@ -77,6 +103,9 @@ struct _RmMDS {
     gint max_threads;
     gint threads_per_disk;
 
+    /* threads per non-rotational or network disk; 0 to use threads_per_disk */
+    gint threads_per_fast_disk;
+
     /* pointer to user data to be passed to func */
     gpointer user_data;
 };
@@ -90,19 +119,32 @@ struct _RmMDSDevice {
     /* Device's physical disk ID (only used for debug info) */
     dev_t disk;
 
-    /* Sorted list of tasks queued for execution */
-    GSList *sorted_tasks;
+    /* C-SCAN elevator; binary heaps ordered by mds->prioritiser.
+     * sweep_now holds tasks at or after the last served position,
+     * sweep_next the ones behind it that have to wait for the next sweep. */
+    GPtrArray *sweep_now;
+    GPtrArray *sweep_next;
 
-    /* Stack for tasks that will be sorted and carried out next pass */
-    GSList *unsorted_tasks;
+    /* Position of the last task served by the elevator */
+    RmMDSTask head;
+    bool head_valid;
+
+    /* Overdue tasks served ahead of the elevator in the current sweep */
+    guint n_overdue;
+
+    /* All tasks in order of arrival, used for deadlines.
+     * If there is no prioritiser, this is the only queue. */
+    GQueue fifo;
+
+    /* Number of queued tasks that were not served yet */
+    guint n_tasks;
 
     /* Lock for access to:
-     *  self->sorted_tasks
-     *  self->unsorted_tasks
+     *  the task queues above
      *  self->ref_count
+     *  self->parked
      */
     GMutex lock;
-    GCond cond;
 
     /* Reference count for self */
     gint ref_count;
@@ -110,26 +152,46 @@ struct _RmMDSDevice {
     /* Number of running threads for self */
     gint threads;
 
+    /* Number of threads that found no tasks and gave up their place in the
+     * threadpool; they are pushed back when a task arrives or ref_count is 0 */
+    gint parked;
+
     /* is disk rotational? */
     gboolean is_rotational;
+
+    /* is it a network filesystem (bound by latency rather than seeks)? */
+    gboolean is_network;
 };
 
 //////////////////////////////////////////////
 //  Internal Structure Init's & Destroyers  //
 //////////////////////////////////////////////
 
-/* RmMDSTask */
-static RmMDSTask *rm_mds_task_new(const dev_t dev, const guint64 offset,
-                                  const gpointer task_data) {
-    RmMDSTask *self = g_slice_new0(RmMDSTask);
-    self->dev = dev;
-    self->offset = offset;
-    self->task_data = task_data;
+/* A queued RmMDSTask; it is referenced by the fifo and (if there is a
+ * prioritiser) one of the elevator heaps. It is freed when it left both. */
+typedef struct RmMDSQueued {
+    /* must be first; passed to the prioritiser */
+    RmMDSTask task;
+
+    /* monotonic time when it should be served at the latest */
+    gint64 deadline;
+
+    /* set when it was removed from one of its queues */
+    bool taken;
+} RmMDSQueued;
+
+static RmMDSQueued *rm_mds_task_new(const dev_t dev, const guint64 offset,
+                                    const gpointer task_data) {
+    RmMDSQueued *self = g_slice_new0(RmMDSQueued);
+    self->task.dev = dev;
+    self->task.offset = offset;
+    self->task.task_data = task_data;
+    self->deadline = g_get_monotonic_time() + MDS_TASK_DEADLINE_US;
     return self;
 }
 
-static void rm_mds_task_free(RmMDSTask *task) {
-    g_slice_free(RmMDSTask, task);
+static void rm_mds_task_free(RmMDSQueued *task) {
+    g_slice_free(RmMDSQueued, task);
 }
 
 /* RmMDSDevice */
@@ -137,7 +199,9 @@ static RmMDSDevice *rm_mds_device_new(RmMDS *mds, const dev_t disk) {
     RmMDSDevice *self = g_slice_new0(RmMDSDevice);
 
     g_mutex_init(&self->lock);
-    g_cond_init(&self->cond);
+    g_queue_init(&self->fifo);
+    self->sweep_now = g_ptr_array_new();
+    self->sweep_next = g_ptr_array_new();
 
     self->mds = mds;
     self->ref_count = 0;
@@ -148,18 +212,37 @@ static RmMDSDevice *rm_mds_device_new(RmMDS *mds, const dev_t disk) {
         self->is_rotational = (disk % 2 == 0);
     } else {
         self->is_rotational = !rm_mounts_is_nonrotational(mds->mount_table, disk);
+        self->is_network = rm_mounts_is_network(mds->mount_table, disk);
     }
 
-    rm_log_debug_line("Created new RmMDSDevice for %srotational disk #%" LLU,
-                      self->is_rotational ? "" : "non-", (RmOff)disk);
+    rm_log_debug_line("Created new RmMDSDevice for %srotational %sdisk #%" LLU,
+                      self->is_rotational ? "" : "non-",
+                      self->is_network ? "network " : "", (RmOff)disk);
     return self;
 }
 
 /** @brief  Free mem allocated to an RmMDSDevice
  **/
 static void rm_mds_device_free(RmMDSDevice *self) {
+    /* Tasks still in a heap but not in the fifo anymore are taken;
+     * everything else is freed via the fifo */
+    GPtrArray *heaps[] = {self->sweep_now, self->sweep_next};
+    for(guint i = 0; i < 2; ++i) {
+        for(guint j = 0; j < heaps[i]->len; ++j) {
+            RmMDSQueued *task = g_ptr_array_index(heaps[i], j);
+            if(task->taken) {
+                rm_mds_task_free(task);
+            }
+        }
+        g_ptr_array_free(heaps[i], TRUE);
+    }
+
+    RmMDSQueued *task = NULL;
+    while((task = g_queue_pop_head(&self->fifo))) {
+        rm_mds_task_free(task);
+    }
+
     g_mutex_clear(&self->lock);
-    g_cond_clear(&self->cond);
     g_slice_free(RmMDSDevice, self);
 }
 
@@ -167,23 +250,205 @@ static void rm_mds_device_free(RmMDSDevice *self) {
 //    RmMDSDevice Implementation   //
 ///////////////////////////////////////
 
+/** @brief Wake up devices waiting in a stalled pass.
+ *  Call without any device lock held.
+ **/
+static void rm_mds_notify(RmMDS *mds) {
+    g_atomic_int_inc(&mds->events);
+    if(g_atomic_int_get(&mds->n_stalled) > 0) {
+        g_mutex_lock(&mds->lock);
+        { g_cond_broadcast(&mds->stalled_cond); }
+        g_mutex_unlock(&mds->lock);
+    }
+}
+
+/** @brief Send one parked thread of device back to the threadpool.
+ *  Call with device->lock held.
+ **/
+static void rm_mds_device_unpark(RmMDSDevice *device) {
+    if(device->parked > 0) {
+        device->parked--;
+        rm_util_thread_pool_push(device->mds->pool, device);
+    }
+}
+
+///////////////////////////////////////
+//        Elevator Task Queue        //
+///////////////////////////////////////
+
+static void rm_mds_heap_push(GPtrArray *heap, RmMDSQueued *task, RmMDSSortFunc cmp) {
+    g_ptr_array_add(heap, task);
+
+    /* sift up */
+    guint i = heap->len - 1;
+    while(i > 0) {
+        guint parent = (i - 1) / 2;
+        if(cmp(g_ptr_array_index(heap, parent), &task->task) <= 0) {
+            break;
+        }
+        heap->pdata[i] = heap->pdata[parent];
+        i = parent;
+    }
+    heap->pdata[i] = task;
+}
+
+static RmMDSQueued *rm_mds_heap_pop(GPtrArray *heap, RmMDSSortFunc cmp) {
+    if(heap->len == 0) {
+        return NULL;
+    }
+
+    RmMDSQueued *top = g_ptr_array_index(heap, 0);
+    RmMDSQueued *last = g_ptr_array_remove_index(heap, heap->len - 1);
+    if(heap->len == 0) {
+        return top;
+    }
+
+    /* sift down */
+    guint i = 0;
+    while(2 * i + 1 < heap->len) {
+        guint child = 2 * i + 1;
+        if(child + 1 < heap->len &&
+           cmp(g_ptr_array_index(heap, child + 1), g_ptr_array_index(heap, child)) < 0) {
+            child++;
+        }
+        if(cmp(&last->task, g_ptr_array_index(heap, child)) <= 0) {
+            break;
+        }
+        heap->pdata[i] = heap->pdata[child];
+        i = child;
+    }
+    heap->pdata[i] = last;
+    return top;
+}
+
+/* Call with device->lock held */
+static void rm_mds_device_enqueue(RmMDSDevice *device, RmMDSQueued *task,
+                                  bool requeued) {
+    RmMDSSortFunc cmp = device->mds->prioritiser;
+
+    g_queue_push_tail(&device->fifo, task);
+    device->n_tasks++;
+
+    if(cmp == NULL) {
+        return;
+    }
+
+    if(!requeued && (!device->head_valid || cmp(&task->task, &device->head) >= 0)) {
+        /* still ahead of the elevator; serve it in this sweep */
+        rm_mds_heap_push(device->sweep_now, task, cmp);
+    } else {
+        /* behind the elevator (or deferred by the worker); next sweep */
+        rm_mds_heap_push(device->sweep_next, task, cmp);
+    }
+}
+
+/* Called when task was removed from one of its queues */
+static void rm_mds_device_unlink(RmMDSDevice *device, RmMDSQueued *task) {
+    if(task->taken || device->mds->prioritiser == NULL) {
+        rm_mds_task_free(task);
+    } else {
+        task->taken = true;
+    }
+}
+
+/* Pop the next task and return its task_data; call with device->lock held. */
+static bool rm_mds_device_pop(RmMDSDevice *device, gpointer *task_data) {
+    RmMDSSortFunc cmp = device->mds->prioritiser;
+    RmMDSQueued *task = NULL;
+
+    /* forget tasks at the head of the fifo that the elevator already served */
+    while((task = g_queue_peek_head(&device->fifo)) && task->taken) {
+        g_queue_pop_head(&device->fifo);
+        rm_mds_task_free(task);
+    }
+
+    if(task == NULL) {
+        return false;
+    }
+
+    if(cmp == NULL) {
+        /* plain fifo */
+        g_queue_pop_head(&device->fifo);
+    } else if(device->n_overdue < MDS_OVERDUE_PER_SWEEP &&
+              task->deadline <= g_get_monotonic_time()) {
+        /* overdue; the elevator keeps its position */
+        g_queue_pop_head(&device->fifo);
+        device->n_overdue++;
+    } else {
+        do {
+            if(device->sweep_now->len == 0) {
+                /* end of the sweep; start over at the lowest position */
+                GPtrArray *swap = device->sweep_now;
+                device->sweep_now = device->sweep_next;
+                device->sweep_next = swap;
+                device->head_valid = false;
+                device->n_overdue = 0;
+                g_assert(device->sweep_now->len > 0);
+            }
+
+            task = rm_mds_heap_pop(device->sweep_now, cmp);
+            if(task->taken) {
+                /* already served because of its deadline */
+                rm_mds_task_free(task);
+                task = NULL;
+            }
+        } while(task == NULL);
+
+        device->head = task->task;
+        device->head_valid = true;
+    }
+
+    *task_data = task->task.task_data;
+    device->n_tasks--;
+    rm_mds_device_unlink(device, task);
+    return true;
+}
+
 /** @brief Mutex-protected task pusher
  **/
 
-static void rm_mds_push_task_impl(RmMDSDevice *device, RmMDSTask *task) {
+static void rm_mds_push_task_impl(RmMDSDevice *device, RmMDSQueued *task) {
+    /* tasks requeued by the device's own worker are not news */
+    bool requeued = (g_private_get(&rm_mds_current_device) == device);
+    RmMDS *mds = device->mds;
+
     g_mutex_lock(&device->lock);
     {
-        device->unsorted_tasks = g_slist_prepend(device->unsorted_tasks, task);
-        g_cond_signal(&device->cond);
+        rm_mds_device_enqueue(device, task, requeued);
+        rm_mds_device_unpark(device);
     }
     g_mutex_unlock(&device->lock);
+
+    if(!requeued) {
+        rm_mds_notify(mds);
+    }
 }
 
-/** @brief GCompareDataFunc wrapper for mds->prioritiser
+/** @brief Wait until another device made progress (or a timeout passed)
  **/
-static gint rm_mds_compare(const RmMDSTask *a, const RmMDSTask *b,
-                           RmMDSSortFunc prioritiser) {
-    gint result = prioritiser(a, b);
+static void rm_mds_wait_stalled(RmMDS *mds, gint seen_events) {
+    gint64 end_time = g_get_monotonic_time() + MDS_STALLED_WAIT_US;
+
+    g_mutex_lock(&mds->lock);
+    {
+        g_atomic_int_inc(&mds->n_stalled);
+        while(g_atomic_int_get(&mds->events) == seen_events) {
+            if(!g_cond_wait_until(&mds->stalled_cond, &mds->lock, end_time)) {
+                break;
+            }
+        }
+        g_atomic_int_dec_and_test(&mds->n_stalled);
+    }
+    g_mutex_unlock(&mds->lock);
+}
+
+/** @brief Check if device has neither references nor tasks left
+ **/
+static bool rm_mds_device_is_idle(RmMDSDevice *device) {
+    bool result = false;
+    g_mutex_lock(&device->lock);
+    { result = (device->ref_count == 0 && device->n_tasks == 0); }
+    g_mutex_unlock(&device->lock);
     return result;
 }
 
@@ -194,64 +459,95 @@ static void rm_mds_factory(RmMDSDevice *device, RmMDS *mds) {
      * After completing one pass of the device, returns self to the
      * mds->pool threadpool. */
     gint processed = 0;
+    gint seen_events = g_atomic_int_get(&mds->events);
+
+    /* a pass tries each task that is queued now at most once */
+    guint budget = 0;
+
     g_mutex_lock(&device->lock);
     {
-        /* check for empty queues - if so then wait a little while before giving up */
-        if(!device->sorted_tasks && !device->unsorted_tasks && device->ref_count > 0) {
-            /* timed wait for signal from rm_mds_push_task_impl() */
-            gint64 end_time = g_get_monotonic_time() + MDS_EMPTYQUEUE_SLEEP_US;
-            g_cond_wait_until(&device->cond, &device->lock, end_time);
-        }
-
-        /* sort and merge task lists */
-        if(device->unsorted_tasks) {
-            if(mds->prioritiser) {
-                device->sorted_tasks = g_slist_concat(
-                    g_slist_sort_with_data(device->unsorted_tasks,
-                                           (GCompareDataFunc)rm_mds_compare,
-                                           (RmMDSSortFunc)mds->prioritiser),
-                    device->sorted_tasks);
-            } else {
-                device->sorted_tasks =
-                    g_slist_concat(device->unsorted_tasks, device->sorted_tasks);
-            }
-            device->unsorted_tasks = NULL;
+        /* check for empty queues - if so then park until there is something to do */
+        if(device->n_tasks == 0 && device->ref_count > 0) {
+            /* rm_mds_push_task_impl() or rm_mds_device_ref() will push us back */
+            device->parked++;
+            g_mutex_unlock(&device->lock);
+            return;
         }
+        budget = device->n_tasks;
     }
     g_mutex_unlock(&device->lock);
 
-    /* process tasks from device->sorted_tasks */
-    RmMDSTask *task = NULL;
-    while(processed < mds->pass_quota &&
-          (task = rm_util_slist_pop(&device->sorted_tasks, &device->lock))) {
-        if(mds->func(task->task_data, mds->user_data)) {
+    /* process tasks in elevator order */
+    g_private_set(&rm_mds_current_device, device);
+    while(processed < mds->pass_quota && budget-- > 0) {
+        gpointer task_data = NULL;
+        bool popped = false;
+
+        g_mutex_lock(&device->lock);
+        { popped = rm_mds_device_pop(device, &task_data); }
+        g_mutex_unlock(&device->lock);
+
+        if(!popped) {
+            break;
+        }
+
+        if(mds->func(task_data, mds->user_data)) {
             /* task succeeded; update counters */
             ++processed;
         }
-        rm_mds_task_free(task);
     }
+    g_private_set(&rm_mds_current_device, NULL);
 
     if(rm_mds_device_ref(device, 0) > 0) {
         /* return self to pool for further processing */
         if(processed == 0) {
-            /* stalled queue; chill for a bit */
-            g_usleep(1000);
+            /* stalled queue; wait until some other device did something */
+            rm_mds_wait_stalled(mds, seen_events);
         }
         rm_util_thread_pool_push(mds->pool, device);
     } else if(g_atomic_int_dec_and_test(&device->threads)) {
         /* free self and signal to rm_mds_free() */
         g_mutex_lock(&mds->lock);
         {
-            rm_log_debug_line("Freeing device %" LLU " (pointer %p)", (RmOff)device->disk,
-                              device);
-            g_hash_table_remove(mds->disks, GINT_TO_POINTER(device->disk));
-            rm_mds_device_free(device);
-            g_cond_signal(&mds->cond);
+            if(rm_mds_device_is_idle(device)) {
+                rm_log_debug_line("Freeing device %" LLU " (pointer %p)",
+                                  (RmOff)device->disk, device);
+                g_hash_table_remove(mds->disks, GINT_TO_POINTER(device->disk));
+                rm_mds_device_free(device);
+                g_cond_signal(&mds->cond);
+            } else {
+                /* got referenced again via rm_mds_device_get_ref() meanwhile */
+                g_atomic_int_inc(&device->threads);
+                rm_util_thread_pool_push(mds->pool, device);
+            }
         }
         g_mutex_unlock(&mds->lock);
     }
 }
 
+/** @brief Number of worker threads for device
+ **/
+static gint rm_mds_device_max_threads(RmMDS *mds, RmMDSDevice *device) {
+    if((!device->is_rotational || device->is_network) && mds->threads_per_fast_disk > 0) {
+        return mds->threads_per_fast_disk;
+    }
+    return mds->threads_per_disk;
+}
+
+/** @brief Threadpool size needed for all devices; call with mds->lock held
+ *  (or before the scheduler is started)
+ **/
+static guint rm_mds_pool_size(RmMDS *mds) {
+    guint threads = 0;
+    GHashTableIter iter;
+    RmMDSDevice *device = NULL;
+    g_hash_table_iter_init(&iter, mds->disks);
+    while(g_hash_table_iter_next(&iter, NULL, (gpointer *)&device)) {
+        threads += rm_mds_device_max_threads(mds, device);
+    }
+    return CLAMP(threads, 1, (guint)mds->max_threads);
+}
+
 /** @brief Push an RmMDSDevice to the threadpool
  **/
 void rm_mds_device_start(RmMDSDevice *device, RmMDS *mds) {
@@ -259,10 +555,11 @@ void rm_mds_device_start(RmMDSDevice *device, RmMDS *mds) {
     g_assert(device->threads == 0);
 
     g_assert(mds);
-    device->threads = mds->threads_per_disk;
+    gint threads = rm_mds_device_max_threads(mds, device);
+    device->threads = threads;
     g_mutex_lock(&device->lock);
     {
-        for(int i = 0; i < mds->threads_per_disk; ++i) {
+        for(int i = 0; i < threads; ++i) {
             rm_log_debug_line("Starting disk %" LLU " (pointer %p) thread #%i",
                               (RmOff)device->disk, device, i + 1);
             rm_util_thread_pool_push(mds->pool, device);
@@ -272,8 +569,7 @@ void rm_mds_device_start(RmMDSDevice *device, RmMDS *mds) {
 }
 
 void rm_mds_start(RmMDS *mds) {
-    guint disk_count = g_hash_table_size(mds->disks);
-    guint threads = CLAMP(mds->threads_per_disk * disk_count, 1, (guint)mds->max_threads);
+    guint threads = rm_mds_pool_size(mds);
     rm_log_debug_line("Starting MDS scheduler with %i threads", threads);
 
     mds->pool = rm_util_thread_pool_new((GFunc)rm_mds_factory, mds, threads);
@@ -283,7 +579,8 @@ void rm_mds_start(RmMDS *mds) {
     g_list_free(disks);
 }
 
-static RmMDSDevice *rm_mds_device_get_by_disk(RmMDS *mds, const dev_t disk) {
+static RmMDSDevice *rm_mds_device_get_by_disk(RmMDS *mds, const dev_t disk,
+                                              const gint ref_count) {
     RmMDSDevice *result = NULL;
     g_assert(mds);
     g_mutex_lock(&mds->lock);
@@ -295,9 +592,21 @@ static RmMDSDevice *rm_mds_device_get_by_disk(RmMDS *mds, const dev_t disk) {
             result = rm_mds_device_new(mds, disk);
             g_hash_table_insert(mds->disks, GINT_TO_POINTER(disk), result);
             if(g_atomic_int_get(&mds->running) == TRUE) {
+                /* make room for the new device's threads */
+                guint threads = rm_mds_pool_size(mds);
+                if((gint)threads > g_thread_pool_get_max_threads(mds->pool)) {
+                    g_thread_pool_set_max_threads(mds->pool, threads, NULL);
+                }
                 rm_mds_device_start(result, mds);
             }
         }
+
+        if(ref_count != 0) {
+            /* still under mds->lock, so the device can't be freed meanwhile */
+            g_mutex_lock(&result->lock);
+            { result->ref_count += ref_count; }
+            g_mutex_unlock(&result->lock);
+        }
     }
     g_mutex_unlock(&mds->lock);
     return result;
@@ -312,6 +621,7 @@ RmMDS *rm_mds_new(const gint max_threads, RmMountTable *mount_table, bool fake_d
 
     g_mutex_init(&self->lock);
     g_cond_init(&self->cond);
+    g_cond_init(&self->stalled_cond);
 
     self->max_threads = max_threads;
 
@@ -343,6 +653,12 @@ void rm_mds_configure(RmMDS *self,
     self->prioritiser = prioritiser;
 }
 
+void rm_mds_configure_fast_disks(RmMDS *self, const gint threads_per_disk) {
+    g_assert(self);
+    g_assert(self->running == FALSE);
+    self->threads_per_fast_disk = threads_per_disk;
+}
+
 void rm_mds_finish(RmMDS *mds) {
     g_mutex_lock(&mds->lock);
     /* wait for any pending threads to finish */
@@ -357,6 +673,8 @@ void rm_mds_finish(RmMDS *mds) {
     mds->running = FALSE;
     if(mds->pool) {
         g_thread_pool_free(mds->pool, false, true);
+        /* may be started again */
+        mds->pool = NULL;
     }
 }
 
@@ -370,21 +688,36 @@ void rm_mds_free(RmMDS *mds, gboolean free_mount_table) {
     }
     g_mutex_clear(&mds->lock);
     g_cond_clear(&mds->cond);
+    g_cond_clear(&mds->stalled_cond);
     g_slice_free(RmMDS, mds);
 }
 
 gint rm_mds_device_ref(RmMDSDevice *device, const gint ref_count) {
+    /* device might be freed as soon as it is unlocked */
+    RmMDS *mds = device->mds;
     gint result = 0;
     g_mutex_lock(&device->lock);
     {
         device->ref_count += ref_count;
         result = device->ref_count;
+
+        if(result == 0) {
+            /* all parked threads need to finish so the device gets freed */
+            while(device->parked > 0) {
+                rm_mds_device_unpark(device);
+            }
+        }
     }
     g_mutex_unlock(&device->lock);
+
+    if(ref_count < 0) {
+        rm_mds_notify(mds);
+    }
     return result;
 }
 
-RmMDSDevice *rm_mds_device_get(RmMDS *mds, const char *path, dev_t dev) {
+static RmMDSDevice *rm_mds_device_get_impl(RmMDS *mds, const char *path, dev_t dev,
+                                           const gint ref_count) {
     dev_t disk = 0;
     if(dev == 0) {
         dev = rm_mounts_get_disk_id_by_path(mds->mount_table, path);
@@ -394,7 +727,16 @@ RmMDSDevice *rm_mds_device_get(RmMDS *mds, const char *path, dev_t dev) {
     } else {
         disk = rm_mounts_get_disk_id(mds->mount_table, dev, path);
     }
-    return rm_mds_device_get_by_disk(mds, disk);
+    return rm_mds_device_get_by_disk(mds, disk, ref_count);
+}
+
+RmMDSDevice *rm_mds_device_get(RmMDS *mds, const char *path, dev_t dev) {
+    return rm_mds_device_get_impl(mds, path, dev, 0);
+}
+
+RmMDSDevice *rm_mds_device_get_ref(RmMDS *mds, const char *path, dev_t dev,
+                                   const gint ref_count) {
+    return rm_mds_device_get_impl(mds, path, dev, ref_count);
 }
 
 gboolean rm_mds_device_is_rotational(RmMDSDevice *device) {
@@ -407,7 +749,7 @@ void rm_mds_push_task(RmMDSDevice *device, dev_t dev, gint64 offset, const char
         offset = rm_offset_get_from_path(path, 0, NULL);
     }
 
-    RmMDSTask *task = rm_mds_task_new(dev, offset, task_data);
+    RmMDSQueued *task = rm_mds_task_new(dev, offset, task_data);
     rm_mds_push_task_impl(device, task);
 }
 
@@ -44,10 +44,20 @@
  * according to a prioritisation function (eg an elevator algorithm
  * based on disk offsets).
  *
+ * With a prioritisation function, each device runs a one-way (C-SCAN)
+ * elevator: tasks ahead of the last served position are served in this
+ * sweep, tasks behind it in the next one.  Tasks that waited longer than
+ * a deadline are served first regardless of their position, but only a
+ * few per sweep, so that a long queue is still served in elevator order.
+ *
  * Device workers are reference-counted, which may be useful eg in cases
  * where there are known future tasks on a device, eg tasks which can't
  * be started until other tasks have completed.
  *
+ * A device worker without tasks does not poll; it gives its thread back
+ * and is woken up by the next task pushed to that device, or when the
+ * device's reference count drops to zero (then it is freed).
+ *
  * Typical workflow:
  *
  *     RmMDS *mds = rm_mds_new(task_callback, max_threads, sorter, user_data);
@@ -152,6 +162,21 @@ void rm_mds_configure(RmMDS *self,
                       const gint threads_per_disk,
                       RmMDSSortFunc prioritiser);
 
+/**
+ * @brief Use a different number of threads for non-rotational and network devices
+ *
+ * @param threads_per_disk Threads per non-rotational or network device; 0
+ * (the default) uses the threads_per_disk of rm_mds_configure().
+ *
+ * SSDs and NVMe drives serve many requests in parallel, and on network
+ * filesystems each request mostly waits for the round trip, so tasks that
+ * are bound by the latency of each request (eg opening and reading lots of
+ * small files) finish faster with more concurrent workers.  On local
+ * rotational devices that would only cause seeks.  The total is still
+ * limited by the max_threads of rm_mds_new().
+ **/
+void rm_mds_configure_fast_disks(RmMDS *self, const gint threads_per_disk);
+
 /**
  * @brief start a paused MDS scheduler
  **/
@@ -160,6 +185,9 @@ void rm_mds_start(RmMDS *mds);
 /**
  * @brief Wait for all RmMDS scheduler tasks to finish
  *
+ * Afterwards the scheduler is paused again; new tasks may be pushed
+ * and rm_mds_start() called once more.
+ *
  * @param mds Pointer to the MDS scheduler
  **/
 void rm_mds_finish(RmMDS *mds);
@@ -181,6 +209,16 @@ void rm_mds_free(RmMDS *mds, const gboolean free_mount_table);
  **/
 RmMDSDevice *rm_mds_device_get(RmMDS *mds, const char *path, dev_t dev);
 
+/**
+ * @brief like rm_mds_device_get() but also add ref_count references
+ *
+ * Use this instead of rm_mds_device_get() + rm_mds_device_ref() when
+ * pushing to an already running scheduler; otherwise an idle device
+ * might be freed in between.
+ **/
+RmMDSDevice *rm_mds_device_get_ref(RmMDS *mds, const char *path, dev_t dev,
+                                   const gint ref_count);
+
 /**
  * @brief return rotationality of device
  * */
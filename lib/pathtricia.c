@@ -31,102 +31,178 @@
 #include "config.h"
 #include "pathtricia.h"
 
+/* Locks are picked by the address of the node whose children are accessed */
+#define RM_TRIE_LOCK(trie, node) \
+    (&(trie)->locks[((guintptr)(node) >> 4) % RM_TRIE_N_LOCKS])
+
 //////////////////////////
 //  RmPathNode Methods  //
 //////////////////////////
 
+/* Intern elem; equal basenames (think "README" or ".git") are stored only once */
+static char *rm_trie_intern(RmTrie *trie, const char *elem) {
+    guint shard = g_str_hash(elem) % RM_TRIE_N_CHUNKS;
+    char *result = NULL;
+
+    g_mutex_lock(&trie->chunk_locks[shard]);
+    { result = (char *)g_string_chunk_insert_const(trie->chunks[shard], elem); }
+    g_mutex_unlock(&trie->chunk_locks[shard]);
+
+    return result;
+}
+
 static RmNode *rm_node_new(RmTrie *trie, const char *elem) {
     RmNode *self = g_slice_alloc0(sizeof(RmNode));
 
     if(elem != NULL) {
-        /* Note: We could use g_string_chunk_insert_const here.
-         * That would keep a hash table with all strings internally though,
-         * but would sort out storing duplicate path elements. In normal
-         * setups this will not happen that much though I guess.
-         */
-        self->basename = g_string_chunk_insert(trie->chunks, elem);
+        self->basename = rm_trie_intern(trie, elem);
     }
     return self;
 }
 
 static void rm_node_free(RmNode *node) {
-    if(node->children) {
-        g_hash_table_unref(node->children);
+    if(node->n_children > RM_NODE_INLINE_CHILDREN) {
+        g_hash_table_unref(node->children.table);
+    } else {
+        g_free(node->children.array);
     }
     memset(node, 0, sizeof(RmNode));
     g_slice_free(RmNode, node);
 }
 
-static RmNode *rm_node_insert(RmTrie *trie, RmNode *parent, const char *elem) {
-    if(parent->children == NULL) {
-        parent->children = g_hash_table_new(g_str_hash, g_str_equal);
+/* call with parent's lock held */
+static RmNode *rm_node_lookup(RmNode *parent, const char *elem) {
+    if(parent->n_children > RM_NODE_INLINE_CHILDREN) {
+        return g_hash_table_lookup(parent->children.table, elem);
+    }
+
+    for(guint32 i = 0; i < parent->n_children; ++i) {
+        RmNode *child = parent->children.array[i];
+        if(strcmp(child->basename, elem) == 0) {
+            return child;
+        }
+    }
+    return NULL;
+}
+
+/* call with parent's lock held */
+static void rm_node_add_child(RmNode *parent, RmNode *child) {
+    if(parent->n_children < RM_NODE_INLINE_CHILDREN) {
+        /* grow array in powers of two; most directories have few entries */
+        if((parent->n_children & (parent->n_children - 1)) == 0) {
+            parent->children.array = g_renew(RmNode *, parent->children.array,
+                                             MAX(parent->n_children * 2, 1));
+        }
+        parent->children.array[parent->n_children] = child;
+    } else if(parent->n_children == RM_NODE_INLINE_CHILDREN) {
+        /* switch over to a table */
+        RmNode **array = parent->children.array;
+        parent->children.table = g_hash_table_new(g_str_hash, g_str_equal);
+        for(guint32 i = 0; i < parent->n_children; ++i) {
+            g_hash_table_insert(parent->children.table, array[i]->basename, array[i]);
+        }
+        g_free(array);
+        g_hash_table_insert(parent->children.table, child->basename, child);
+    } else {
+        g_hash_table_insert(parent->children.table, child->basename, child);
     }
+    parent->n_children++;
+}
 
-    RmNode *exists = g_hash_table_lookup(parent->children, elem);
+static RmNode *rm_node_insert(RmTrie *trie, RmNode *parent, const char *elem) {
+    GMutex *lock = RM_TRIE_LOCK(trie, parent);
+    g_mutex_lock(lock);
+
+    RmNode *exists = rm_node_lookup(parent, elem);
     if(exists == NULL) {
-        RmNode *node = rm_node_new(trie, elem);
-        node->parent = parent;
-        g_hash_table_insert(parent->children, node->basename, node);
-        return node;
+        exists = rm_node_new(trie, elem);
+        exists->parent = parent;
+        rm_node_add_child(parent, exists);
     }
 
+    g_mutex_unlock(lock);
     return exists;
 }
 
+static RmNode *rm_node_search(RmTrie *trie, RmNode *parent, const char *elem) {
+    GMutex *lock = RM_TRIE_LOCK(trie, parent);
+    g_mutex_lock(lock);
+    RmNode *result = rm_node_lookup(parent, elem);
+    g_mutex_unlock(lock);
+    return result;
+}
+
 ///////////////////////////
 //    RmTrie Methods     //
 ///////////////////////////
 
 void rm_trie_init(RmTrie *self) {
     g_assert(self);
-    self->root = rm_node_new(self, NULL);
 
-    /* Average path len is 93.633236.
-     * I did ze science! :-)
-     */
-    self->chunks = g_string_chunk_new(100);
+    for(int i = 0; i < RM_TRIE_N_CHUNKS; ++i) {
+        /* only basenames are stored, and each of them only once */
+        self->chunks[i] = g_string_chunk_new(1024);
+        g_mutex_init(&self->chunk_locks[i]);
+    }
 
-    g_mutex_init(&self->lock);
+    for(int i = 0; i < RM_TRIE_N_LOCKS; ++i) {
+        g_mutex_init(&self->locks[i]);
+    }
+
+    self->root = rm_node_new(self, NULL);
+    self->size = 0;
 }
 
 /* Path iterator that works with absolute paths.
  * Absolute paths are required to start with a /
+ * Only the current element is copied (into elem), not the whole path.
  */
 typedef struct RmPathIter {
-    char *curr_elem;
-    char path_buf[PATH_MAX];
+    const char *curr_elem;
+    char elem[PATH_MAX];
 } RmPathIter;
 
-void rm_path_iter_init(RmPathIter *iter, const char *path) {
+static void rm_path_iter_init(RmPathIter *iter, const char *path) {
     if(*path == '/') {
         path++;
     }
 
-    memset(iter->path_buf, 0, PATH_MAX);
-    strncpy(iter->path_buf, path, PATH_MAX);
-
-    iter->curr_elem = iter->path_buf;
+    iter->curr_elem = path;
 }
 
-char *rm_path_iter_next(RmPathIter *iter) {
-    char *elem_begin = iter->curr_elem;
+static char *rm_path_iter_next(RmPathIter *iter) {
+    const char *elem_begin = iter->curr_elem;
+    if(elem_begin == NULL) {
+        return NULL;
+    }
 
-    if(elem_begin && (iter->curr_elem = strchr(elem_begin, '/'))) {
-        *(iter->curr_elem) = 0;
-        iter->curr_elem += 1;
+    const char *elem_end = strchr(elem_begin, '/');
+    size_t elem_len = 0;
+    if(elem_end) {
+        elem_len = elem_end - elem_begin;
+        iter->curr_elem = elem_end + 1;
+    } else {
+        elem_len = strlen(elem_begin);
+        iter->curr_elem = NULL;
     }
 
-    return elem_begin;
+    elem_len = MIN(elem_len, sizeof(iter->elem) - 1);
+    memcpy(iter->elem, elem_begin, elem_len);
+    iter->elem[elem_len] = 0;
+    return iter->elem;
 }
 
-RmNode *rm_trie_insert(RmTrie *self, const char *path, void *value) {
+/* name is a single path element if parent is given, a full path otherwise */
+RmNode *rm_trie_get_node(RmTrie *self, RmNode *parent, const char *name) {
     g_assert(self);
-    g_assert(path);
+    g_assert(name);
 
-    RmPathIter iter;
-    rm_path_iter_init(&iter, path);
+    if(parent != NULL) {
+        return rm_node_insert(self, parent, name);
+    }
 
-    g_mutex_lock(&self->lock);
+    RmPathIter iter;
+    rm_path_iter_init(&iter, name);
 
     char *path_elem = NULL;
     RmNode *curr_node = self->root;
@@ -135,15 +211,30 @@ RmNode *rm_trie_insert(RmTrie *self, const char *path, void *value) {
         curr_node = rm_node_insert(self, curr_node, path_elem);
     }
 
-    if(curr_node != NULL) {
-        curr_node->has_value = true;
-        curr_node->data = value;
-        self->size++;
+    return curr_node;
+}
+
+RmNode *rm_trie_insert_at(RmTrie *self, RmNode *parent, const char *name, void *value) {
+    RmNode *node = rm_trie_get_node(self, parent, name);
+
+    if(node != NULL) {
+        /* has_value and data are guarded by the lock of the node's parent */
+        GMutex *lock = RM_TRIE_LOCK(self, node->parent);
+        g_mutex_lock(lock);
+        {
+            node->has_value = true;
+            node->data = value;
+        }
+        g_mutex_unlock(lock);
+        g_atomic_pointer_add(&self->size, 1);
     }
 
-    g_mutex_unlock(&self->lock);
+    return node;
+}
 
-    return curr_node;
+RmNode *rm_trie_insert(RmTrie *self, const char *path, void *value) {
+    g_assert(path);
+    return rm_trie_insert_at(self, NULL, path, value);
 }
 
 RmNode *rm_trie_search_node(RmTrie *self, const char *path) {
@@ -153,22 +244,13 @@ RmNode *rm_trie_search_node(RmTrie *self, const char *path) {
     RmPathIter iter;
     rm_path_iter_init(&iter, path);
 
-    g_mutex_lock(&self->lock);
-
     char *path_elem = NULL;
     RmNode *curr_node = self->root;
 
     while(curr_node && (path_elem = rm_path_iter_next(&iter))) {
-        if(curr_node->children == NULL) {
-            /* Can't go any further */
-            g_mutex_unlock(&self->lock);
-            return NULL;
-        }
-
-        curr_node = g_hash_table_lookup(curr_node->children, path_elem);
+        curr_node = rm_node_search(self, curr_node, path_elem);
     }
 
-    g_mutex_unlock(&self->lock);
     return curr_node;
 }
 
@@ -214,26 +296,17 @@ char *rm_trie_build_path_unlocked(RmNode *node, char *buf, size_t buf_len) {
     return buf;
 }
 
-char *rm_trie_build_path(RmTrie *self, RmNode *node, char *buf, size_t buf_len) {
-    if(node == NULL) {
-        return NULL;
-    }
-    char *result = NULL;
-    g_mutex_lock(&self->lock);
-    { result = rm_trie_build_path_unlocked(node, buf, buf_len); }
-    g_mutex_unlock(&self->lock);
-    return result;
+char *rm_trie_build_path(_UNUSED RmTrie *self, RmNode *node, char *buf, size_t buf_len) {
+    /* basename and parent of a node never change; no locking needed */
+    return rm_trie_build_path_unlocked(node, buf, buf_len);
 }
 
 size_t rm_trie_size(RmTrie *self) {
-    return self->size;
+    return (size_t)g_atomic_pointer_get(&self->size);
 }
 
 static void _rm_trie_iter(RmTrie *self, RmNode *root, bool pre_order, bool all_nodes,
                           RmTrieIterCallback callback, void *user_data, int level) {
-    GHashTableIter iter;
-    gpointer key, value;
-
     if(root == NULL) {
         root = self->root;
     }
@@ -244,12 +317,20 @@ static void _rm_trie_iter(RmTrie *self, RmNode *root, bool pre_order, bool all_n
         }
     }
 
-    if(root->children != NULL) {
-        g_hash_table_iter_init(&iter, root->children);
+    if(root->n_children > RM_NODE_INLINE_CHILDREN) {
+        GHashTableIter iter;
+        gpointer key, value;
+
+        g_hash_table_iter_init(&iter, root->children.table);
         while(g_hash_table_iter_next(&iter, &key, &value)) {
             _rm_trie_iter(self, value, pre_order, all_nodes, callback, user_data,
                           level + 1);
         }
+    } else {
+        for(guint32 i = 0; i < root->n_children; ++i) {
+            _rm_trie_iter(self, root->children.array[i], pre_order, all_nodes, callback,
+                          user_data, level + 1);
+        }
     }
 
     if(!pre_order && (all_nodes || root->has_value)) {
@@ -261,9 +342,15 @@ static void _rm_trie_iter(RmTrie *self, RmNode *root, bool pre_order, bool all_n
 
 void rm_trie_iter(RmTrie *self, RmNode *root, bool pre_order, bool all_nodes,
                   RmTrieIterCallback callback, void *user_data) {
-    g_mutex_lock(&self->lock);
+    for(int i = 0; i < RM_TRIE_N_LOCKS; ++i) {
+        g_mutex_lock(&self->locks[i]);
+    }
+
     _rm_trie_iter(self, root, pre_order, all_nodes, callback, user_data, 0);
-    g_mutex_unlock(&self->lock);
+
+    for(int i = RM_TRIE_N_LOCKS - 1; i >= 0; --i) {
+        g_mutex_unlock(&self->locks[i]);
+    }
 }
 
 static int rm_trie_destroy_callback(_UNUSED RmTrie *self,
@@ -276,8 +363,15 @@ static int rm_trie_destroy_callback(_UNUSED RmTrie *self,
 
 void rm_trie_destroy(RmTrie *self) {
     rm_trie_iter(self, NULL, false, true, rm_trie_destroy_callback, NULL);
-    g_string_chunk_free(self->chunks);
-    g_mutex_clear(&self->lock);
+
+    for(int i = 0; i < RM_TRIE_N_CHUNKS; ++i) {
+        g_string_chunk_free(self->chunks[i]);
+        g_mutex_clear(&self->chunk_locks[i]);
+    }
+
+    for(int i = 0; i < RM_TRIE_N_LOCKS; ++i) {
+        g_mutex_clear(&self->locks[i]);
+    }
 }
 
 #ifdef _RM_PATHTRICIA_BUILD_MAIN
@@ -29,15 +29,30 @@
 #include <glib.h>
 #include <stdbool.h>
 
+/* Number of children kept in a plain array before switching to a hash table */
+#define RM_NODE_INLINE_CHILDREN (8)
+
+/* Number of locks that protect the children of the nodes (by parent address) */
+#define RM_TRIE_N_LOCKS (64)
+
+/* Number of string chunks (and locks) the basenames are interned into */
+#define RM_TRIE_N_CHUNKS (16)
+
 typedef struct _RmNode {
-    /* Element of the path */
+    /* Element of the path; interned, shared between equal basenames */
     char *basename;
 
     /* Parent node or NULL */
     struct _RmNode *parent;
 
-    /* Array of children nodes */
-    GHashTable *children;
+    /* Children nodes; an array of n_children nodes if there are
+     * not more than RM_NODE_INLINE_CHILDREN, a basename -> node table otherwise */
+    union {
+        struct _RmNode **array;
+        GHashTable *table;
+    } children;
+
+    guint32 n_children;
 
     /* data was set explicitly */
     char has_value : 1;
@@ -50,14 +65,15 @@ typedef struct _RmTrie {
     /* Root node or NULL if empty */
     RmNode *root;
 
-    /* chunk storage for strings */
-    GStringChunk *chunks;
+    /* chunk storage for strings, sharded by string hash */
+    GStringChunk *chunks[RM_TRIE_N_CHUNKS];
+    GMutex chunk_locks[RM_TRIE_N_CHUNKS];
 
     /* size of the trie */
     size_t size;
 
-    /* read write lock for insert/search */
-    GMutex lock;
+    /* locks for insert/search, sharded by the address of the parent node */
+    GMutex locks[RM_TRIE_N_LOCKS];
 } RmTrie;
 
 /* Callback to rm_trie_iter */
@@ -79,9 +95,25 @@ void rm_trie_destroy(RmTrie *self);
  * rm_trie_insert:
  * Insert a path to the trie and associate a value with it.
  * The value can be later requested with rm_trie_search*.
+ *
+ * Inserts may run in parallel; only the locks of the touched nodes are taken.
  */
 RmNode *rm_trie_insert(RmTrie *self, const char *path, void *value);
-RmNode *rm_trie_insert_unlocked(RmTrie *self, const char *path, void *value);
+
+/**
+ * rm_trie_insert_at:
+ * Like rm_trie_insert, but name is taken relative to parent, which saves
+ * walking down from the root. If parent is NULL, name is a full path.
+ */
+RmNode *rm_trie_insert_at(RmTrie *self, RmNode *parent, const char *name, void *value);
+
+/**
+ * rm_trie_get_node:
+ * Like rm_trie_insert_at, but the node is created without a value
+ * (or left as it is if it exists already). Useful to get directory nodes
+ * to use as parent for rm_trie_insert_at.
+ */
+RmNode *rm_trie_get_node(RmTrie *self, RmNode *parent, const char *name);
 
 /**
  * rm_trie_search_node:
@@ -107,6 +139,8 @@ bool rm_trie_set_value(RmTrie *self, const char *path, void *data);
  * Take a node and go up till parent while writing all nodes
  * in buf (or until buf_len is reached).
  *
+ * Nodes never change after insertion, so this needs no lock.
+ *
  * Returns the input buffer for chaining calls.
  */
 char *rm_trie_build_path(RmTrie *self, RmNode *node, char *buf, size_t buf_len);
@@ -130,6 +164,8 @@ size_t rm_trie_size(RmTrie *self);
  * If all_nodes is false only nodes that were explicitly inserted are traversed.
  *
  * user_data will be passed to the callback.
+ * The trie is locked during iteration; callbacks may only use
+ * rm_trie_build_path*() on it.
  */
 void rm_trie_iter(RmTrie *self,
                   RmNode *root,
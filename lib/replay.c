@@ -28,14 +28,18 @@
 #include "config.h"
 #include "file.h"
 #include "formats.h"
+#include "formats/binary.h"
+#include "md-scheduler.h"
 #include "preprocess.h"
 #include "session.h"
 #include "shredder.h"
 
 /* External libraries */
 #include <glib.h>
+#include <errno.h>
 #include <glib/gstdio.h>
 #include <math.h>
+#include <stdio.h>
 #include <string.h>
 
 #if HAVE_JSON_GLIB
@@ -76,17 +80,50 @@ typedef struct RmParrot {
     /* Global session */
     RmSession *session;
 
-    /* Json parser instance */
+    /* Json parser instance; only ever holds a single element */
     JsonParser *parser;
 
-    /* Root array of the json document */
-    JsonArray *root;
+    /* The .json file, read incrementally */
+    FILE *stream;
+
+    /* Read buffer for stream and the current position in it */
+    char *read_buf;
+    gsize read_len;
+    gsize read_pos;
+
+    /* Raw text of the current top-level array element */
+    GString *element;
+
+    /* Current element, valid until the next rm_parrot_read_object() */
+    JsonNode *node;
+    JsonObject *object;
+
+    /* true if the file was written by the "binary" formatter */
+    bool is_binary;
+
+    /* Binary format only: full path of each directory id */
+    GPtrArray *bin_dirs;
+
+    /* true if the closing ']' of the document (or EOF) was reached */
+    bool at_end;
+
+    /* Elements that were read ahead; their paths are already stat'ed */
+    GQueue *lookahead;
+
+    /* Paths from cfg->paths and the device they are on.
+     * Used to guess the device of a path without stat'ing it.
+     */
+    GQueue *path_devs;
+
+    /* Scheduler for the stat() calls of rm_parrot_fill_lookahead();
+     * restarted for every batch */
+    RmMDS *mds;
 
     /* Last original file that we encountered */
     RmFile *last_original;
 
     /* Index inside the document
-     * (0 is header, 1 first element, len(root) is footer)
+     * (0 is header, 1 first element, the last one is the footer)
      * */
     guint index;
 
@@ -119,13 +156,569 @@ static int rm_parrot_dir_trie_clear_children(_UNUSED RmTrie *self, RmNode *node,
     return 0;
 }
 
+/////////////////////////////////////////
+//  INCREMENTAL READING OF THE DOCUMENT  //
+/////////////////////////////////////////
+
+/* Size of the chunks read from the .json file */
+#define RM_PARROT_READ_BUF_SIZE (64 * 1024)
+
+static int rm_parrot_getc(RmParrot *polly) {
+    if(polly->read_pos >= polly->read_len) {
+        polly->read_len = fread(polly->read_buf, 1, RM_PARROT_READ_BUF_SIZE, polly->stream);
+        polly->read_pos = 0;
+        if(polly->read_len == 0) {
+            return EOF;
+        }
+    }
+
+    return (unsigned char)polly->read_buf[polly->read_pos++];
+}
+
+/* Skip whitespace and return the next significant character (or EOF) */
+static int rm_parrot_getc_nonspace(RmParrot *polly) {
+    int c = 0;
+    do {
+        c = rm_parrot_getc(polly);
+    } while(c != EOF && g_ascii_isspace(c));
+    return c;
+}
+
+/* Read the raw text of the next element of the top-level array into
+ * polly->element. Only strings and nesting are tracked here, the actual
+ * parsing of the element is done by json-glib. This way only a single
+ * element needs to be in memory, no matter how large the document is.
+ *
+ * Returns false when the end of the array was reached.
+ */
+static bool rm_parrot_read_element(RmParrot *polly) {
+    g_string_truncate(polly->element, 0);
+    if(polly->at_end) {
+        return false;
+    }
+
+    int c = rm_parrot_getc_nonspace(polly);
+    if(c == ',') {
+        c = rm_parrot_getc_nonspace(polly);
+    }
+
+    if(c == ']' || c == EOF) {
+        polly->at_end = true;
+        return false;
+    }
+
+    int depth = 0;
+    bool in_string = false, escaped = false;
+
+    for(; c != EOF; c = rm_parrot_getc(polly)) {
+        if(in_string) {
+            if(escaped) {
+                escaped = false;
+            } else if(c == '\\') {
+                escaped = true;
+            } else if(c == '"') {
+                in_string = false;
+            }
+        } else if(c == '"') {
+            in_string = true;
+        } else if(c == '{' || c == '[') {
+            depth++;
+        } else if(c == '}' || c == ']') {
+            if(depth == 0) {
+                /* End of the top-level array after a primitive element */
+                polly->at_end = true;
+                break;
+            }
+            depth--;
+        } else if(c == ',' && depth == 0) {
+            /* Separator after a primitive element */
+            break;
+        }
+
+        g_string_append_c(polly->element, c);
+
+        if(depth == 0 && !in_string && (c == '}' || c == ']')) {
+            break;
+        }
+    }
+
+    return polly->element->len > 0;
+}
+
+///////////////////////////////////////////
+//  READING OF THE BINARY RESULT FORMAT  //
+///////////////////////////////////////////
+
+/* Read exactly len bytes into dest; false on EOF */
+static bool rm_parrot_read(RmParrot *polly, void *dest, gsize len) {
+    char *dest_ptr = dest;
+    while(len > 0) {
+        if(polly->read_pos >= polly->read_len) {
+            polly->read_len =
+                fread(polly->read_buf, 1, RM_PARROT_READ_BUF_SIZE, polly->stream);
+            polly->read_pos = 0;
+            if(polly->read_len == 0) {
+                return false;
+            }
+        }
+
+        gsize chunk = MIN(len, polly->read_len - polly->read_pos);
+        memcpy(dest_ptr, polly->read_buf + polly->read_pos, chunk);
+        polly->read_pos += chunk;
+        dest_ptr += chunk;
+        len -= chunk;
+    }
+
+    return true;
+}
+
+/* Read a string prefixed by a guint16 length; the result needs to be freed */
+static char *rm_parrot_read_string(RmParrot *polly) {
+    guint16 len = 0;
+    if(!rm_parrot_read(polly, &len, sizeof(len))) {
+        return NULL;
+    }
+
+    char *string = g_malloc(len + 1);
+    if(!rm_parrot_read(polly, string, len)) {
+        g_free(string);
+        return NULL;
+    }
+
+    string[len] = 0;
+    return string;
+}
+
+/* Check the start of the read buffer for RM_FMT_BIN_MAGIC */
+static bool rm_parrot_is_binary(RmParrot *polly) {
+    polly->read_len = fread(polly->read_buf, 1, RM_PARROT_READ_BUF_SIZE, polly->stream);
+    polly->read_pos = 0;
+
+    return polly->read_len >= RM_FMT_BIN_MAGIC_LEN &&
+           memcmp(polly->read_buf, RM_FMT_BIN_MAGIC, RM_FMT_BIN_MAGIC_LEN) == 0;
+}
+
+/* Replace the current element by object */
+static void rm_parrot_set_binary_object(RmParrot *polly, JsonObject *object) {
+    if(polly->node != NULL) {
+        json_node_free(polly->node);
+    }
+
+    polly->node = json_node_new(JSON_NODE_OBJECT);
+    json_node_take_object(polly->node, object);
+    polly->object = object;
+}
+
+/* Read the header of a binary file and convert it to the json header object */
+static bool rm_parrot_read_binary_header(RmParrot *polly, GError **error) {
+    char magic[RM_FMT_BIN_MAGIC_LEN];
+    guint32 version = 0, byte_order = 0;
+    guint8 merge_directories = 0, cksum_type_len = 0;
+    char cksum_type[256];
+
+    if(!rm_parrot_read(polly, magic, sizeof(magic)) ||
+       !rm_parrot_read(polly, &version, sizeof(version)) ||
+       !rm_parrot_read(polly, &byte_order, sizeof(byte_order)) ||
+       !rm_parrot_read(polly, &merge_directories, sizeof(merge_directories)) ||
+       !rm_parrot_read(polly, &cksum_type_len, sizeof(cksum_type_len)) ||
+       !rm_parrot_read(polly, cksum_type, cksum_type_len)) {
+        g_set_error(error, RM_ERROR_QUARK, 0, _("Truncated binary header"));
+        return false;
+    }
+
+    if(byte_order != RM_FMT_BIN_BYTE_ORDER) {
+        g_set_error(error, RM_ERROR_QUARK, 0,
+                    _("Binary file was written on a machine with different byte order"));
+        return false;
+    }
+
+    if(version != RM_FMT_BIN_VERSION) {
+        g_set_error(error, RM_ERROR_QUARK, 0, _("Unsupported binary format version %u"),
+                    version);
+        return false;
+    }
+
+    cksum_type[cksum_type_len] = 0;
+
+    JsonObject *object = json_object_new();
+    json_object_set_boolean_member(object, "merge_directories", merge_directories);
+    json_object_set_string_member(object, "checksum_type", cksum_type);
+    rm_parrot_set_binary_object(polly, object);
+    return true;
+}
+
+static bool rm_parrot_read_binary_dir(RmParrot *polly) {
+    guint32 id = 0, parent_id = 0;
+    if(!rm_parrot_read(polly, &id, sizeof(id)) ||
+       !rm_parrot_read(polly, &parent_id, sizeof(parent_id))) {
+        return false;
+    }
+
+    char *basename = rm_parrot_read_string(polly);
+    if(basename == NULL) {
+        return false;
+    }
+
+    if(parent_id >= polly->bin_dirs->len || id == 0) {
+        rm_log_warning_line(_("Invalid directory record #%u in binary file"), id);
+        g_free(basename);
+        return true;
+    }
+
+    if(id >= polly->bin_dirs->len) {
+        g_ptr_array_set_size(polly->bin_dirs, id + 1);
+    }
+
+    const char *parent_path = g_ptr_array_index(polly->bin_dirs, parent_id);
+    g_free(g_ptr_array_index(polly->bin_dirs, id));
+    g_ptr_array_index(polly->bin_dirs, id) =
+        g_strdup_printf("%s/%s", parent_path ? parent_path : "", basename);
+
+    g_free(basename);
+    return true;
+}
+
+static bool rm_parrot_read_binary_file(RmParrot *polly) {
+    guint32 dir_id = 0, cksum_len = 0;
+    guint8 lint_type = 0, flags = 0;
+    guint64 size = 0, inode = 0, dev = 0, n_children = 0;
+    gdouble mtime = 0;
+    gint16 depth = 0;
+
+    if(!rm_parrot_read(polly, &dir_id, sizeof(dir_id))) {
+        return false;
+    }
+
+    char *basename = rm_parrot_read_string(polly);
+    if(basename == NULL) {
+        return false;
+    }
+
+    if(!rm_parrot_read(polly, &lint_type, sizeof(lint_type)) ||
+       !rm_parrot_read(polly, &flags, sizeof(flags)) ||
+       !rm_parrot_read(polly, &size, sizeof(size)) ||
+       !rm_parrot_read(polly, &inode, sizeof(inode)) ||
+       !rm_parrot_read(polly, &dev, sizeof(dev)) ||
+       !rm_parrot_read(polly, &mtime, sizeof(mtime)) ||
+       !rm_parrot_read(polly, &depth, sizeof(depth)) ||
+       !rm_parrot_read(polly, &n_children, sizeof(n_children)) ||
+       !rm_parrot_read(polly, &cksum_len, sizeof(cksum_len))) {
+        g_free(basename);
+        return false;
+    }
+
+    if(cksum_len > RM_FMT_BIN_MAX_CKSUM_LEN) {
+        /* corrupt; don't let it allocate gigabytes */
+        g_free(basename);
+        return false;
+    }
+
+    guint8 *cksum = g_malloc(cksum_len);
+    char *parent_path = NULL;
+    if(!rm_parrot_read(polly, cksum, cksum_len) ||
+       (parent_path = rm_parrot_read_string(polly)) == NULL) {
+        g_free(basename);
+        g_free(cksum);
+        return false;
+    }
+
+    const char *dir_path = NULL;
+    if(dir_id < polly->bin_dirs->len) {
+        dir_path = g_ptr_array_index(polly->bin_dirs, dir_id);
+    }
+
+    JsonObject *object = json_object_new();
+    if(dir_path != NULL) {
+        char *path = g_strdup_printf("%s/%s", dir_path, basename);
+        json_object_set_string_member(object, "path", path);
+        g_free(path);
+    } else {
+        rm_log_warning_line(_("Unknown directory #%u in binary file"), dir_id);
+    }
+
+    json_object_set_string_member(object, "type", rm_file_lint_type_to_string(lint_type));
+    json_object_set_boolean_member(object, "is_original", flags & RM_FMT_BIN_FLAG_ORIGINAL);
+    json_object_set_int_member(object, "size", size);
+    json_object_set_int_member(object, "depth", depth);
+    json_object_set_int_member(object, "inode", inode);
+    json_object_set_int_member(object, "disk_id", dev);
+    json_object_set_double_member(object, "mtime", mtime);
+
+    if(lint_type == RM_LINT_TYPE_DUPE_DIR_CANDIDATE) {
+        json_object_set_int_member(object, "n_children", n_children);
+    }
+
+    if(cksum_len > 0) {
+        /* The json formatter writes hex, which is what the ext digest expects */
+        static const char *hex = "0123456789abcdef";
+        char *cksum_str = g_malloc(cksum_len * 2 + 1);
+        for(guint32 i = 0; i < cksum_len; ++i) {
+            cksum_str[2 * i + 0] = hex[cksum[i] / 16];
+            cksum_str[2 * i + 1] = hex[cksum[i] % 16];
+        }
+        cksum_str[cksum_len * 2] = 0;
+        json_object_set_string_member(object, "checksum", cksum_str);
+        g_free(cksum_str);
+    }
+
+    if(flags & RM_FMT_BIN_FLAG_HARDLINK) {
+        /* Only the presence of this member is checked */
+        json_object_set_int_member(object, "hardlink_of", 0);
+    }
+
+    if(lint_type == RM_LINT_TYPE_PART_OF_DIRECTORY) {
+        json_object_set_string_member(object, "parent_path", parent_path);
+    }
+
+    rm_parrot_set_binary_object(polly, object);
+
+    g_free(basename);
+    g_free(cksum);
+    g_free(parent_path);
+    return true;
+}
+
+/* Binary counterpart of rm_parrot_read_object(); every FILE record is
+ * converted to the same object the json formatter would have written.
+ */
+static bool rm_parrot_read_binary_object(RmParrot *polly) {
+    while(!polly->at_end) {
+        guint8 tag = 0;
+        if(!rm_parrot_read(polly, &tag, sizeof(tag))) {
+            rm_log_warning_line(_("Binary file ends without end record"));
+            break;
+        }
+
+        bool success = true;
+        switch(tag) {
+        case RM_FMT_BIN_TAG_DIR:
+            success = rm_parrot_read_binary_dir(polly);
+            break;
+        case RM_FMT_BIN_TAG_GROUP:
+            /* Groups are recognized by is_original, like in the json file */
+            break;
+        case RM_FMT_BIN_TAG_FILE:
+            if(rm_parrot_read_binary_file(polly)) {
+                return true;
+            }
+            success = false;
+            break;
+        case RM_FMT_BIN_TAG_END:
+            polly->at_end = true;
+            break;
+        default:
+            rm_log_warning_line(_("Unknown record type %u in binary file"), tag);
+            success = false;
+            break;
+        }
+
+        if(!success) {
+            rm_log_warning_line(_("Binary file is truncated or corrupt; stopping at #%u"),
+                                polly->index);
+            break;
+        }
+    }
+
+    polly->at_end = true;
+    return false;
+}
+
+/* Read and parse the next object of the top-level array into polly->object.
+ * Elements that are no valid objects are skipped with a warning.
+ */
+static bool rm_parrot_read_object(RmParrot *polly) {
+    polly->object = NULL;
+
+    if(polly->is_binary) {
+        return rm_parrot_read_binary_object(polly);
+    }
+
+    while(rm_parrot_read_element(polly)) {
+        GError *error = NULL;
+        if(!json_parser_load_from_data(polly->parser, polly->element->str,
+                                       polly->element->len, &error)) {
+            rm_log_warning_line(_("Skipping invalid json element #%u: %s"), polly->index,
+                                error->message);
+            g_error_free(error);
+            polly->index++;
+            continue;
+        }
+
+        JsonNode *node = json_parser_get_root(polly->parser);
+        if(node == NULL || JSON_NODE_TYPE(node) != JSON_NODE_OBJECT) {
+            polly->index++;
+            continue;
+        }
+
+        polly->node = node;
+        polly->object = json_node_get_object(node);
+        return true;
+    }
+
+    return false;
+}
+
+//////////////////////////////////////////
+//  PARALLEL STAT OF READ AHEAD ENTRIES  //
+//////////////////////////////////////////
+
+/* Number of elements that are read ahead and stat'ed in one go */
+#define RM_PARROT_LOOKAHEAD (4 * 1024)
+
+/* One element of the json document, read ahead of time */
+typedef struct RmParrotEntry {
+    /* The parsed element; owned by the entry */
+    JsonNode *node;
+
+    /* Value of the "path" member or NULL; memory owned by node */
+    const char *path;
+
+    /* Device this entry was scheduled on (may be NULL) */
+    RmMDSDevice *disk;
+
+    /* Result of lstat() and stat() on path (-1 on error) */
+    int lstat_rc;
+    int stat_rc;
+    RmStat lstat_buf;
+    RmStat stat_buf;
+} RmParrotEntry;
+
+typedef struct RmParrotPathDev {
+    const char *path;
+    size_t path_len;
+    dev_t dev;
+} RmParrotPathDev;
+
+static void rm_parrot_entry_free(RmParrotEntry *entry) {
+    json_node_free(entry->node);
+    g_slice_free(RmParrotEntry, entry);
+}
+
+static void rm_parrot_entry_stat(RmParrotEntry *entry) {
+    entry->lstat_rc = rm_sys_lstat(entry->path, &entry->lstat_buf);
+    if(entry->lstat_rc == -1) {
+        return;
+    }
+
+    if(S_ISLNK(entry->lstat_buf.st_mode)) {
+        entry->stat_rc = rm_sys_stat(entry->path, &entry->stat_buf);
+    } else {
+        /* No need for another syscall; stat() would yield the same */
+        entry->stat_buf = entry->lstat_buf;
+        entry->stat_rc = 0;
+    }
+}
+
+/* RmMDSFunc; called from the device worker threads */
+static gint rm_parrot_entry_stat_func(RmParrotEntry *entry, _UNUSED RmParrot *polly) {
+    rm_parrot_entry_stat(entry);
+    rm_mds_device_ref(entry->disk, -1);
+    return 1;
+}
+
+/* Guess the device of path by the longest matching path in cfg->paths */
+static dev_t rm_parrot_guess_dev(RmParrot *polly, const char *path) {
+    dev_t dev = 0;
+    size_t highest_match = 0;
+
+    for(GList *iter = polly->path_devs->head; iter; iter = iter->next) {
+        RmParrotPathDev *path_dev = iter->data;
+        size_t len = path_dev->path_len;
+        if(len > highest_match && strncmp(path, path_dev->path, len) == 0 &&
+           (path[len] == '/' || path[len] == 0 || path_dev->path[len - 1] == '/')) {
+            /* "/mnt/a" is no parent of "/mnt/ab" */
+            highest_match = len;
+            dev = path_dev->dev;
+        }
+    }
+
+    return dev;
+}
+
+/* Use the hash of the parent directory as offset for the elevator.
+ * This way entries of the same directory are stat'ed together.
+ */
+static gint64 rm_parrot_dir_offset(const char *path) {
+    const char *slash = strrchr(path, '/');
+    guint32 hash = 5381;
+
+    for(const char *c = path; c < slash; ++c) {
+        hash = (hash << 5) + hash + (unsigned char)*c;
+    }
+
+    return hash;
+}
+
+/* Read up to RM_PARROT_LOOKAHEAD elements and stat their paths.
+ * Every disk gets its own workers via RmMDS, so on slow (network)
+ * filesystems many stat() calls are in flight at the same time.
+ * The order of polly->lookahead is the order of the document.
+ */
+static void rm_parrot_fill_lookahead(RmParrot *polly) {
+    RmMDS *mds = polly->mds;
+
+    while(polly->lookahead->length < RM_PARROT_LOOKAHEAD && rm_parrot_read_object(polly)) {
+        RmParrotEntry *entry = g_slice_new0(RmParrotEntry);
+        entry->node = json_node_copy(polly->node);
+        entry->lstat_rc = entry->stat_rc = -1;
+        g_queue_push_tail(polly->lookahead, entry);
+
+        JsonObject *object = json_node_get_object(entry->node);
+        JsonNode *path_node = json_object_get_member(object, "path");
+        if(path_node == NULL) {
+            continue;
+        }
+
+        entry->path = json_node_get_string(path_node);
+        if(entry->path == NULL) {
+            continue;
+        }
+
+        dev_t dev = rm_parrot_guess_dev(polly, entry->path);
+        if(dev == 0) {
+            /* Not below any given path; will be filtered anyways */
+            rm_parrot_entry_stat(entry);
+            continue;
+        }
+
+        entry->disk = rm_mds_device_get(mds, entry->path, dev);
+        rm_mds_device_ref(entry->disk, 1);
+        rm_mds_push_task(entry->disk, dev, rm_parrot_dir_offset(entry->path),
+                         entry->path, entry);
+    }
+
+    /* Start the workers and wait for all of them to finish */
+    rm_mds_start(mds);
+    rm_mds_finish(mds);
+}
+
 static void rm_parrot_close(RmParrot *polly) {
     if(polly->parser) {
         g_object_unref(polly->parser);
     }
 
+    if(polly->stream) {
+        fclose(polly->stream);
+    }
+
+    if(polly->is_binary && polly->node) {
+        json_node_free(polly->node);
+    }
+
+    if(polly->bin_dirs) {
+        g_ptr_array_free(polly->bin_dirs, TRUE);
+    }
+
+    g_free(polly->read_buf);
+    g_string_free(polly->element, TRUE);
+    g_queue_free_full(polly->lookahead, (GDestroyNotify)rm_parrot_entry_free);
+    g_queue_free_full(polly->path_devs, (GDestroyNotify)g_free);
+
     g_hash_table_unref(polly->disk_ids);
 
+    /* also frees the mount table if the scheduler had to create one */
+    rm_mds_free(polly->mds, polly->session->mounts == NULL);
+
     /* Free the GQeues in the trie */
     rm_trie_iter(
         &polly->directory_trie,
@@ -146,32 +739,60 @@ static RmParrot *rm_parrot_open(RmSession *session, const char *json_path, bool
     RmParrot *polly = g_malloc0(sizeof(RmParrot));
     polly->session = session;
     polly->parser = json_parser_new();
+    polly->read_buf = g_malloc(RM_PARROT_READ_BUF_SIZE);
+    polly->element = g_string_sized_new(1024);
+    polly->lookahead = g_queue_new();
+    polly->path_devs = g_queue_new();
     polly->disk_ids = g_hash_table_new(NULL, NULL);
-    polly->index = 1;
+    polly->index = 0;
     polly->is_prefd = is_prefd;
     rm_trie_init(&polly->directory_trie);
 
+    RmCfg *cfg = session->cfg;
+    polly->mds = rm_mds_new(cfg->threads, session->mounts, cfg->fake_pathindex_as_disk);
+    rm_mds_configure(polly->mds, (RmMDSFunc)rm_parrot_entry_stat_func, polly, 0,
+                     cfg->threads_per_disk, (RmMDSSortFunc)rm_mds_elevator_cmp);
+
     for(GSList *iter = session->cfg->paths; iter; iter = iter->next) {
         RmPath *rmpath = iter->data;
         RmStat stat_buf;
         if(rm_sys_stat(rmpath->path, &stat_buf) != -1) {
             g_hash_table_add(polly->disk_ids, GUINT_TO_POINTER(stat_buf.st_dev));
+
+            RmParrotPathDev *path_dev = g_malloc0(sizeof(RmParrotPathDev));
+            path_dev->path = rmpath->path;
+            path_dev->path_len = strlen(rmpath->path);
+            path_dev->dev = stat_buf.st_dev;
+            g_queue_push_tail(polly->path_devs, path_dev);
         }
     }
 
-    if(!json_parser_load_from_file(polly->parser, json_path, error)) {
+    polly->stream = fopen(json_path, "rb");
+    if(polly->stream == NULL) {
+        g_set_error(error, RM_ERROR_QUARK, 0, _("Unable to open %s: %s"), json_path,
+                    g_strerror(errno));
+        rm_parrot_close(polly);
         return NULL;
     }
 
-    JsonNode *root = json_parser_get_root(polly->parser);
-    if(JSON_NODE_TYPE(root) != JSON_NODE_ARRAY) {
+    if(rm_parrot_is_binary(polly)) {
+        polly->is_binary = true;
+        polly->bin_dirs = g_ptr_array_new_with_free_func(g_free);
+        g_ptr_array_add(polly->bin_dirs, g_strdup(""));
+
+        if(!rm_parrot_read_binary_header(polly, error)) {
+            rm_parrot_close(polly);
+            return NULL;
+        }
+    } else if(rm_parrot_getc_nonspace(polly) != '[' || !rm_parrot_read_object(polly)) {
         g_set_error(error, RM_ERROR_QUARK, 0, _("No valid json cache (no array in /)"));
+        rm_parrot_close(polly);
         return NULL;
     }
 
-    polly->root = json_node_get_array(root);
-
-    JsonObject *object = json_array_get_object_element(polly->root, 0);
+    /* First element is the header */
+    JsonObject *object = polly->object;
+    polly->index = 1;
     JsonNode *merge_directories_node = json_object_get_member(object, "merge_directories");
 
     if(merge_directories_node != NULL) {
@@ -210,30 +831,23 @@ static bool rm_parrot_has_next(RmParrot *polly) {
         polly->unpacker = NULL;
     }
 
-    return (polly->index < json_array_get_length(polly->root));
-}
-
-static RmFile *rm_parrot_try_next(RmParrot *polly) {
-    if(!rm_parrot_has_next(polly)) {
-        return NULL;
+    if(polly->lookahead->length == 0) {
+        rm_parrot_fill_lookahead(polly);
     }
 
-    RmFile *file = NULL;
-    const char *path = NULL;
-
-    JsonObject *object = json_array_get_object_element(polly->root, polly->index);
+    return polly->lookahead->length > 0;
+}
 
-    /* Deliver a higher index the next time, even if it fails */
-    polly->index += 1;
+static RmFile *rm_parrot_try_next_entry(RmParrot *polly, RmParrotEntry *entry) {
+    RmFile *file = NULL;
+    const char *path = entry->path;
+    JsonObject *object = json_node_get_object(entry->node);
 
     /* Read the path (without generating a warning if it's not there) */
-    JsonNode *path_node = json_object_get_member(object, "path");
-    if(path_node == NULL) {
+    if(path == NULL) {
         return NULL;
     }
 
-    path = json_node_get_string(path_node);
-
     /* Check for the lint type */
     RmLintType type =
         rm_file_string_to_lint_type(json_object_get_string_member(object, "type"));
@@ -244,18 +858,18 @@ static RmFile *rm_parrot_try_next(RmParrot *polly) {
         return NULL;
     }
 
-    /* Collect file information (for rm_file_new) */
-    RmStat lstat_buf, stat_buf;
+    /* Collect file information (for rm_file_new); stat'ed in rm_parrot_fill_lookahead() */
+    RmStat lstat_buf = entry->lstat_buf;
     RmStat *stat_info = &lstat_buf;
-    if(rm_sys_lstat(path, &lstat_buf) == -1) {
+    if(entry->lstat_rc == -1) {
         return NULL;
     }
 
     /* use stat() after lstat() to find out if it's an symlink.
      * If it's a bad link, this will fail with stat_info still pointing to lstat.
      * */
-    if(rm_sys_stat(path, &stat_buf) != -1) {
-        stat_info = &stat_buf;
+    if(entry->stat_rc != -1) {
+        stat_info = &entry->stat_buf;
     }
 
     /* Check if we're late and issue an warning */
@@ -273,7 +887,7 @@ static RmFile *rm_parrot_try_next(RmParrot *polly) {
     }
 
     /* Fill up the RmFile */
-    file = rm_file_new(polly->session, path, stat_info, type, 0, 0, 0);
+    file = rm_file_new(polly->session, path, NULL, stat_info, type, 0, 0, 0);
     file->is_original = json_object_get_boolean_member(object, "is_original");
     file->is_symlink = (lstat_buf.st_mode & S_IFLNK);
     file->digest = rm_digest_new(RM_DIGEST_EXT, 0);
@@ -340,6 +954,20 @@ static RmFile *rm_parrot_try_next(RmParrot *polly) {
     return file;
 }
 
+static RmFile *rm_parrot_try_next(RmParrot *polly) {
+    RmParrotEntry *entry = g_queue_pop_head(polly->lookahead);
+    if(entry == NULL) {
+        return NULL;
+    }
+
+    /* Deliver the next element the next time, even if it fails */
+    polly->index += 1;
+
+    RmFile *file = rm_parrot_try_next_entry(polly, entry);
+    rm_parrot_entry_free(entry);
+    return file;
+}
+
 static int rm_parrot_iter_dir_children(_UNUSED RmTrie *self, RmNode *node, _UNUSED int level, void *user_data) {
     RmUnpackedDirectory *unpacker = user_data;
 
@@ -744,6 +1372,7 @@ static void rm_parrot_cage_write_group(RmParrotCage *cage, GQueue *group, bool p
         file->twin_count = group->length;
 
         if(pack_directories && file->lint_type == RM_LINT_TYPE_DUPE_CANDIDATE) {
+            rm_tm_add_candidate(cage->tree_merger, file);
             rm_tm_feed(cage->tree_merger, file);
         } else {
             rm_fmt_write(file, cage->session->formats);
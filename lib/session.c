@@ -27,6 +27,8 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "checksums/xxhash/xxhash.h"
+#include "chunker.h"
 #include "config.h"
 #include "formats.h"
 #include "preprocess.h"
@@ -139,6 +141,10 @@ void rm_session_clear(RmSession *session) {
         rm_tm_destroy(session->dir_merger);
     }
 
+    if(session->chunker) {
+        rm_chunk_destroy(session->chunker);
+    }
+
     g_free(cfg->joined_argv);
     g_free(cfg->full_argv0_path);
     g_free(cfg->iwd);
@@ -201,6 +207,237 @@ void rm_session_acknowledge_abort(const gint abort_count) {
 # define _MIN_LINUX_SUBVERSION     2
 #endif
 
+#if HAVE_FIDEDUPERANGE || HAVE_BTRFS_H
+
+/* a poorly-documented limit for dedupe ioctl's */
+static const gint64 max_dedupe_chunk = 16 * 1024 * 1024;
+
+/* how fine a resolution to use once difference detected;
+ * use btrfs default node size (16k); this is also the
+ * block size used by --dedupe-partial: */
+static const gint64 min_dedupe_chunk = 16 * 1024;
+
+/* Dedupe a single range of at most max_dedupe_chunk bytes.
+ * If the data differs, the range is split into blocks of min_dedupe_chunk,
+ * which are tried one by one. Returns 0 or an errno. */
+static int rm_session_dedupe_range(int source_fd, int dest_fd, gint64 src_offset,
+                                   gint64 dest_offset, gint64 length,
+                                   gint64 *bytes_deduped) {
+    struct {
+        struct _FILE_DEDUPE_RANGE args;
+        struct _FILE_DEDUPE_RANGE_INFO info;
+    } dedupe;
+    memset(&dedupe, 0, sizeof(dedupe));
+
+    dedupe.args.dest_count = 1;
+    dedupe.args._SRC_OFFSET = src_offset;
+    dedupe.args._SRC_LENGTH = length;
+    dedupe.info._DEST_FD = dest_fd;
+    dedupe.info._DEST_OFFSET = dest_offset;
+
+    if(ioctl(source_fd, _DEDUPE_IOCTL, &dedupe) != 0) {
+        return errno;
+    }
+
+    if(dedupe.info.status == _DATA_DIFFERS) {
+        /* block digests collided or one of the files changed meanwhile */
+        for(gint64 done = 0; length > min_dedupe_chunk && done < length;
+            done += min_dedupe_chunk) {
+            int ret = rm_session_dedupe_range(
+                source_fd, dest_fd, src_offset + done, dest_offset + done,
+                MIN(min_dedupe_chunk, length - done), bytes_deduped);
+            if(ret != 0) {
+                return ret;
+            }
+        }
+        return 0;
+    } else if(dedupe.info.status != 0) {
+        return -dedupe.info.status;
+    }
+
+    *bytes_deduped += dedupe.info.bytes_deduped;
+    return 0;
+}
+
+/* Digest of one aligned block of min_dedupe_chunk bytes */
+typedef struct RmDedupeBlock {
+    guint64 digest;
+    gint64 offset;
+} RmDedupeBlock;
+
+typedef void (*RmDedupeBlockFunc)(RmDedupeBlock *block, gpointer user_data);
+
+static gint rm_session_dedupe_block_cmp(const RmDedupeBlock *a, const RmDedupeBlock *b) {
+    RETURN_IF_NONZERO(SIGN_DIFF(a->digest, b->digest));
+    return SIGN_DIFF(a->offset, b->offset);
+}
+
+/* Call func for each full aligned block of fd, in file order.
+ * A partial block at the end of the file is skipped, since dedupe lengths
+ * need to be aligned unless the range ends at the end of the files. */
+static bool rm_session_dedupe_read_blocks(int fd, gint64 size, RmDedupeBlockFunc func,
+                                          gpointer user_data) {
+    const gsize buf_len = 64 * min_dedupe_chunk;
+    guint8 *buf = g_malloc(buf_len);
+    gint64 offset = 0;
+    bool success = true;
+
+    while(offset + min_dedupe_chunk <= size && !rm_session_was_aborted()) {
+        gsize want = MIN((gint64)buf_len, size - offset);
+        want -= want % min_dedupe_chunk;
+
+        ssize_t got = pread(fd, buf, want, offset);
+        if(got < min_dedupe_chunk) {
+            if(got < 0) {
+                rm_log_perror("pread");
+                success = false;
+            }
+            break;
+        }
+
+        for(gsize pos = 0; pos + min_dedupe_chunk <= (gsize)got; pos += min_dedupe_chunk) {
+            RmDedupeBlock block;
+            block.digest = XXH64(buf + pos, min_dedupe_chunk, 0);
+            block.offset = offset + pos;
+            func(&block, user_data);
+        }
+
+        offset += got - got % min_dedupe_chunk;
+    }
+
+    g_free(buf);
+    return success;
+}
+
+static void rm_session_dedupe_collect_block(RmDedupeBlock *block, GArray *blocks) {
+    g_array_append_val(blocks, *block);
+}
+
+/* State while walking the dest file's blocks */
+typedef struct RmDedupePartial {
+    int source_fd;
+    int dest_fd;
+
+    /* source blocks, sorted by digest and offset */
+    GArray *blocks;
+
+    /* current run of matching blocks that was not submitted yet */
+    gint64 run_src;
+    gint64 run_dest;
+    gint64 run_len;
+
+    gint64 bytes_deduped;
+    guint n_ranges;
+    int ret;
+} RmDedupePartial;
+
+/* Find a source block with digest; prefer the one at offset */
+static RmDedupeBlock *rm_session_dedupe_lookup(GArray *blocks, guint64 digest,
+                                               gint64 offset) {
+    RmDedupeBlock key = {.digest = digest, .offset = offset};
+
+    /* lower bound of key */
+    guint lo = 0, hi = blocks->len;
+    while(lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+        if(rm_session_dedupe_block_cmp(&g_array_index(blocks, RmDedupeBlock, mid), &key) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if(lo < blocks->len && g_array_index(blocks, RmDedupeBlock, lo).digest == digest) {
+        return &g_array_index(blocks, RmDedupeBlock, lo);
+    }
+
+    if(lo > 0 && g_array_index(blocks, RmDedupeBlock, lo - 1).digest == digest) {
+        return &g_array_index(blocks, RmDedupeBlock, lo - 1);
+    }
+
+    return NULL;
+}
+
+static void rm_session_dedupe_flush(RmDedupePartial *state) {
+    if(state->run_len == 0 || state->ret != 0) {
+        return;
+    }
+
+    rm_log_debug_line("Dedupe range %" G_GINT64_FORMAT " -> %" G_GINT64_FORMAT
+                      " (%" G_GINT64_FORMAT " bytes)",
+                      state->run_src, state->run_dest, state->run_len);
+
+    state->ret = rm_session_dedupe_range(state->source_fd, state->dest_fd,
+                                         state->run_src, state->run_dest,
+                                         state->run_len, &state->bytes_deduped);
+    state->n_ranges++;
+    state->run_len = 0;
+}
+
+static void rm_session_dedupe_match_block(RmDedupeBlock *block, RmDedupePartial *state) {
+    /* continuing the current run is best, then the same offset */
+    gint64 expected = (state->run_len) ? state->run_src + state->run_len : block->offset;
+    RmDedupeBlock *match = rm_session_dedupe_lookup(state->blocks, block->digest, expected);
+
+    if(match && state->run_len && match->offset == expected &&
+       block->offset == state->run_dest + state->run_len &&
+       state->run_len < max_dedupe_chunk) {
+        state->run_len += min_dedupe_chunk;
+        return;
+    }
+
+    rm_session_dedupe_flush(state);
+
+    if(match) {
+        state->run_src = match->offset;
+        state->run_dest = block->offset;
+        state->run_len = min_dedupe_chunk;
+    }
+}
+
+/* Dedupe every aligned block of dest that also exists somewhere in source.
+ * Adjacent blocks are merged into one range, so files that share long runs
+ * (like two similar VM images) need only few ioctl's. The kernel compares the
+ * data itself, so a digest collision only costs a failed attempt.
+ * Returns 0 or an errno. */
+static int rm_session_dedupe_partial(int source_fd, gint64 source_size, int dest_fd,
+                                     gint64 dest_size, gint64 *bytes_deduped) {
+    RmDedupePartial state;
+    memset(&state, 0, sizeof(state));
+    state.source_fd = source_fd;
+    state.dest_fd = dest_fd;
+    state.blocks = g_array_sized_new(FALSE, FALSE, sizeof(RmDedupeBlock),
+                                     source_size / min_dedupe_chunk);
+
+    if(rm_session_dedupe_read_blocks(source_fd, source_size,
+                                     (RmDedupeBlockFunc)rm_session_dedupe_collect_block,
+                                     state.blocks)) {
+        g_array_sort(state.blocks, (GCompareFunc)rm_session_dedupe_block_cmp);
+        rm_session_dedupe_read_blocks(dest_fd, dest_size,
+                                      (RmDedupeBlockFunc)rm_session_dedupe_match_block,
+                                      &state);
+        rm_session_dedupe_flush(&state);
+    }
+
+    /* A partial last block can only be shared with the one of source */
+    gint64 tail = dest_size % min_dedupe_chunk;
+    if(state.ret == 0 && tail > 0 && source_size % min_dedupe_chunk == tail &&
+       !rm_session_was_aborted()) {
+        state.ret = rm_session_dedupe_range(source_fd, dest_fd, source_size - tail,
+                                            dest_size - tail, tail, &state.bytes_deduped);
+        state.n_ranges++;
+    }
+
+    rm_log_debug_line("Deduped %" G_GINT64_FORMAT " bytes in %u ranges",
+                      state.bytes_deduped, state.n_ranges);
+
+    g_array_free(state.blocks, TRUE);
+    *bytes_deduped = state.bytes_deduped;
+    return state.ret;
+}
+
+#endif
+
 /**
  * *********** dedupe session main ************
  **/
@@ -246,13 +483,6 @@ int rm_session_dedupe_main(RmCfg *cfg) {
     fstat(source_fd, &source_stat);
     gint64 bytes_deduped = 0;
 
-    /* a poorly-documented limit for dedupe ioctl's */
-    static const gint64 max_dedupe_chunk = 16 * 1024 * 1024;
-
-    /* how fine a resolution to use once difference detected;
-     * use btrfs default node size (16k): */
-    static const gint64 min_dedupe_chunk = 16 * 1024;
-
     rm_log_debug_line("Cloning using %s", _DEDUPE_IOCTL_NAME);
 
     if(!rm_session_check_kernel_version(4, _MIN_LINUX_SUBVERSION)) {
@@ -292,7 +522,18 @@ int rm_session_dedupe_main(RmCfg *cfg) {
 
     int ret = 0;
     gint64 dedupe_chunk = max_dedupe_chunk;
-    while(bytes_deduped < source_stat.st_size && !rm_session_was_aborted()) {
+    struct stat dest_stat;
+    fstat(dedupe.info._DEST_FD, &dest_stat);
+
+    if(cfg->dedupe_partial) {
+        ret = rm_session_dedupe_partial(source_fd, source_stat.st_size,
+                                        dedupe.info._DEST_FD, dest_stat.st_size,
+                                        &bytes_deduped);
+        errno = ret;
+    }
+
+    while(!cfg->dedupe_partial && bytes_deduped < source_stat.st_size &&
+          !rm_session_was_aborted()) {
         dedupe.args.dest_count = 1;
         /* TODO: multiple destinations at same time? */
         dedupe.args._SRC_OFFSET = bytes_deduped;
@@ -331,6 +572,10 @@ int rm_session_dedupe_main(RmCfg *cfg) {
         rm_log_perrorf(_("%s returned error: (%d)"), _DEDUPE_IOCTL_NAME, ret);
     } else if(bytes_deduped == 0) {
         rm_log_info_line(_("Files don't match - not deduped"));
+    } else if(cfg->dedupe_partial) {
+        rm_log_info_line(_("%" G_GINT64_FORMAT " of %" G_GINT64_FORMAT
+                           " bytes deduped"),
+                         bytes_deduped, (gint64)dest_stat.st_size);
     } else if(bytes_deduped < source_stat.st_size) {
         rm_log_info_line(_("Only first %"G_GINT64_FORMAT" bytes deduped "
                            "- files not fully identical"),
@@ -340,7 +585,9 @@ int rm_session_dedupe_main(RmCfg *cfg) {
     rm_sys_close(source_fd);
     rm_sys_close(dedupe.info._DEST_FD);
 
-    if(bytes_deduped == source_stat.st_size) {
+    /* in partial mode dest may be larger than source */
+    gint64 complete_size = (cfg->dedupe_partial) ? dest_stat.st_size : source_stat.st_size;
+    if(bytes_deduped == complete_size) {
         if(cfg->dedupe_check_xattr && !cfg->dedupe_readonly) {
             rm_xattr_mark_deduplicated(dest->path, cfg->follow_symlinks);
         }
@@ -348,6 +595,10 @@ int rm_session_dedupe_main(RmCfg *cfg) {
         return EXIT_SUCCESS;
     }
 
+    if(cfg->dedupe_partial && ret == 0 && bytes_deduped > 0) {
+        return EXIT_SUCCESS;
+    }
+
 #else
     (void)cfg;
     rm_log_error_line(_("rmlint was not compiled with file cloning support."))
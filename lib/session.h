@@ -71,6 +71,9 @@ typedef struct RmSession {
     /* Treemerging for -D */
     struct RmTreeMerger *dir_merger;
 
+    /* Block level savings estimation for --chunk-savings */
+    struct RmChunker *chunker;
+
     /* Shredder session */
     struct RmShredTag *shredder;
 
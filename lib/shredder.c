@@ -31,6 +31,8 @@
 #include <sys/uio.h>
 
 #include "checksum.h"
+#include "chunker.h"
+#include "fd-cache.h"
 #include "hasher.h"
 
 #include "formats.h"
@@ -57,6 +59,11 @@
  *
  * The default step size can be configured below.
  *
+ * Generations that end within the first SHRED_FAST_TIER_BYTES only use a fast
+ * digest (xxhash) if the configured one is cryptographic.  The first generation
+ * beyond that starts the strong digest from the beginning of the file again, so
+ * the checksum of finished groups always covers the whole file.
+ *
  *
  * The clusters and generations look something like this:
  *
@@ -255,6 +262,11 @@
  * hashtable lookup to quickly identify potential matches.  This saves time in
  * the case of RmShredGroups with large number of child groups and where the
  * pre-matching strategy failed.
+ *
+ * With --lockstep-paranoid the increments are cut down to a window that
+ * shrinks with the number of files that may still be in the group, so that
+ * all members are compared (and split up) window by window with memory
+ * bounded by members x window size, rather than by SHRED_PARANOID_BYTES.
  * */
 
 /*
@@ -284,6 +296,10 @@
  * rate = 160ms read vs typical seek time 10ms*/
 #define SHRED_PARANOID_BYTES (16 * 1024 * 1024)
 
+/* Window limits for --lockstep-paranoid increments; see rm_shred_paranoid_bytes() */
+#define SHRED_LOCKSTEP_MIN_WINDOW (64 * 1024)
+#define SHRED_LOCKSTEP_MAX_WINDOW (4 * 1024 * 1024)
+
 /* When paranoid hashing, if a file increments is larger
  * than SHRED_PREMATCH_THRESHOLD, we take a guess at the likely
  * matching file and do a progressive memcmp() on each buffer
@@ -298,6 +314,20 @@
 /* Maximum number of bytes before worth_waiting becomes false */
 #define SHRED_TOO_MANY_BYTES_TO_WAIT (64 * 1024 * 1024)
 
+/* Size groups of files up to this many pages (the ones the first increment
+ * reads whole anyway) are hashed in a single pass, see rm_shred_read_small_files() */
+#define SHRED_SMALL_FILE_PAGES (2 * SHRED_BALANCED_PAGES)
+
+/* Reader threads per non-rotational or network device in
+ * rm_shred_read_small_files(); small reads are bound by the latency of
+ * open/read/close, and SSDs and file servers serve many of those in parallel */
+#define SHRED_SMALL_FILE_THREADS (8)
+
+/* Increments ending below this offset are hashed with a fast non-cryptographic
+ * digest; the first strong increment re-reads these bytes, which are usually
+ * still in the page cache */
+#define SHRED_FAST_TIER_BYTES (2 * 1024 * 1024)
+
 ///////////////////////////////////////////////////////////////////////
 //    INTERNAL STRUCTURES, WITH THEIR INITIALISERS AND DESTROYERS    //
 ///////////////////////////////////////////////////////////////////////
@@ -310,6 +340,13 @@ typedef struct RmShredTag {
     gint64 paranoid_mem_alloc; /* how much memory to allocate for paranoid checks */
     gint32 active_groups; /* how many shred groups active (only used with paranoid) */
     RmHasher *hasher;
+    /* digest used to build the groups (cfg->checksum_type) */
+    RmDigestType digest_type;
+    /* digest for the early increments, or RM_DIGEST_UNKNOWN to use digest_type
+     * throughout */
+    RmDigestType fast_digest_type;
+    /* keeps files open between increments; NULL for buffered reads */
+    RmFdCache *fd_cache;
     GThreadPool *result_pool;
     /* threadpool for progress counters to avoid blocking delays in
      * rm_shred_adjust_counters */
@@ -317,6 +354,10 @@ typedef struct RmShredTag {
     gint32 page_size;
     bool mem_refusing;
 
+    /* bytes rm_shred_prefetch_data() may still ask the kernel to read ahead;
+     * protected by lock */
+    gint64 prefetch_budget;
+
     GMutex lock;
 
     gint32 remaining_files;
@@ -375,6 +416,12 @@ typedef struct RmShredGroup {
     /* number of files newer than cfg->min_mtime */
     gsize n_new;
 
+    /* number of pending files on non-rotational devices */
+    gsize n_fast_pending;
+
+    /* files on rotational devices which wait until n_fast_pending is 0 */
+    GQueue *slow_files;
+
     /* set if group has been greenlighted by paranoid mem manager */
     bool is_active : 1;
 
@@ -394,6 +441,9 @@ typedef struct RmShredGroup {
     /* file hash_offset when files arrived in this group */
     RmOff hash_offset;
 
+    /* file hash_offset when hashing of the files started (root group) */
+    RmOff start_offset;
+
     /* file hash_offset for next increment */
     RmOff next_offset;
 
@@ -403,6 +453,9 @@ typedef struct RmShredGroup {
     /* allocated memory for paranoid hashing */
     RmOff mem_allocation;
 
+    /* size of paranoid increments; fixed when the group is greenlighted */
+    RmOff paranoid_bytes;
+
     /* checksum structure taken from first file to enter the group.  This allows
      * digests to be released from RmFiles and memory freed up until they
      * are required again for further hashing.*/
@@ -476,6 +529,7 @@ static RmShredGroup *rm_shred_group_new(RmFile *file) {
     self->held_files = g_queue_new();
     self->file_size = file->file_size;
     self->hash_offset = file->hash_offset;
+    self->start_offset = (self->parent) ? self->parent->start_offset : file->hash_offset;
 
     self->session = file->session;
 
@@ -489,44 +543,95 @@ static RmShredGroup *rm_shred_group_new(RmFile *file) {
 // MANAGEMENT ALGORITHMS        //
 //////////////////////////////////
 
-/* Compute optimal size for next hash increment call this with group locked */
-static gint32 rm_shred_get_read_size(RmFile *file, RmShredTag *tag) {
-    g_assert(file);
-    RmShredGroup *group = file->shred_group;
-    g_assert(group);
+/* what is the maximum number of files that a group may end up with (including
+ * parent, grandparent etc group files that haven't been hashed yet)?
+ */
+static gulong rm_shred_group_potential_file_count(RmShredGroup *group) {
+    if(group) {
+        return group->num_pending + rm_shred_group_potential_file_count(group->parent);
+    } else {
+        return 0;
+    }
+}
 
-    gint32 result = 0;
+/* Maximum increment size for a paranoid digest of group; with --lockstep-paranoid
+ * this is the memory budget shared by all potential members of the group.
+ * Once the group is greenlighted the size is fixed, so that all members read
+ * increments of the same length even if the potential count drops meanwhile.
+ */
+static RmOff rm_shred_paranoid_bytes(RmShredGroup *group) {
+    RmCfg *cfg = group->session->cfg;
+    if(group->paranoid_bytes > 0) {
+        return group->paranoid_bytes;
+    }
 
-    /* calculate next_offset property of the RmShredGroup */
+    if(!cfg->paranoid_lockstep) {
+        return SHRED_PARANOID_BYTES;
+    }
+
+    RmShredTag *tag = group->session->shredder;
+    RmOff budget = cfg->total_mem / 2 / MAX(cfg->threads, 1);
+    RmOff window = budget / MAX(rm_shred_group_potential_file_count(group), 1);
+    window = CLAMP(window, SHRED_LOCKSTEP_MIN_WINDOW, SHRED_LOCKSTEP_MAX_WINDOW);
+    return window - window % tag->page_size;
+}
+
+/* Offset the next increment of group should be read up to; has no side
+ * effects, so it may be used just to look ahead. If whole_file is not NULL it
+ * is set when it's cheaper to read the rest of the file in one go. */
+static RmOff rm_shred_next_offset(RmShredGroup *group, RmShredTag *tag,
+                                  bool *whole_file) {
+    g_assert(group);
     g_assert(tag);
+
+    RmOff next_offset = 0;
     RmOff balanced_bytes = tag->page_size * SHRED_BALANCED_PAGES;
     RmOff target_bytes = balanced_bytes * group->offset_factor;
-    if(group->next_offset == 2) {
-        file->fadvise_requested = 1;
-    }
 
     /* round to even number of pages, round up to MIN_READ_PAGES */
     RmOff target_pages = MAX(target_bytes / tag->page_size, 1);
     target_bytes = target_pages * tag->page_size;
 
     /* test if cost-effective to read the whole file */
-    if(group->hash_offset + target_bytes + (balanced_bytes) >= group->file_size) {
-        group->next_offset = group->file_size;
-        file->fadvise_requested = 1;
+    bool read_all = (group->hash_offset + target_bytes + (balanced_bytes) >=
+                     group->file_size);
+    if(read_all) {
+        next_offset = group->file_size;
     } else {
-        group->next_offset = group->hash_offset + target_bytes;
+        next_offset = group->hash_offset + target_bytes;
     }
 
     /* for paranoid digests, make sure next read is not > max size of paranoid buffer */
     if(group->digest_type == RM_DIGEST_PARANOID) {
-        group->next_offset =
-            MIN(group->next_offset, group->hash_offset + SHRED_PARANOID_BYTES);
+        next_offset =
+            MIN(next_offset, group->hash_offset + rm_shred_paranoid_bytes(group));
     }
 
-    file->status = RM_FILE_STATE_NORMAL;
-    result = (group->next_offset - file->hash_offset);
+    if(whole_file) {
+        *whole_file = read_all;
+    }
+    return next_offset;
+}
 
-    return result;
+/* Compute optimal size for next hash increment call this with group locked */
+static gint32 rm_shred_get_read_size(RmFile *file, RmShredTag *tag) {
+    g_assert(file);
+    RmShredGroup *group = file->shred_group;
+    g_assert(group);
+
+    if(group->next_offset == 2) {
+        file->fadvise_requested = 1;
+    }
+
+    /* calculate next_offset property of the RmShredGroup */
+    bool whole_file = false;
+    group->next_offset = rm_shred_next_offset(group, tag, &whole_file);
+    if(whole_file) {
+        file->fadvise_requested = 1;
+    }
+
+    file->status = RM_FILE_STATE_NORMAL;
+    return (group->next_offset - file->hash_offset);
 }
 
 /* Memory manager (only used for RM_DIGEST_PARANOID at the moment
@@ -561,17 +666,6 @@ static void rm_shred_mem_return(RmShredGroup *group) {
     }
 }
 
-/* what is the maximum number of files that a group may end up with (including
- * parent, grandparent etc group files that haven't been hashed yet)?
- */
-static gulong rm_shred_group_potential_file_count(RmShredGroup *group) {
-    if(group) {
-        return group->num_pending + rm_shred_group_potential_file_count(group->parent);
-    } else {
-        return 0;
-    }
-}
-
 /* Governor to limit memory usage by limiting how many RmShredGroups can be
  * active at any one time
  * NOTE: group_lock must be held before calling rm_shred_check_paranoid_mem_alloc
@@ -583,9 +677,9 @@ static bool rm_shred_check_paranoid_mem_alloc(RmShredGroup *group,
         return true;
     }
 
-    gint64 mem_required =
-        (rm_shred_group_potential_file_count(group) / 2 + 1) *
-        MIN(group->file_size - group->hash_offset, SHRED_PARANOID_BYTES);
+    RmOff paranoid_bytes = rm_shred_paranoid_bytes(group);
+    gint64 mem_required = (rm_shred_group_potential_file_count(group) / 2 + 1) *
+                          MIN(group->file_size - group->hash_offset, paranoid_bytes);
 
     bool result = FALSE;
     RmShredTag *tag = group->session->shredder;
@@ -625,6 +719,7 @@ static bool rm_shred_check_paranoid_mem_alloc(RmShredGroup *group,
 
             tag->active_groups++;
             group->is_active = TRUE;
+            group->paranoid_bytes = paranoid_bytes;
             group->status = RM_SHRED_GROUP_HASHING;
             result = TRUE;
         } else {
@@ -695,10 +790,17 @@ static void rm_shred_write_group_to_xattr(const RmSession *session, GQueue *grou
         return;
     }
 
+    RmFdCache *fd_cache = session->shredder->fd_cache;
+
     for(GList *iter = group->head; iter; iter = iter->next) {
         RmFile *file = iter->data;
         if(file->ext_cksum == NULL && file->digest != NULL) {
-            rm_xattr_write_hash(file, (RmSession *)session);
+            /* use the descriptor of the last increment if it's still open */
+            int fd = (fd_cache) ? rm_fd_cache_get(fd_cache, file, NULL) : -1;
+            rm_xattr_write_hash(file, (RmSession *)session, fd);
+            if(fd != -1) {
+                rm_fd_cache_release(fd_cache, file);
+            }
         }
     }
 }
@@ -709,6 +811,10 @@ static void rm_shred_discard_file(RmFile *file, bool free_file) {
     const RmSession *session = file->session;
     RmShredTag *tag = session->shredder;
 
+    if(tag->fd_cache) {
+        rm_fd_cache_drop(tag->fd_cache, file);
+    }
+
     /* update device counters (unless this file was a bundled hardlink) */
     if(file->disk) {
         rm_mds_device_ref(file->disk, -1);
@@ -722,15 +828,40 @@ static void rm_shred_discard_file(RmFile *file, bool free_file) {
     }
 }
 
+/* Move file->disk_offset to (approximately) the physical offset of the
+ * increment starting at next_offset, so that the scheduler orders the
+ * increments of fragmented files by where they are on disk.
+ * FIEMAP is only asked again once the current fragment is exhausted.
+ */
+static void rm_shred_update_disk_offset(RmFile *file, int fd, RmOff next_offset) {
+    if(!file->has_disk_offset || next_offset >= file->file_size) {
+        return;
+    }
+
+    if(next_offset < file->fragment_end) {
+        /* still within the same contiguous fragment */
+        file->disk_offset += next_offset - file->hash_offset;
+        return;
+    }
+
+    file->disk_offset = rm_offset_get_from_fd(fd, next_offset, &file->fragment_end, NULL);
+    if(file->fragment_end <= next_offset) {
+        /* no extent data; don't ask again for every increment */
+        file->fragment_end = file->file_size;
+    }
+}
+
 /* Push file to scheduler queue.
  * */
 static void rm_shred_push_queue(RmFile *file) {
-    if(file->hash_offset == 0) {
-        /* first-timer; lookup disk offset */
+    if(file->hash_offset == 0 && !file->has_disk_offset) {
+        /* first-timer not seen by rm_shred_prefetch_offsets(); lookup disk offset */
         if(file->session->cfg->build_fiemap &&
            !rm_mounts_is_nonrotational(file->session->mounts, file->dev)) {
             RM_DEFINE_PATH(file);
-            file->disk_offset = rm_offset_get_from_path(file_path, 0, NULL);
+            file->disk_offset =
+                rm_offset_get_from_path(file_path, 0, &file->fragment_end);
+            file->has_disk_offset = true;
         } else {
             /* use inode number instead of disk offset */
             file->disk_offset = file->inode;
@@ -763,6 +894,12 @@ static void rm_shred_group_free(RmShredGroup *self, bool force_free) {
     }
 
     if(self->held_files) {
+        if(cfg->merge_directories && self->status != RM_SHRED_GROUP_FINISHED) {
+            /* these were not fed; their directories can't be complete */
+            for(GList *iter = self->held_files->head; iter; iter = iter->next) {
+                rm_tm_reject(self->session->dir_merger, iter->data);
+            }
+        }
         g_queue_foreach(self->held_files, (GFunc)rm_shred_discard_file,
                         GUINT_TO_POINTER(needs_free));
         g_queue_free(self->held_files);
@@ -781,6 +918,7 @@ static void rm_shred_group_free(RmShredGroup *self, bool force_free) {
     }
 
     g_assert(!self->in_progress_digests);
+    g_assert(!self->slow_files);
 
     g_mutex_clear(&self->lock);
 
@@ -867,11 +1005,92 @@ static void rm_shred_group_make_orphan(RmShredGroup *self) {
     }
 }
 
+static bool rm_shred_file_is_slow(RmFile *file) {
+    return file->disk && rm_mds_device_is_rotational(file->disk);
+}
+
+/* If a group spans fast and slow (rotational) devices, the slow members are only
+ * read once the fast members are through the current increment.  This way the
+ * slow disk does not hold back splitting the group and spends its time on files
+ * that are still candidates.  Returns true if file was deferred.
+ * Call with group->lock held; file must be counted in group->num_pending.
+ */
+static bool rm_shred_group_defer_slow(RmShredGroup *group, RmFile *file) {
+    if(!rm_shred_file_is_slow(file)) {
+        group->n_fast_pending++;
+        return false;
+    }
+
+    if(group->n_fast_pending == 0) {
+        return false;
+    }
+
+    if(!group->slow_files) {
+        group->slow_files = g_queue_new();
+    }
+    g_queue_push_tail(group->slow_files, file);
+    return true;
+}
+
+/* Push all held files of a group that just went active.
+ * Call with group->lock held. */
+static void rm_shred_group_release_held(RmShredGroup *group) {
+    group->num_pending += g_queue_get_length(group->held_files);
+
+    /* fast members first, so that the slow ones can wait for them */
+    for(GList *iter = group->held_files->head; iter; iter = iter->next) {
+        if(!rm_shred_file_is_slow(iter->data)) {
+            rm_shred_group_defer_slow(group, iter->data);
+            rm_shred_push_queue(iter->data);
+        }
+    }
+    for(GList *iter = group->held_files->head; iter; iter = iter->next) {
+        if(rm_shred_file_is_slow(iter->data) &&
+           !rm_shred_group_defer_slow(group, iter->data)) {
+            rm_shred_push_queue(iter->data);
+        }
+    }
+
+    g_queue_free(group->held_files);
+    group->held_files = NULL; /* won't need shred_group queue any more,
+                                 since new arrivals will bypass */
+}
+
+/* Update the counters that rm_shred_group_qualifies() looks at for a new file.
+ * Call with shred_group->lock held (if the group is shared).
+ */
+static void rm_shred_group_count_file(RmShredGroup *shred_group, RmFile *file) {
+    if(shred_group->session->cfg->unmatched_basenames) {
+        /* do some fancy footwork for cfg->unmatched_basenames criterion */
+        if(shred_group->num_files == 0) {
+            shred_group->unique_basename = file;
+        } else if(shred_group->unique_basename &&
+                  rm_file_basenames_cmp(file, shred_group->unique_basename) != 0) {
+            shred_group->unique_basename = NULL;
+        }
+        if(file->cluster) {
+            for(GList *iter = file->cluster->head; iter; iter = iter->next) {
+                if(rm_file_basenames_cmp(iter->data, shred_group->unique_basename) != 0) {
+                    shred_group->unique_basename = NULL;
+                    break;
+                }
+            }
+        }
+    }
+
+    /* update group counters */
+    shred_group->num_files += rm_file_n_files(file);
+    shred_group->n_pref += rm_file_n_prefd(file);
+    shred_group->n_npref += rm_file_n_nprefd(file);
+    shred_group->n_new += rm_file_n_new(file);
+    shred_group->n_clusters++;
+    shred_group->n_inodes += RM_FILE_INODE_COUNT(file);
+}
+
 /* Call with shred_group->lock unlocked. */
 static RmFile *rm_shred_group_push_file(RmShredGroup *shred_group, RmFile *file,
                                         gboolean initial) {
     RmFile *result = NULL;
-    RmCfg *cfg = shred_group->session->cfg;
 
     file->shred_group = shred_group;
 
@@ -882,32 +1101,7 @@ static RmFile *rm_shred_group_push_file(RmShredGroup *shred_group, RmFile *file,
 
     g_mutex_lock(&shred_group->lock);
     {
-        if(cfg->unmatched_basenames) {
-            /* do some fancy footwork for cfg->unmatched_basenames criterion */
-            if(shred_group->num_files == 0) {
-                shred_group->unique_basename = file;
-            } else if(shred_group->unique_basename &&
-                      rm_file_basenames_cmp(file, shred_group->unique_basename) != 0) {
-                shred_group->unique_basename = NULL;
-            }
-            if(file->cluster) {
-                for(GList *iter = file->cluster->head; iter; iter = iter->next) {
-                    if(rm_file_basenames_cmp(iter->data, shred_group->unique_basename) !=
-                       0) {
-                        shred_group->unique_basename = NULL;
-                        break;
-                    }
-                }
-            }
-        }
-
-        /* update group counters */
-        shred_group->num_files += rm_file_n_files(file);
-        shred_group->n_pref += rm_file_n_prefd(file);
-        shred_group->n_npref += rm_file_n_nprefd(file);
-        shred_group->n_new += rm_file_n_new(file);
-        shred_group->n_clusters++;
-        shred_group->n_inodes += RM_FILE_INODE_COUNT(file);
+        rm_shred_group_count_file(shred_group, file);
 
         g_assert(file->hash_offset == shred_group->hash_offset);
 
@@ -916,11 +1110,7 @@ static RmFile *rm_shred_group_push_file(RmShredGroup *shred_group, RmFile *file,
         case RM_SHRED_GROUP_START_HASHING:
             /* clear the queue and push all its rmfiles to the md-scheduler */
             if(shred_group->held_files) {
-                shred_group->num_pending += g_queue_get_length(shred_group->held_files);
-                g_queue_free_full(shred_group->held_files,
-                                  (GDestroyNotify)rm_shred_push_queue);
-                shred_group->held_files = NULL; /* won't need shred_group queue any more,
-                                                   since new arrivals will bypass */
+                rm_shred_group_release_held(shred_group);
             }
             if(shred_group->digest_type == RM_DIGEST_PARANOID && !initial) {
                 rm_shred_check_paranoid_mem_alloc(shred_group, 1);
@@ -928,7 +1118,9 @@ static RmFile *rm_shred_group_push_file(RmShredGroup *shred_group, RmFile *file,
         /* FALLTHROUGH */
         case RM_SHRED_GROUP_HASHING:
             shred_group->num_pending++;
-            if(!file->shredder_waiting) {
+            if(rm_shred_group_defer_slow(shred_group, file)) {
+                /* pushed once the fast members are done */
+            } else if(!file->shredder_waiting) {
                 /* add file to device queue */
                 rm_shred_push_queue(file);
             } else {
@@ -937,6 +1129,11 @@ static RmFile *rm_shred_group_push_file(RmShredGroup *shred_group, RmFile *file,
             }
             break;
         case RM_SHRED_GROUP_DORMANT:
+            /* file might never be read again; don't keep it open */
+            if(shred_group->session->shredder->fd_cache) {
+                rm_fd_cache_drop(shred_group->session->shredder->fd_cache, file);
+            }
+        /* FALLTHROUGH */
         case RM_SHRED_GROUP_FINISHING:
             /* add file to held_files */
             g_queue_push_head(shred_group->held_files, file);
@@ -969,6 +1166,14 @@ static RmFile *rm_shred_sift(RmFile *file) {
     g_mutex_lock(&current_group->lock);
     {
         current_group->num_pending--;
+        if(!rm_shred_file_is_slow(file) && current_group->n_fast_pending > 0 &&
+           --current_group->n_fast_pending == 0 && current_group->slow_files) {
+            /* fast members are through this increment; now read the slow ones */
+            g_queue_free_full(current_group->slow_files,
+                              (GDestroyNotify)rm_shred_push_queue);
+            current_group->slow_files = NULL;
+        }
+
         if(current_group->in_progress_digests) {
             /* remove this file from current_group's pending digests list */
             current_group->in_progress_digests =
@@ -980,6 +1185,9 @@ static RmFile *rm_shred_sift(RmFile *file) {
             if(file->digest) {
                 rm_digest_free(file->digest);
             }
+            if(current_group->session->cfg->merge_directories) {
+                rm_tm_reject(current_group->session->dir_merger, file);
+            }
             rm_shred_discard_file(file, true);
 
         } else {
@@ -1063,39 +1271,56 @@ static void rm_shred_hash_callback(
  *    files via rm_shred_device_preprocess.
  * */
 
+/* Make the shredder account for a new dupe candidate: device reference,
+ * progress counters and the treemerge/chunker hooks.
+ * */
+static void rm_shred_file_register(RmFile *file) {
+    RmSession *session = (RmSession *)file->session;
+    RmShredTag *shredder = session->shredder;
+    RmCfg *cfg = session->cfg;
+
+    RM_DEFINE_PATH(file);
+
+    /* add reference for this file to the MDS scheduler, and get pointer to its device */
+    file->disk = rm_mds_device_get(session->mds, file_path, (cfg->fake_pathindex_as_disk)
+                                                                ? file->path_index + 1
+                                                                : file->dev);
+    rm_mds_device_ref(file->disk, 1);
+
+    rm_shred_adjust_counters(shredder, 1, (gint64)file->file_size - file->hash_offset);
+
+    if(cfg->merge_directories) {
+        /* lets the tree merger see which directories can't be complete anymore */
+        rm_tm_add_candidate(session->dir_merger, file);
+    }
+
+    if(cfg->chunk_savings) {
+        rm_chunk_add_file(session->chunker, file);
+    }
+}
+
 /* Called for each file; find appropriate RmShredGroup (ie files with same size) and
  * push the file to it.
  * */
 static void rm_shred_file_preprocess(RmFile *file, RmShredGroup **group) {
     /* initial population of RmShredDevice's and first level RmShredGroup's */
-    RmSession *session = (RmSession *)file->session;
-    RmShredTag *shredder = session->shredder;
-    RmCfg *cfg = session->cfg;
+    RmShredTag *shredder = file->session->shredder;
 
     g_assert(file);
     g_assert(file->lint_type == RM_LINT_TYPE_DUPE_CANDIDATE);
 
     /* Create an empty checksum for empty files */
     if(file->file_size == 0) {
-        file->digest = rm_digest_new(cfg->checksum_type, 0);
+        file->digest = rm_digest_new(shredder->digest_type, 0);
     }
 
     if(!(*group)) {
         /* create RmShredGroup using first file in size group as template*/
         *group = rm_shred_group_new(file);
-        (*group)->digest_type = cfg->checksum_type;
+        (*group)->digest_type = shredder->digest_type;
     }
 
-    RM_DEFINE_PATH(file);
-
-    /* add reference for this file to the MDS scheduler, and get pointer to its device */
-    file->disk = rm_mds_device_get(session->mds, file_path, (cfg->fake_pathindex_as_disk)
-                                                                ? file->path_index + 1
-                                                                : file->dev);
-    rm_mds_device_ref(file->disk, 1);
-
-    rm_shred_adjust_counters(shredder, 1, (gint64)file->file_size - file->hash_offset);
-
+    rm_shred_file_register(file);
     rm_shred_group_push_file(*group, file, true);
 }
 
@@ -1136,10 +1361,90 @@ static gint rm_shred_cmp_ext_cksum(RmFile *a, RmFile *b) {
     return strcmp(a->ext_cksum, b->ext_cksum);
 }
 
-static void rm_shred_process_group(GSList *files, _UNUSED RmShredTag *main) {
+/* Does the size group qualify for rm_shred_read_small_files()?  Only if all
+ * of its files would be read whole by the first increment anyway, and only if
+ * the size group as a whole could qualify (see rm_shred_group_qualifies());
+ * otherwise none of its subgroups could, and the normal path won't read it. */
+static bool rm_shred_group_is_small(GSList *files, RmShredTag *tag) {
+    if(files == NULL || files->next == NULL || tag->digest_type == RM_DIGEST_PARANOID) {
+        /* unique size, or paranoid digests need the memory manager */
+        return false;
+    }
+
+    RmFile *head = files->data;
+    if(head->file_size == 0 ||
+       head->file_size > (RmOff)tag->page_size * SHRED_SMALL_FILE_PAGES) {
+        return false;
+    }
+
+    for(GSList *iter = files; iter; iter = iter->next) {
+        RmFile *file = iter->data;
+        if(file->hash_offset != 0 || file->ext_cksum || file->is_symlink) {
+            /* clamped, clustered by external checksum or not read via pread() */
+            return false;
+        }
+    }
+
+    RmShredGroup counts = {.session = tag->session};
+    for(GSList *iter = files; iter; iter = iter->next) {
+        rm_shred_group_count_file(&counts, iter->data);
+    }
+    return rm_shred_group_qualifies(&counts);
+}
+
+/* Sort the files of a small size group into RmShredGroups by the whole-file
+ * digest rm_shred_read_small_func() left in file->digest.  The groups are
+ * complete right away and go straight to the results; the table belongs to
+ * this size group alone, so it needs no locking.
+ */
+static void rm_shred_process_small_group(GSList *files, RmShredTag *tag) {
+    RmCfg *cfg = tag->session->cfg;
+    GHashTable *groups =
+        g_hash_table_new((GHashFunc)rm_digest_hash, (GEqualFunc)rm_digest_equal);
+
+    RmFile *file = NULL;
+    while((file = rm_util_slist_pop(&files, NULL))) {
+        if(!file->digest) {
+            /* reading failed or was aborted */
+            rm_shred_file_register(file);
+            if(cfg->merge_directories) {
+                rm_tm_reject(tag->session->dir_merger, file);
+            }
+            rm_shred_discard_file(file, true);
+            continue;
+        }
+
+        file->hash_offset = file->file_size;
+
+        RmShredGroup *group = g_hash_table_lookup(groups, file->digest);
+        bool is_new = (group == NULL);
+        rm_shred_file_preprocess(file, &group);
+        if(is_new) {
+            /* the new group took over file->digest */
+            g_hash_table_insert(groups, group->digest, group);
+        }
+    }
+
+    GHashTableIter iter;
+    RmShredGroup *group = NULL;
+    g_hash_table_iter_init(&iter, groups);
+    while(g_hash_table_iter_next(&iter, NULL, (gpointer *)&group)) {
+        if(rm_shred_group_qualifies(group)) {
+            /* as if its last increment had just been hashed */
+            group->status = RM_SHRED_GROUP_FINISHING;
+        }
+        rm_shred_group_finalise(group);
+    }
+    g_hash_table_unref(groups);
+}
+
+static void rm_shred_process_group(GSList *files, RmShredTag *main) {
     g_assert(files);
     g_assert(files->data);
 
+    /* was the group hashed by rm_shred_read_small_files() already? */
+    bool is_small = rm_shred_group_is_small(files, main);
+
     /* cluster hardlinks and ext_cksum matches;
      * Initially I over-complicated this until I realised that hardlinks
      * share common extended attributes.  So there is no need to
@@ -1172,6 +1477,11 @@ static void rm_shred_process_group(GSList *files, _UNUSED RmShredTag *main) {
         }
     }
 
+    if(is_small) {
+        rm_shred_process_small_group(files, main);
+        return;
+    }
+
     /* push files to shred group */
     RmShredGroup *group = NULL;
     RmFile *file = NULL;
@@ -1190,10 +1500,294 @@ static void rm_shred_process_group(GSList *files, _UNUSED RmShredTag *main) {
     }
 }
 
+/* RmMDSFunc; called from the prefetch device worker threads */
+static gint rm_shred_prefetch_offset_func(RmFile *file, _UNUSED RmSession *session) {
+    RM_DEFINE_PATH(file);
+    file->disk_offset = rm_offset_get_from_path(file_path, 0, &file->fragment_end);
+    file->has_disk_offset = true;
+    return 1;
+}
+
+/* Look up the physical offsets of all dupe candidates on rotational disks
+ * before they are pushed to the scheduler.  Every disk gets its own workers,
+ * which query the files in inode order, instead of one open/FIEMAP/close
+ * per file on the preprocessing thread.
+ */
+static void rm_shred_prefetch_offsets(RmSession *session) {
+    RmCfg *cfg = session->cfg;
+    if(!cfg->build_fiemap) {
+        return;
+    }
+
+    RmMDS *mds = rm_mds_new(cfg->threads, session->mounts, cfg->fake_pathindex_as_disk);
+    rm_mds_configure(mds, (RmMDSFunc)rm_shred_prefetch_offset_func, session, 0,
+                     cfg->threads_per_disk, (RmMDSSortFunc)rm_mds_elevator_cmp);
+
+    guint n_files = 0;
+    for(GSList *group = session->tables->size_groups; group; group = group->next) {
+        GSList *files = group->data;
+        if(files == NULL || files->next == NULL ||
+           rm_shred_group_is_small(files, session->shredder)) {
+            /* unique size (will not be read) or read whole in one pass, where
+             * inode order is good enough */
+            continue;
+        }
+
+        for(GSList *iter = files; iter; iter = iter->next) {
+            RmFile *file = iter->data;
+            if(file->hash_offset != 0 || file->file_size == 0 || file->ext_cksum ||
+               rm_mounts_is_nonrotational(session->mounts, file->dev)) {
+                /* won't be read or no benefit from ordering */
+                continue;
+            }
+
+            RM_DEFINE_PATH(file);
+            RmMDSDevice *disk =
+                rm_mds_device_get(mds, file_path, (cfg->fake_pathindex_as_disk)
+                                                      ? file->path_index + 1
+                                                      : file->dev);
+            rm_mds_push_task(disk, file->dev, file->inode, NULL, file);
+            n_files++;
+        }
+    }
+
+    /* Start the workers and wait for all of them to finish; no device refs are
+     * needed since the unlimited pass quota drains each queue in one pass. */
+    rm_mds_start(mds);
+    rm_mds_free(mds, FALSE);
+
+    rm_log_debug_line("looked up disk offsets of %u files at time %.3f", n_files,
+                      g_timer_elapsed(session->timer, NULL));
+}
+
+/* RmMDSFunc; called from the prefetch device worker threads */
+static gint rm_shred_prefetch_data_func(RmFile *file, RmShredTag *tag) {
+#if HAVE_POSIX_FADVISE && defined(POSIX_FADV_WILLNEED)
+    /* same size as the first increment of rm_shred_get_read_size() */
+    RmOff balanced_bytes = tag->page_size * SHRED_BALANCED_PAGES;
+    RmOff len = file->file_size - file->hash_offset;
+    if(len >= 2 * balanced_bytes) {
+        len = balanced_bytes;
+    }
+
+    bool in_budget = false;
+    g_mutex_lock(&tag->lock);
+    {
+        in_budget = (tag->prefetch_budget >= (gint64)len);
+        if(in_budget) {
+            tag->prefetch_budget -= len;
+        }
+    }
+    g_mutex_unlock(&tag->lock);
+
+    if(!in_budget) {
+        return 1;
+    }
+
+    /* Open through the fd cache if possible; the shredder can use it then */
+    int fd = -1;
+    if(tag->fd_cache) {
+        fd = rm_fd_cache_get_at(tag->fd_cache, file, file->folder);
+    }
+
+    if(fd != -1) {
+        posix_fadvise(fd, file->hash_offset, len, POSIX_FADV_WILLNEED);
+        rm_fd_cache_release(tag->fd_cache, file);
+    } else {
+        RM_DEFINE_PATH(file);
+        fd = rm_sys_open(file_path, O_RDONLY);
+        if(fd != -1) {
+            posix_fadvise(fd, file->hash_offset, len, POSIX_FADV_WILLNEED);
+            rm_sys_close(fd);
+        }
+    }
+#else
+    (void)file;
+    (void)tag;
+#endif
+    return 1;
+}
+
+/* Ask the kernel to read the first increment of all dupe candidates on
+ * rotational disks, ordered by their physical offset.
+ * Otherwise the first generation is read one small increment at a time, each
+ * after the previous one was hashed; here the readahead requests are queued
+ * back to back, so the disk can serve them in a few sequential sweeps and the
+ * shredder mostly finds the data in the page cache.
+ * The total is limited to half of --limit-mem; more would likely be evicted
+ * again before the shredder gets to it.
+ */
+static void rm_shred_prefetch_data(RmShredTag *tag) {
+    RmSession *session = tag->session;
+    RmCfg *cfg = session->cfg;
+    if(!cfg->build_fiemap) {
+        /* no offsets to sort by */
+        return;
+    }
+
+    tag->prefetch_budget = cfg->total_mem / 2;
+
+    RmMDS *mds = rm_mds_new(cfg->threads, session->mounts, cfg->fake_pathindex_as_disk);
+    rm_mds_configure(mds, (RmMDSFunc)rm_shred_prefetch_data_func, tag, 0, 1,
+                     (RmMDSSortFunc)rm_mds_elevator_cmp);
+
+    guint n_files = 0;
+    for(GSList *group = session->tables->size_groups; group; group = group->next) {
+        GSList *files = group->data;
+        if(files == NULL || files->next == NULL || rm_shred_group_is_small(files, tag)) {
+            /* unique size, will not be read, or read by rm_shred_read_small_files() */
+            continue;
+        }
+
+        for(GSList *iter = files; iter; iter = iter->next) {
+            RmFile *file = iter->data;
+            if(!file->has_disk_offset || file->hash_offset >= file->file_size ||
+               file->ext_cksum) {
+                /* not on a rotational disk or won't be read */
+                continue;
+            }
+
+            RM_DEFINE_PATH(file);
+            RmMDSDevice *disk =
+                rm_mds_device_get(mds, file_path, (cfg->fake_pathindex_as_disk)
+                                                      ? file->path_index + 1
+                                                      : file->dev);
+            rm_mds_push_task(disk, file->dev, file->disk_offset, NULL, file);
+            n_files++;
+        }
+    }
+
+    rm_mds_start(mds);
+    rm_mds_free(mds, FALSE);
+
+    rm_log_debug_line("requested readahead for %u files at time %.3f", n_files,
+                      g_timer_elapsed(session->timer, NULL));
+}
+
+/* RmMDSFunc; reads a whole small file with one pread(2) and digests it right
+ * on this device worker thread.  Leaves file->digest NULL on failure. */
+static gint rm_shred_read_small_func(RmFile *file, RmShredTag *tag) {
+    if(rm_session_was_aborted()) {
+        return 1;
+    }
+
+    /* open relative to the (cached) directory if possible */
+    int fd = -1;
+    if(tag->fd_cache) {
+        fd = rm_fd_cache_get_at(tag->fd_cache, file, file->folder);
+    }
+
+    bool cached = (fd != -1);
+    RM_DEFINE_PATH_IF_NEEDED(file, !cached);
+    if(!cached) {
+        fd = rm_sys_open(file_path, O_RDONLY);
+        if(fd == -1) {
+            rm_log_info("open(2) failed for %s: %s\n", file_path, g_strerror(errno));
+            return 1;
+        }
+    }
+
+    RmOff bytes_to_read = file->file_size;
+    RmOff bytes_read = 0;
+    unsigned char *data = g_malloc(bytes_to_read);
+
+    while(bytes_read < bytes_to_read) {
+        /* normally done after the first call */
+        struct iovec readvec = {data + bytes_read, bytes_to_read - bytes_read};
+        gint64 result = rm_sys_preadv(fd, &readvec, 1, bytes_read);
+        if(result == -1) {
+            rm_log_perror("preadv failed");
+            break;
+        } else if(result == 0) {
+            if(cached) {
+                rm_file_build_path(file, file_path);
+            }
+            rm_log_warning_line(_("Something went wrong reading %s; expected %li bytes, "
+                                  "got %li; ignoring"),
+                                file_path, (long int)bytes_to_read, (long int)bytes_read);
+            break;
+        }
+        bytes_read += result;
+    }
+
+    if(cached) {
+        /* won't be read again */
+        rm_fd_cache_release(tag->fd_cache, file);
+        rm_fd_cache_drop(tag->fd_cache, file);
+    } else {
+        rm_sys_close(fd);
+    }
+
+    if(bytes_read == bytes_to_read) {
+        file->digest = rm_digest_new(tag->digest_type, tag->session->hash_seed);
+        rm_digest_update(file->digest, data, bytes_read);
+    }
+    g_free(data);
+
+    g_mutex_lock(&tag->lock);
+    {
+        tag->session->shred_bytes_read += bytes_read;
+    }
+    g_mutex_unlock(&tag->lock);
+
+    return 1;
+}
+
+/* Hash all files of small size groups (see rm_shred_group_is_small()) before
+ * the shredder starts.  For those the first increment would be the whole file;
+ * reading and digesting it in one go on the device workers saves the hasher
+ * pipe handoff, the signals and the RmShredGroup generations, which cost more
+ * than the read itself when there are millions of tiny files.
+ * Non-rotational devices and network filesystems get SHRED_SMALL_FILE_THREADS
+ * workers, so that their opens and reads overlap instead of waiting for each
+ * other.
+ * rm_shred_process_small_group() then sorts the files by their digest.
+ */
+static void rm_shred_read_small_files(RmShredTag *tag) {
+    RmSession *session = tag->session;
+    RmCfg *cfg = session->cfg;
+
+    RmMDS *mds = rm_mds_new(cfg->threads, session->mounts, cfg->fake_pathindex_as_disk);
+    rm_mds_configure(mds, (RmMDSFunc)rm_shred_read_small_func, tag, 0,
+                     cfg->threads_per_disk, (RmMDSSortFunc)rm_mds_elevator_cmp);
+    rm_mds_configure_fast_disks(mds,
+                                MAX(SHRED_SMALL_FILE_THREADS, (gint)cfg->threads_per_disk));
+
+    guint n_files = 0;
+    for(GSList *group = session->tables->size_groups; group; group = group->next) {
+        if(!rm_shred_group_is_small(group->data, tag)) {
+            continue;
+        }
+
+        for(GSList *iter = group->data; iter; iter = iter->next) {
+            RmFile *file = iter->data;
+            RM_DEFINE_PATH(file);
+            RmMDSDevice *disk =
+                rm_mds_device_get(mds, file_path, (cfg->fake_pathindex_as_disk)
+                                                      ? file->path_index + 1
+                                                      : file->dev);
+            rm_mds_push_task(disk, file->dev,
+                             (file->has_disk_offset) ? file->disk_offset : file->inode,
+                             NULL, file);
+            n_files++;
+        }
+    }
+
+    rm_mds_start(mds);
+    rm_mds_free(mds, FALSE);
+
+    rm_log_debug_line("hashed %u small files in one pass at time %.3f", n_files,
+                      g_timer_elapsed(session->timer, NULL));
+}
+
 static void rm_shred_preprocess_input(RmShredTag *main) {
     RmSession *session = main->session;
     guint removed = 0;
 
+    rm_shred_prefetch_offsets(session);
+    rm_shred_read_small_files(main);
+    rm_shred_prefetch_data(main);
+
     /* move files from node tables into initial RmShredGroups */
     rm_log_debug_line("preparing size groups for shredding (dupe finding)...");
     RmFileTables *tables = session->tables;
@@ -1497,6 +2091,13 @@ static void rm_shred_group_postprocess(RmShredGroup *group, RmShredTag *tag) {
 
     rm_shred_write_group_to_xattr(tag->session, group->held_files);
 
+    if(tag->fd_cache) {
+        /* the files leave the shredder; they may be freed from now on */
+        for(GList *iter = group->held_files->head; iter; iter = iter->next) {
+            rm_fd_cache_drop(tag->fd_cache, iter->data);
+        }
+    }
+
     if(group->status == RM_SHRED_GROUP_FINISHING) {
         group->status = RM_SHRED_GROUP_FINISHED;
     }
@@ -1551,29 +2152,77 @@ static void rm_shred_result_factory(RmShredGroup *group, RmShredTag *tag) {
     }
 
     rm_shred_group_postprocess(group, tag);
+
+    if(tag->session->cfg->merge_directories && tag->after_preprocess) {
+        /* output directories that are final now; this also frees their files.
+         * (not before all candidates were registered by rm_shred_file_preprocess) */
+        rm_tm_emit(tag->session->dir_merger);
+    }
 }
 
 /////////////////////////////////
 //    ACTUAL IMPLEMENTATION    //
 /////////////////////////////////
 
+/* Digests that are much slower than xxhash and worth a fast first tier */
+static bool rm_shred_is_strong_digest(RmDigestType type) {
+    switch(type) {
+    case RM_DIGEST_MD5:
+    case RM_DIGEST_SHA1:
+    case RM_DIGEST_SHA256:
+#if HAVE_SHA512
+    case RM_DIGEST_SHA512:
+#endif
+    case RM_DIGEST_SHA3_256:
+    case RM_DIGEST_SHA3_384:
+    case RM_DIGEST_SHA3_512:
+    case RM_DIGEST_BLAKE2S:
+    case RM_DIGEST_BLAKE2B:
+    case RM_DIGEST_BLAKE2SP:
+    case RM_DIGEST_BLAKE2BP:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Check if the next increment of file should use the fast digest; only groups
+ * which did not use the strong digest yet qualify, and the final increment
+ * never does, so that the digest of finished groups is always the strong one.
+ * */
+static bool rm_shred_in_fast_tier(RmShredTag *main, RmFile *file) {
+    RmShredGroup *group = file->shred_group;
+    if(main->fast_digest_type == RM_DIGEST_UNKNOWN) {
+        return false;
+    }
+
+    if(group->digest && group->digest->type != main->fast_digest_type) {
+        return false;
+    }
+
+    RmOff next_offset = 0;
+    g_mutex_lock(&group->lock);
+    { next_offset = rm_shred_next_offset(group, main, NULL); }
+    g_mutex_unlock(&group->lock);
+
+    return next_offset < group->file_size && next_offset <= SHRED_FAST_TIER_BYTES;
+}
+
 static bool rm_shred_reassign_checksum(RmShredTag *main, RmFile *file) {
     RmCfg *cfg = main->session->cfg;
     RmShredGroup *group = file->shred_group;
 
     if(group->digest_type == RM_DIGEST_PARANOID) {
-        /* check if memory allocation is ok */
-        if(!rm_shred_check_paranoid_mem_alloc(group, 0)) {
-            return false;
-        }
-
-        /* get the required target offset into group->next_offset, so that
-         * we can make the paranoid RmDigest the right size*/
+        /* check if memory allocation is ok and get the target offset of the
+         * next increment, so we know whether twin candidates are worth it */
+        RmOff next_offset = 0;
         g_mutex_lock(&group->lock);
         {
-            if(group->next_offset == 0) {
-                (void)rm_shred_get_read_size(file, main);
+            if(!rm_shred_check_paranoid_mem_alloc(group, 0)) {
+                g_mutex_unlock(&group->lock);
+                return false;
             }
+            next_offset = rm_shred_next_offset(group, main, NULL);
             g_assert(group->hash_offset == file->hash_offset);
         }
         g_mutex_unlock(&group->lock);
@@ -1581,7 +2230,7 @@ static bool rm_shred_reassign_checksum(RmShredTag *main, RmFile *file) {
         file->digest = rm_digest_new(RM_DIGEST_PARANOID, 0);
 
         if((file->is_symlink == false || cfg->see_symlinks == false) &&
-           (group->next_offset > file->hash_offset + SHRED_PREMATCH_THRESHOLD)) {
+           (next_offset > file->hash_offset + SHRED_PREMATCH_THRESHOLD)) {
             /* send candidate twin(s) */
             g_mutex_lock(&group->lock);
             {
@@ -1600,13 +2249,19 @@ static bool rm_shred_reassign_checksum(RmShredTag *main, RmFile *file) {
             }
             g_mutex_unlock(&group->lock);
         }
-    } else if(group->digest) {
+    } else if(group->digest && group->digest->type != main->fast_digest_type) {
         /* pick up the digest-so-far from the RmShredGroup */
         file->digest = rm_digest_copy(group->digest);
+    } else if(rm_shred_in_fast_tier(main, file)) {
+        /* small early increment; a fast digest is good enough to split the group */
+        file->digest = (group->digest) ? rm_digest_copy(group->digest)
+                                       : rm_digest_new(main->fast_digest_type,
+                                                       main->session->hash_seed);
     } else {
-        /* this is first generation of RMGroups, so there is no progressive hash yet */
-        file->digest = rm_digest_new(cfg->checksum_type,
-                                     main->session->hash_seed);
+        /* first generation of RMGroups, or switch from the fast digest; in the
+         * latter case the strong digest has to start again at the beginning */
+        file->digest = rm_digest_new(main->digest_type, main->session->hash_seed);
+        file->rehash_from_start = (group->digest != NULL);
     }
     return true;
 }
@@ -1636,31 +2291,86 @@ static gint rm_shred_process_file(RmFile *file, RmSession *session) {
     }
 
     gint result = 0;
-    RM_DEFINE_PATH(file);
+
+    /* With the fd cache files are opened relative to their (cached) directory,
+     * so the full path is only built when that fails or for symlinks. */
+    bool have_path = !tag->fd_cache || file->is_symlink;
+    RM_DEFINE_PATH_IF_NEEDED(file, have_path);
+    if(!have_path) {
+        /* only read when the descriptor can't be opened; see below */
+        file_path[0] = 0;
+    }
 
     while(file && rm_shred_can_process(file, tag)) {
         result = 1;
         /* hash the next increment of the file */
         RmCfg *cfg = session->cfg;
-        RmOff bytes_to_read = rm_shred_get_read_size(file, tag);
+        RmOff bytes_to_read = 0;
+        RmOff next_offset = 0;
+        g_mutex_lock(&file->shred_group->lock);
+        {
+            bytes_to_read = rm_shred_get_read_size(file, tag);
+            next_offset = file->shred_group->next_offset;
+        }
+        g_mutex_unlock(&file->shred_group->lock);
 
         gboolean shredder_waiting =
-            (file->shred_group->next_offset != file->file_size) &&
+            (next_offset != file->file_size) &&
             (cfg->shred_always_wait ||
              (!cfg->shred_never_wait && rm_mds_device_is_rotational(file->disk) &&
               bytes_to_read < SHRED_TOO_MANY_BYTES_TO_WAIT));
 
+        /* re-use the descriptor of the previous increment if possible */
+        int fd = -1;
+        if(tag->fd_cache && !file->is_symlink) {
+            fd = rm_fd_cache_get_at(tag->fd_cache, file, file->folder);
+            if(fd == -1) {
+                /* e.g. directory not accessible; try the full path */
+                if(!have_path) {
+                    rm_file_build_path(file, file_path);
+                    have_path = true;
+                }
+                fd = rm_fd_cache_get(tag->fd_cache, file, file_path);
+            }
+        }
+
+        /* after the switch from the fast digest the strong one needs the
+         * already compared bytes too */
+        RmOff start_offset = file->hash_offset;
+        if(file->rehash_from_start) {
+            start_offset = file->shred_group->start_offset;
+            file->rehash_from_start = false;
+        }
+
         gsize bytes_read = 0;
         RmHasherTask *task = rm_hasher_task_new(tag->hasher, file->digest, file);
-        if(!rm_hasher_task_hash(task, file_path, file->hash_offset, bytes_to_read,
+        if(!rm_hasher_task_hash(task, file_path, fd, start_offset,
+                                file->hash_offset + bytes_to_read - start_offset,
                                 file->is_symlink, &bytes_read)) {
             /* rm_hasher_start_increment failed somewhere */
+            if(!have_path) {
+                rm_file_build_path(file, file_path);
+                have_path = true;
+            }
+            rm_log_info_line(_("Reading %s failed; ignoring it"), file_path);
             file->status = RM_FILE_STATE_IGNORE;
             shredder_waiting = FALSE;
         }
 
+        if(fd != -1) {
+            rm_shred_update_disk_offset(file, fd, file->hash_offset + bytes_to_read);
+
+            /* must be released before the file is sifted */
+            rm_fd_cache_release(tag->fd_cache, file);
+        }
+
+        /* the re-read start of the file was already counted by the fast digest */
+        RmOff bytes_reread = file->hash_offset - start_offset;
+
         /* TODO: make this threadsafe: */
-        session->shred_bytes_read += bytes_read;
+        if(bytes_read > bytes_reread) {
+            session->shred_bytes_read += bytes_read - bytes_reread;
+        }
 
         /* Update totals for file, device and session*/
         file->hash_offset += bytes_to_read;
@@ -1724,12 +2434,27 @@ void rm_shred_run(RmSession *session) {
     tag.active_groups = 0;
     tag.session = session;
     tag.mem_refusing = false;
+    tag.prefetch_budget = 0;
     session->shredder = &tag;
 
     tag.page_size = SHRED_PAGE_SIZE;
 
+    /* buffered reads use fopen(), which can't use a cached descriptor */
+    tag.fd_cache = (cfg->use_buffered_read) ? NULL : rm_fd_cache_new(0);
+
     tag.after_preprocess = FALSE;
 
+    tag.digest_type = cfg->checksum_type;
+
+    /* Two-tier hashing: the small first increments only need to tell different
+     * files apart, so a fast digest does; the strong digest then covers the
+     * whole file.  Not worth it if digest_type is fast itself, and not possible
+     * if unfinished checksums are written (they would be of the wrong type). */
+    tag.fast_digest_type = RM_DIGEST_UNKNOWN;
+    if(rm_shred_is_strong_digest(tag.digest_type) && !cfg->write_unfinished) {
+        tag.fast_digest_type = RM_DIGEST_XXHASH;
+    }
+
     /* would use g_atomic, but helgrind does not like that */
     g_mutex_init(&tag.hash_mem_mtx);
 
@@ -1765,7 +2490,7 @@ void rm_shred_run(RmSession *session) {
     RmOff mem_used = SHRED_AVERAGE_MEM_PER_FILE * session->shred_files_remaining;
     RmOff read_buffer_mem = MAX(1024 * 1024, (gint64)cfg->total_mem - (gint64)mem_used);
 
-    if(cfg->checksum_type == RM_DIGEST_PARANOID) {
+    if(tag.digest_type == RM_DIGEST_PARANOID) {
         /* allocate any spare mem for paranoid hashing */
         tag.paranoid_mem_alloc = (gint64)cfg->total_mem - (gint64)mem_used;
         tag.paranoid_mem_alloc = MAX(0, tag.paranoid_mem_alloc);
@@ -1777,7 +2502,7 @@ void rm_shred_run(RmSession *session) {
 
     /* Initialise hasher */
 
-    tag.hasher = rm_hasher_new(cfg->checksum_type,
+    tag.hasher = rm_hasher_new(tag.digest_type,
                                cfg->threads,
                                cfg->use_buffered_read,
                                cfg->read_buf_len,
@@ -1804,6 +2529,12 @@ void rm_shred_run(RmSession *session) {
     g_thread_pool_free(tag.counter_pool, FALSE, TRUE);
     rm_log_debug(BLUE "Done\n" RESET);
 
+    if(tag.fd_cache) {
+        /* close whatever is left (e.g. files of cached groups) */
+        rm_fd_cache_free(tag.fd_cache);
+        tag.fd_cache = NULL;
+    }
+
     g_mutex_clear(&tag.hash_mem_mtx);
     rm_log_debug_line("Remaining %" LLU " bytes in %" LLU " files",
                       session->shred_bytes_remaining, session->shred_files_remaining);
@@ -130,7 +130,7 @@ static char *rm_traverse_rel_realpath(char *link_path, char *pointing_to) {
 }
 
 static void rm_traverse_file(RmTravSession *trav_session, RmStat *statp, char *path,
-                             bool is_prefd, unsigned long path_index,
+                             RmNode *parent, bool is_prefd, unsigned long path_index,
                              RmLintType file_type, bool is_symlink, bool is_hidden,
                              bool is_on_subvol_fs, short depth) {
     RmSession *session = trav_session->session;
@@ -189,10 +189,11 @@ static void rm_traverse_file(RmTravSession *trav_session, RmStat *statp, char *p
         path = resolved_path;
         is_symlink = false;
         path_needs_free = true;
+        parent = NULL;
     }
 
     RmFile *file =
-        rm_file_new(session, path, statp, file_type, is_prefd, path_index, depth);
+        rm_file_new(session, path, parent, statp, file_type, is_prefd, path_index, depth);
 
     if(path_needs_free) {
         g_free(path);
@@ -231,11 +232,27 @@ static bool rm_traverse_is_hidden(RmCfg *cfg, const char *basename, char *hierar
     }
 }
 
+/* Trie node of the fts directory entry dir; created on first use and cached in
+ * fts_pointer, so that files only need to look up their basename in it */
+static RmNode *rm_traverse_dir_node(RmTrie *trie, FTSENT *dir) {
+    if(dir->fts_level < FTS_ROOTLEVEL) {
+        return NULL;
+    }
+
+    if(dir->fts_pointer == NULL) {
+        RmNode *parent = rm_traverse_dir_node(trie, dir->fts_parent);
+        dir->fts_pointer =
+            rm_trie_get_node(trie, parent, (parent) ? dir->fts_name : dir->fts_path);
+    }
+    return dir->fts_pointer;
+}
+
 /* Macro for rm_traverse_directory() for easy file adding */
 #define _ADD_FILE(lint_type, is_symlink, stat_buf)                                      \
     rm_traverse_file(                                                                   \
-        trav_session, (RmStat *)stat_buf, p->fts_path, is_prefd, path_index, lint_type, \
-        is_symlink,                                                                     \
+        trav_session, (RmStat *)stat_buf, p->fts_path,                                  \
+        rm_traverse_dir_node(&cfg->file_trie, p->fts_parent), is_prefd, path_index,     \
+        lint_type, is_symlink,                                                          \
         rm_traverse_is_hidden(cfg, p->fts_name, is_hidden, p->fts_level + 1),           \
         rmpath->treat_as_single_vol, p->fts_level);
 
@@ -398,8 +415,9 @@ static void rm_traverse_directory(RmTravBuffer *buffer, RmTravSession *trav_sess
                     /* normal stat failed but 64-bit stat worked
                      * -> must be a big file on 32 bit.
                      */
-                    rm_traverse_file(trav_session, &stat_buf, p->fts_path, is_prefd,
-                                     path_index, RM_LINT_TYPE_UNKNOWN, false,
+                    rm_traverse_file(trav_session, &stat_buf, p->fts_path,
+                                     rm_traverse_dir_node(&cfg->file_trie, p->fts_parent),
+                                     is_prefd, path_index, RM_LINT_TYPE_UNKNOWN, false,
                                      rm_traverse_is_hidden(cfg, p->fts_name, is_hidden,
                                                            p->fts_level + 1),
                                      rmpath->treat_as_single_vol, p->fts_level);
@@ -510,11 +528,11 @@ void rm_traverse_tree(RmSession *session) {
             /* A symlink where we could not get the actual path from
              * (and it was given directly, e.g. by a find call)
              */
-            rm_traverse_file(trav_session, &buffer->stat_buf, rmpath->path,
+            rm_traverse_file(trav_session, &buffer->stat_buf, rmpath->path, NULL,
                              rmpath->is_prefd, rmpath->idx, RM_LINT_TYPE_BADLINK, false,
                              is_hidden, FALSE, 0);
         } else if(S_ISREG(buffer->stat_buf.st_mode)) {
-            rm_traverse_file(trav_session, &buffer->stat_buf, rmpath->path,
+            rm_traverse_file(trav_session, &buffer->stat_buf, rmpath->path, NULL,
                              rmpath->is_prefd, rmpath->idx, RM_LINT_TYPE_UNKNOWN, false,
                              is_hidden, FALSE, 0);
 
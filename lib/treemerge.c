@@ -64,6 +64,9 @@
  *              so they do not get reported twice. Files that could not be
  *              grouped in directories are found and reported as usually.
  *              Some ugly and tricky parts are in here due to the many options of rmlint.
+ *              Groups whose directories can not be merged up any further (all their
+ *              parents are known to stay incomplete) are extracted already while the
+ *              shredder runs (see rm_tm_emit()), so their files can be freed early.
  */
 
 /*
@@ -86,6 +89,22 @@
 
 #include "fts/fts.h"
 
+/* Number of 64 bit lanes of the multiset fingerprint of a directory */
+#define RM_TM_FINGERPRINT_LANES (4)
+
+/* Minimum time between two scans of the pending groups in rm_tm_emit() (in us) */
+#define RM_TM_EMIT_INTERVAL (500 * 1000)
+
+/* MinHash sketch of a directory tree (--similar-dirs): directories whose
+ * sketches agree in all rows of at least one band are compared (LSH) */
+#define RM_TM_SKETCH_BANDS (8)
+#define RM_TM_SKETCH_ROWS (4)
+#define RM_TM_SKETCH_SIZE (RM_TM_SKETCH_BANDS * RM_TM_SKETCH_ROWS)
+
+/* Buckets bigger than this are not paired up; they are usually lots of
+ * directories that only share a single common file */
+#define RM_TM_SKETCH_MAX_BUCKET (64)
+
 typedef struct RmDirectory {
     char *dirname;       /* Path to this directory without trailing slash              */
     GQueue known_files;  /* RmFiles in this directory                                  */
@@ -99,8 +118,13 @@ typedef struct RmDirectory {
     bool was_merged : 1; /* true if this directory was merged up already (only once)   */
     bool was_inserted : 1; /* true if this directory was added to results (only once)  */
     bool was_dupe_extracted : 1;
+    bool was_emitted : 1; /* true if the group of this directory went out early      */
+    gint rank;            /* position when ranking equal dirs by orig criteria         */
+    RmFile *mask;         /* this directory as RmFile; set by rm_tm_prepare_group()    */
     unsigned short depth; /* path depth (i.e. count of / in path, no trailing /)       */
-    GHashTable *hash_set; /* Set of hashes, used for true equality check               */
+    guint64 fingerprint[RM_TM_FINGERPRINT_LANES]; /* Lane-wise sum of the blake2b of the
+                             file digests in this directory and below; a multiset hash
+                             that is merged up by addition and compared with memcmp.   */
     RmDigest *digest;     /* Common XOR digest of all RmFiles in this directory.
                              note that this is only used as fast hash comparison.      */
 
@@ -127,8 +151,21 @@ struct RmTreeMerger {
     GQueue valid_dirs;               /* Directories consisting of RmFiles only              */
     RmTreeMergeOutputFunc callback;  /* Callback for finished directories or leftover files */
     gpointer callback_data;
+    GHashTable *dir_states;          /* {RmNode => RmTmDirState} of the file trie           */
+    GMutex dir_states_lock;          /* Protects dir_states (written by shredder threads)   */
+    GHashTable *candidate_nodes;     /* file_trie nodes of all candidates (--similar-dirs)  */
+    GQueue pending_groups;           /* Groups of equal directories not emitted yet         */
+    gint64 last_emit_scan;           /* Monotonic time of the last scan in rm_tm_emit()     */
+    GQueue similar_dirs;             /* RmSimilarDirs found by rm_tm_find_similar_dirs()    */
 };
 
+/* What the shredder told us about a directory of the file trie */
+typedef struct RmTmDirState {
+    gint64 candidates; /* Files in or below this directory that entered the shredder */
+    bool rejected : 1; /* At least one of them turned out to be unique               */
+    bool dead : 1;     /* The directory can never be complete (cached)               */
+} RmTmDirState;
+
 //////////////////////////
 // ACTUAL FILE COUNTING //
 //////////////////////////
@@ -290,6 +327,97 @@ static bool rm_tm_count_files(RmTrie *count_tree, const RmCfg *const cfg) {
         return false;
 }
 
+////////////////////////////////
+// SHREDDER PROGRESS TRACKING //
+////////////////////////////////
+
+/* A directory is complete once all of its files were fed, which is only known
+ * for sure at the very end.  What is known earlier is when a directory can
+ * *never* become complete anymore: if less files than it contains entered the
+ * shredder, or one of them was found to be unique.  Equal directories whose
+ * parents are all "dead" like that won't be merged up anymore, so they can be
+ * written out right away by rm_tm_emit().
+ */
+
+static void rm_tm_dir_state_free(RmTmDirState *state) {
+    g_slice_free(RmTmDirState, state);
+}
+
+/* Call with dir_states_lock held */
+static RmTmDirState *rm_tm_dir_state(RmTreeMerger *self, RmNode *node) {
+    RmTmDirState *state = g_hash_table_lookup(self->dir_states, node);
+    if(state == NULL) {
+        state = g_slice_new0(RmTmDirState);
+        g_hash_table_insert(self->dir_states, node, state);
+    }
+    return state;
+}
+
+static gint rm_tm_add_candidate_single(RmFile *file, RmTreeMerger *self) {
+    if(self->session->cfg->find_similar_dirs) {
+        /* rm_tm_collect_differing() only counts these */
+        g_hash_table_add(self->candidate_nodes, file->folder);
+    }
+    for(RmNode *node = file->folder->parent; node; node = node->parent) {
+        rm_tm_dir_state(self, node)->candidates++;
+    }
+    return 0;
+}
+
+void rm_tm_add_candidate(RmTreeMerger *self, RmFile *file) {
+    g_assert(self);
+    g_assert(file);
+
+    g_mutex_lock(&self->dir_states_lock);
+    {
+        rm_file_foreach(file, (RmRFunc)rm_tm_add_candidate_single, self);
+    }
+    g_mutex_unlock(&self->dir_states_lock);
+}
+
+void rm_tm_reject(RmTreeMerger *self, RmFile *file) {
+    g_assert(self);
+    g_assert(file);
+
+    /* Bundled hardlinks are not followed: they might have been split off
+     * into a group of their own already and still be fed from there. */
+    g_mutex_lock(&self->dir_states_lock);
+    {
+        for(RmNode *node = file->folder->parent; node; node = node->parent) {
+            RmTmDirState *state = rm_tm_dir_state(self, node);
+            if(state->rejected) {
+                /* all parents were flagged already */
+                break;
+            }
+            state->rejected = true;
+        }
+    }
+    g_mutex_unlock(&self->dir_states_lock);
+}
+
+static bool rm_tm_dir_is_dead(RmTreeMerger *self, RmNode *node) {
+    char path[PATH_MAX] = "/";
+    rm_trie_build_path(&self->session->cfg->file_trie, node, path, sizeof(path));
+
+    /* -1 (error) or 0 (never seen) can not be reached */
+    gint64 file_count = GPOINTER_TO_INT(rm_trie_search(&self->count_tree, path));
+
+    bool dead = false;
+    g_mutex_lock(&self->dir_states_lock);
+    {
+        RmTmDirState *state = rm_tm_dir_state(self, node);
+        if(!state->dead) {
+            /* Only candidates can be fed, and never a rejected one */
+            state->dead = file_count <= 0 || state->candidates < file_count ||
+                          (state->rejected && state->candidates <= file_count);
+        }
+        dead = state->dead;
+    }
+    g_mutex_unlock(&self->dir_states_lock);
+
+    return dead;
+}
+
 ///////////////////////////////
 // DIRECTORY STRUCT HANDLING //
 ///////////////////////////////
@@ -331,15 +459,11 @@ static RmDirectory *rm_directory_new(char *dirname) {
     g_queue_init(&self->known_files);
     g_queue_init(&self->children);
 
-    self->hash_set =
-        g_hash_table_new((GHashFunc)rm_digest_hash, (GEqualFunc)rm_digest_equal);
-
     return self;
 }
 
 static void rm_directory_free(RmDirectory *self) {
     rm_digest_free(self->digest);
-    g_hash_table_unref(self->hash_set);
     g_queue_clear(&self->known_files);
     g_queue_clear(&self->children);
     g_free(self->dirname);
@@ -403,31 +527,17 @@ static bool rm_directory_equal(RmDirectory *d1, RmDirectory *d2) {
         return false;
     }
 
-    if(g_hash_table_size(d1->hash_set) != g_hash_table_size(d2->hash_set)) {
-        return false;
-    }
-
-    /* Compare the exact contents of the hash sets */
-    gpointer digest_key;
-    GHashTableIter iter;
-
-    g_hash_table_iter_init(&iter, d1->hash_set);
-    while(g_hash_table_iter_next(&iter, &digest_key, NULL)) {
-        if(g_hash_table_contains(d2->hash_set, digest_key) == false) {
-            return false;
-        }
-    }
-
-    return true;
+    /* Compare the contents (as multiset of file digests) */
+    return memcmp(d1->fingerprint, d2->fingerprint, sizeof(d1->fingerprint)) == 0;
 }
 
 static guint rm_directory_hash(const RmDirectory *d) {
     /* This hash is used to quickly compare directories with each other.
      * Different directories might yield the same hash of course.
      * To prevent this case, rm_directory_equal really compares
-     * all the file's hashes with each other.
+     * the digest and the fingerprint of the directories.
      */
-    return rm_digest_hash(d->digest) ^ d->dupe_count;
+    return (guint)d->fingerprint[0] ^ d->dupe_count;
 }
 
 static void rm_directory_add(RmTreeMerger *self, RmDirectory *directory, RmFile *file) {
@@ -461,10 +571,20 @@ static void rm_directory_add(RmTreeMerger *self, RmDirectory *directory, RmFile
         g_slice_free1(basename_cksum_len, basename_cksum);
     }
 
-    g_slice_free1(digest_bytes, file_digest);
+    /* Unlike the xor above, a sum does not cancel out equal files; the blake2b
+     * spreads short digests (e.g. xxhash) over all lanes. */
+    gsize key_len = 0;
+    guint8 *key = rm_digest_sum(RM_DIGEST_BLAKE2B, file_digest, digest_bytes, &key_len);
+    g_assert(key_len >= sizeof(directory->fingerprint));
 
-    /* The file value is not really used, but we need some non-null value */
-    g_hash_table_add(directory->hash_set, file->digest);
+    guint64 lanes[RM_TM_FINGERPRINT_LANES];
+    memcpy(lanes, key, sizeof(lanes));
+    for(int i = 0; i < RM_TM_FINGERPRINT_LANES; ++i) {
+        directory->fingerprint[i] += lanes[i];
+    }
+
+    g_slice_free1(key_len, key);
+    g_slice_free1(digest_bytes, file_digest);
 
     directory->dupe_count += 1;
     directory->prefd_files += file->is_prefd;
@@ -487,9 +607,8 @@ static void rm_directory_add_subdir(RmTreeMerger *self, RmDirectory *parent, RmD
 #endif
 
     /* Take over the child's digests */
-    for(GList *iter = subdir->known_files.head; iter; iter = iter->next) {
-        RmFile *file = iter->data;
-        g_hash_table_add(parent->hash_set, file->digest);
+    for(int i = 0; i < RM_TM_FINGERPRINT_LANES; ++i) {
+        parent->fingerprint[i] += subdir->fingerprint[i];
     }
 
     /* Inherit the child's checksum */
@@ -526,6 +645,14 @@ RmTreeMerger *rm_tm_new(RmSession *session) {
     self->callback_data = NULL;
     self->free_map = g_hash_table_new(NULL, NULL);
     g_queue_init(&self->valid_dirs);
+    g_queue_init(&self->pending_groups);
+    g_queue_init(&self->similar_dirs);
+    self->last_emit_scan = 0;
+
+    self->dir_states = g_hash_table_new_full(NULL, NULL, NULL,
+                                             (GDestroyNotify)rm_tm_dir_state_free);
+    g_mutex_init(&self->dir_states_lock);
+    self->candidate_nodes = g_hash_table_new(NULL, NULL);
 
     self->result_table = g_hash_table_new_full((GHashFunc)rm_directory_hash,
                                                (GEqualFunc)rm_directory_equal, NULL,
@@ -569,8 +696,15 @@ static void rm_tm_insert_dir(RmTreeMerger *self, RmDirectory *directory) {
         rm_hash_table_setdefault(self->result_table, directory, (RmNewFunc)g_queue_new);
     g_queue_push_head(dir_queue, directory);
     directory->was_inserted = true;
+
+    if(dir_queue->length == 2) {
+        /* Became a group of equal directories; see rm_tm_emit() */
+        g_queue_push_tail(&self->pending_groups, dir_queue);
+    }
 }
 
+static void rm_tm_cluster_up(RmTreeMerger *self, RmDirectory *directory);
+
 void rm_tm_feed(RmTreeMerger *self, RmFile *file) {
     g_assert(self);
     g_assert(file);
@@ -598,6 +732,10 @@ void rm_tm_feed(RmTreeMerger *self, RmFile *file) {
 
         g_queue_push_head(&self->valid_dirs, directory);
     } else {
+        if(directory->known_files.length == 0) {
+            /* created by rm_tm_cluster_up() as parent of a finished subdir */
+            g_queue_push_head(&self->valid_dirs, directory);
+        }
         g_free(dirname);
     }
 
@@ -613,6 +751,12 @@ void rm_tm_feed(RmTreeMerger *self, RmFile *file) {
     /* Check if the directory reached the number of actual files in it */
     if(directory->dupe_count == directory->file_count && directory->file_count > 0) {
         rm_tm_insert_dir(self, directory);
+
+        /* Merge it up right away (while the shredder is still busy), so that
+         * rm_tm_finish() only has to deal with the incomplete directories */
+        if(strcmp(directory->dirname, "/") != 0) {
+            rm_tm_cluster_up(self, directory);
+        }
     }
 }
 
@@ -665,6 +809,11 @@ static void rm_tm_output_file(RmTreeMerger *self, RmFile *file) {
 static void rm_tm_write_unfinished_cksums(RmTreeMerger *self, RmDirectory *directory) {
     for(GList *iter = directory->known_files.head; iter; iter = iter->next) {
         RmFile *file = iter->data;
+        if(self->session->cfg->find_similar_dirs) {
+            /* rm_tm_find_similar_dirs() still needs the file, but the output
+             * may spill (and free) what it gets; hand it a copy instead */
+            file = rm_file_copy(file);
+        }
         file->lint_type = RM_LINT_TYPE_UNIQUE_FILE;
         file->twin_count = -1;
         rm_tm_output_file(self, file);
@@ -679,7 +828,11 @@ static void rm_tm_write_unfinished_cksums(RmTreeMerger *self, RmDirectory *direc
 
 static int rm_tm_sort_paths(const RmDirectory *da, const RmDirectory *db,
                             _UNUSED RmTreeMerger *self) {
-    return da->depth - db->depth;
+    if(da->depth != db->depth) {
+        return da->depth - db->depth;
+    }
+    /* make the order independent of the order the files were fed in */
+    return strcmp(da->dirname, db->dirname);
 }
 
 static int rm_tm_sort_paths_reverse(const RmDirectory *da, const RmDirectory *db,
@@ -699,11 +852,12 @@ static int rm_tm_sort_orig_criteria(const RmDirectory *da, const RmDirectory *db
         }
     }
 
-    RmFile file_a, file_b;
-    rm_directory_to_file(self, da, &file_a);
-    rm_directory_to_file(self, db, &file_b);
+    return rm_pp_cmp_orig_criteria(da->mask, db->mask, self->session);
+}
 
-    return rm_pp_cmp_orig_criteria(&file_a, &file_b, self->session);
+static int rm_tm_sort_rank(const RmDirectory *da, const RmDirectory *db,
+                           _UNUSED RmTreeMerger *self) {
+    return da->rank - db->rank;
 }
 
 static void rm_tm_forward_unresolved(RmTreeMerger *self, RmDirectory *directory) {
@@ -831,6 +985,135 @@ static void rm_tm_output_group(RmTreeMerger *self, GQueue *group) {
     }
 }
 
+static bool rm_tm_group_was_emitted(GQueue *dir_list) {
+    for(GList *iter = dir_list->head; iter; iter = iter->next) {
+        if(((RmDirectory *)iter->data)->was_emitted) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Threadpool function for rm_tm_extract(): everything that can be done for a
+ * group of equal directories without looking at other groups. Groups are
+ * disjoint, so each directory is only touched by one thread. */
+static void rm_tm_prepare_group(GQueue *dir_list, RmTreeMerger *self) {
+    if(rm_tm_group_was_emitted(dir_list)) {
+        return;
+    }
+
+    /* Sort the RmDirectory list by their path depth, lowest depth first */
+    g_queue_sort(dir_list, (GCompareDataFunc)rm_tm_sort_paths, self);
+
+    /* If no --hidden is given, do not display top-level directories
+     * that are hidden. If needed, filter them beforehand. */
+    if(self->session->cfg->partial_hidden) {
+        rm_tm_filter_hidden_directories(dir_list);
+    }
+
+    /* Rank the directories for the choice of the original; they are taken
+     * in reverse depth order, like the result queue in rm_tm_extract() */
+    GQueue ranked = G_QUEUE_INIT;
+    for(GList *iter = dir_list->head; iter; iter = iter->next) {
+        RmDirectory *directory = iter->data;
+        directory->mask = rm_directory_as_new_file(self, directory);
+        g_queue_push_head(&ranked, directory);
+    }
+
+    g_queue_sort(&ranked, (GCompareDataFunc)rm_tm_sort_orig_criteria, self);
+
+    gint rank = 0;
+    for(GList *iter = ranked.head; iter; iter = iter->next) {
+        ((RmDirectory *)iter->data)->rank = rank++;
+    }
+    g_queue_clear(&ranked);
+}
+
+static void rm_tm_release_files(RmTreeMerger *self, RmDirectory *directory) {
+    for(GList *iter = directory->known_files.head; iter; iter = iter->next) {
+        RmFile *file = iter->data;
+
+        /* Files that went to the output (--write-unfinished) are not ours anymore */
+        if(g_hash_table_remove(self->free_map, file)) {
+            rm_file_destroy(file);
+        }
+    }
+    g_queue_clear(&directory->known_files);
+
+    for(GList *iter = directory->children.head; iter; iter = iter->next) {
+        rm_tm_release_files(self, iter->data);
+    }
+}
+
+/* Output one group of equal directories (prepared by rm_tm_prepare_group()).
+ * If release is true, the RmFiles of the reported duplicates are freed
+ * afterwards; they are finished and would not be looked at again. */
+static void rm_tm_extract_group(RmTreeMerger *self, GQueue *dir_list, bool release) {
+    RmCfg *cfg = self->session->cfg;
+
+    /* List of result directories */
+    GQueue result_dirs = G_QUEUE_INIT;
+
+    /* Output the directories and mark their children to prevent
+     * duplicate directory reports in lower levels.
+     */
+    for(GList *iter = dir_list->head; iter; iter = iter->next) {
+        RmDirectory *directory = iter->data;
+        if(directory->finished == false) {
+            rm_tm_mark_finished(self, directory);
+            g_queue_push_head(&result_dirs, directory);
+        }
+    }
+
+    /* Make sure the original directory lands as first
+     * in the result_dirs queue. The directories were converted to
+     * fake RmFiles already, so the output module can handle them.
+     */
+    g_queue_sort(&result_dirs, (GCompareDataFunc)rm_tm_sort_rank, self);
+
+    GQueue file_adaptor_group = G_QUEUE_INIT;
+
+    for(GList *iter = result_dirs.head; iter; iter = iter->next) {
+        RmDirectory *directory = iter->data;
+        rm_tm_extract_part_of_dir_dupes(self, directory);
+
+        RmFile *mask = directory->mask;
+        g_queue_push_tail(&file_adaptor_group, mask);
+
+        if(iter == result_dirs.head) {
+            /* First one in the group -> It's the original */
+            mask->is_original = true;
+            rm_tm_mark_original_files(self, directory);
+        } else {
+            gint64 prefd = rm_tm_mark_duplicate_files(self, directory);
+            if(prefd == directory->dupe_count && cfg->keep_all_tagged) {
+                /* Mark the file as original when all files in it are preferred. */
+                mask->is_original = true;
+            } else if(prefd == 0 && cfg->keep_all_untagged) {
+                mask->is_original = true;
+            }
+        }
+
+        if(self->session->cfg->write_unfinished) {
+            rm_tm_write_unfinished_cksums(self, directory);
+        }
+
+    }
+
+    rm_tm_output_group(self, &file_adaptor_group);
+
+    if(release) {
+        for(GList *iter = result_dirs.head; iter; iter = iter->next) {
+            if(iter != result_dirs.head) {
+                rm_tm_release_files(self, iter->data);
+            }
+        }
+    }
+
+    g_queue_clear(&file_adaptor_group);
+    g_queue_clear(&result_dirs);
+}
+
 static void rm_tm_extract(RmTreeMerger *self) {
     /* Iterate over all directories per hash (which are same therefore) */
     RmCfg *cfg = self->session->cfg;
@@ -838,6 +1121,28 @@ static void rm_tm_extract(RmTreeMerger *self) {
     result_table_values =
         g_list_sort(result_table_values, (GCompareFunc)rm_tm_cmp_directory_groups);
 
+    /* Sorting and ranking is independent per group; do it in parallel */
+    GThreadPool *prepare_pool = rm_util_thread_pool_new(
+        (GFunc)rm_tm_prepare_group, self, MAX(cfg->threads, 1));
+    for(GList *iter = result_table_values; iter; iter = iter->next) {
+        GQueue *dir_list = iter->data;
+        if(dir_list->length >= 2) {
+            rm_util_thread_pool_push(prepare_pool, dir_list);
+        }
+    }
+    g_thread_pool_free(prepare_pool, FALSE, TRUE);
+
+    for(GList *iter = result_table_values; iter; iter = iter->next) {
+        GQueue *dir_list = iter->data;
+        for(GList *dir_iter = dir_list->head; dir_iter; dir_iter = dir_iter->next) {
+            RmDirectory *directory = dir_iter->data;
+            if(directory->mask) {
+                /* freed in rm_tm_destroy() unless it is written to the output */
+                g_hash_table_insert(self->free_map, directory->mask, directory->mask);
+            }
+        }
+    }
+
     for(GList *iter = result_table_values; iter; iter = iter->next) {
         /* Needs at least two directories to be duplicate... */
         GQueue *dir_list = iter->data;
@@ -852,7 +1157,7 @@ static void rm_tm_extract(RmTreeMerger *self) {
         }
         g_printerr("---\n");
 #endif
-        if(dir_list->length < 2) {
+        if(dir_list->length < 2 || rm_tm_group_was_emitted(dir_list)) {
             continue;
         }
 
@@ -860,69 +1165,7 @@ static void rm_tm_extract(RmTreeMerger *self) {
             break;
         }
 
-        /* List of result directories */
-        GQueue result_dirs = G_QUEUE_INIT;
-
-        /* Sort the RmDirectory list by their path depth, lowest depth first */
-        g_queue_sort(dir_list, (GCompareDataFunc)rm_tm_sort_paths, self);
-
-        /* If no --hidden is given, do not display top-level directories
-         * that are hidden. If needed, filter them beforehand. */
-        if(cfg->partial_hidden) {
-            rm_tm_filter_hidden_directories(dir_list);
-        }
-
-        /* Output the directories and mark their children to prevent
-         * duplicate directory reports in lower levels.
-         */
-        for(GList *iter = dir_list->head; iter; iter = iter->next) {
-            RmDirectory *directory = iter->data;
-            if(directory->finished == false) {
-                rm_tm_mark_finished(self, directory);
-                g_queue_push_head(&result_dirs, directory);
-            }
-        }
-
-        /* Make sure the original directory lands as first
-         * in the result_dirs queue. Also convert it from RmDirectory
-         * to a fake RmFile, so the output module can handle it.
-         */
-        g_queue_sort(&result_dirs, (GCompareDataFunc)rm_tm_sort_orig_criteria, self);
-
-        GQueue file_adaptor_group = G_QUEUE_INIT;
-
-        for(GList *iter = result_dirs.head; iter; iter = iter->next) {
-            RmDirectory *directory = iter->data;
-            rm_tm_extract_part_of_dir_dupes(self, directory);
-
-            RmFile *mask = rm_directory_as_new_file(self, directory);
-            g_queue_push_tail(&file_adaptor_group, mask);
-            g_hash_table_insert(self->free_map, mask, mask);
-
-            if(iter == result_dirs.head) {
-                /* First one in the group -> It's the original */
-                mask->is_original = true;
-                rm_tm_mark_original_files(self, directory);
-            } else {
-                gint64 prefd = rm_tm_mark_duplicate_files(self, directory);
-                if(prefd == directory->dupe_count && cfg->keep_all_tagged) {
-                    /* Mark the file as original when all files in it are preferred. */
-                    mask->is_original = true;
-                } else if(prefd == 0 && cfg->keep_all_untagged) {
-                    mask->is_original = true;
-                }
-            }
-
-            if(self->session->cfg->write_unfinished) {
-                rm_tm_write_unfinished_cksums(self, directory);
-            }
-
-        }
-
-        rm_tm_output_group(self, &file_adaptor_group);
-
-        g_queue_clear(&file_adaptor_group);
-        g_queue_clear(&result_dirs);
+        rm_tm_extract_group(self, dir_list, false);
     }
 
     g_list_free(result_table_values);
@@ -974,6 +1217,421 @@ static void rm_tm_extract(RmTreeMerger *self) {
     }
 }
 
+/* A group can go out early if none of its directories can be merged up anymore.
+ * Its partners are complete already: equal directories consist of the same
+ * shred groups and therefore complete in the same call of rm_tm_emit(). */
+static bool rm_tm_group_is_final(RmTreeMerger *self, GQueue *dir_list) {
+    RmTrie *file_trie = &self->session->cfg->file_trie;
+
+    for(GList *iter = dir_list->head; iter; iter = iter->next) {
+        RmDirectory *directory = iter->data;
+        if(directory->finished || directory->was_emitted) {
+            return false;
+        }
+
+        RmNode *node = rm_trie_search_node(file_trie, directory->dirname);
+        if(node == NULL) {
+            return false;
+        }
+
+        for(node = node->parent; node; node = node->parent) {
+            if(!rm_tm_dir_is_dead(self, node)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void rm_tm_emit(RmTreeMerger *self) {
+    g_assert(self);
+
+    if(self->callback == NULL || self->pending_groups.length == 0) {
+        return;
+    }
+
+    /* The scan is not for free; it is fine if a few groups wait for rm_tm_finish() */
+    gint64 now = g_get_monotonic_time();
+    if(now - self->last_emit_scan < RM_TM_EMIT_INTERVAL) {
+        return;
+    }
+    self->last_emit_scan = now;
+
+    for(GList *iter = self->pending_groups.head, *next = NULL; iter; iter = next) {
+        next = iter->next;
+        GQueue *dir_list = iter->data;
+
+        if(rm_session_was_aborted()) {
+            break;
+        }
+
+        if(!rm_tm_group_is_final(self, dir_list)) {
+            continue;
+        }
+
+        g_queue_delete_link(&self->pending_groups, iter);
+
+        rm_tm_prepare_group(dir_list, self);
+        for(GList *dir_iter = dir_list->head; dir_iter; dir_iter = dir_iter->next) {
+            RmDirectory *directory = dir_iter->data;
+            if(directory->mask) {
+                g_hash_table_insert(self->free_map, directory->mask, directory->mask);
+            }
+        }
+
+        if(dir_list->length >= 2) {
+            /* --similar-dirs still needs the files in rm_tm_finish() */
+            rm_tm_extract_group(self, dir_list, !self->session->cfg->find_similar_dirs);
+        }
+
+        /* rm_tm_finish() must not report them again */
+        for(GList *dir_iter = dir_list->head; dir_iter; dir_iter = dir_iter->next) {
+            RmDirectory *directory = dir_iter->data;
+            directory->was_emitted = true;
+            directory->mask = NULL;
+        }
+    }
+}
+
+/////////////////////////
+// SIMILAR DIRECTORIES //
+/////////////////////////
+
+/* Directories that are not equal, but share most of their files, are found in
+ * three steps: A MinHash sketch of the file digests is built for every
+ * directory in dir_tree (bottom-up, so it covers the whole tree below).
+ * Directories whose sketches agree in one band land in the same bucket and
+ * are paired up (LSH), which avoids comparing all pairs.  The pairs are then
+ * compared exactly, counting all duplicate candidates (including unique
+ * ones, but no other lint) as the Jaccard index shared / (files_a + files_b - shared).
+ */
+
+typedef struct RmTmSketch {
+    RmNode *node;                       /* Node of this directory in dir_tree */
+    gint level;                         /* Depth of node in dir_tree          */
+    guint32 minhash[RM_TM_SKETCH_SIZE]; /* Minimum of each hash function      */
+    guint64 bands[RM_TM_SKETCH_BANDS];  /* Hash of each band; bucket keys     */
+} RmTmSketch;
+
+typedef struct RmTmSketchPair {
+    RmTmSketch *a, *b;
+} RmTmSketchPair;
+
+void rm_similar_dirs_free(RmSimilarDirs *self) {
+    for(int i = 0; i < 2; ++i) {
+        g_free(self->paths[i]);
+        g_queue_foreach(&self->differing[i], (GFunc)g_free, NULL);
+        g_queue_clear(&self->differing[i]);
+    }
+    g_slice_free(RmSimilarDirs, self);
+}
+
+const GQueue *rm_tm_get_similar_dirs(RmTreeMerger *self) {
+    g_assert(self);
+    return &self->similar_dirs;
+}
+
+static void rm_tm_sketch_free(RmTmSketch *sketch) {
+    g_slice_free(RmTmSketch, sketch);
+}
+
+static RmTmSketch *rm_tm_sketch_get(GHashTable *sketches, RmNode *node) {
+    RmTmSketch *sketch = g_hash_table_lookup(sketches, node);
+    if(sketch == NULL) {
+        sketch = g_slice_new0(RmTmSketch);
+        sketch->node = node;
+        memset(sketch->minhash, 0xff, sizeof(sketch->minhash));
+        g_hash_table_insert(sketches, node, sketch);
+    }
+    return sketch;
+}
+
+/* i-th hash function of the MinHash family (splitmix64 of a shifted seed) */
+static guint32 rm_tm_minhash(guint64 seed, int i) {
+    guint64 x = seed + (i + 1) * 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return (guint32)((x ^ (x >> 31)) >> 32);
+}
+
+static int rm_tm_sketch_callback(_UNUSED RmTrie *trie, RmNode *node, int level,
+                                 GHashTable *sketches) {
+    /* post order: the children were merged into this sketch already */
+    RmDirectory *directory = node->data;
+    RmTmSketch *sketch = g_hash_table_lookup(sketches, node);
+
+    if(directory && directory->known_files.length > 0) {
+        sketch = rm_tm_sketch_get(sketches, node);
+        for(GList *iter = directory->known_files.head; iter; iter = iter->next) {
+            RmFile *file = iter->data;
+            guint64 seed = rm_digest_hash(file->digest);
+            for(int i = 0; i < RM_TM_SKETCH_SIZE; ++i) {
+                sketch->minhash[i] = MIN(sketch->minhash[i], rm_tm_minhash(seed, i));
+            }
+        }
+    }
+
+    if(sketch == NULL) {
+        return 0;
+    }
+
+    sketch->level = level;
+    if(node->parent) {
+        RmTmSketch *parent = rm_tm_sketch_get(sketches, node->parent);
+        for(int i = 0; i < RM_TM_SKETCH_SIZE; ++i) {
+            parent->minhash[i] = MIN(parent->minhash[i], sketch->minhash[i]);
+        }
+    }
+    return 0;
+}
+
+static guint rm_tm_sketch_pair_hash(const RmTmSketchPair *pair) {
+    return g_direct_hash(pair->a) * 31 + g_direct_hash(pair->b);
+}
+
+static gboolean rm_tm_sketch_pair_equal(const RmTmSketchPair *x, const RmTmSketchPair *y) {
+    return x->a == y->a && x->b == y->b;
+}
+
+static void rm_tm_sketch_pair_free(RmTmSketchPair *pair) {
+    g_slice_free(RmTmSketchPair, pair);
+}
+
+static RmTmSketchPair *rm_tm_sketch_pair_new(RmTmSketch *a, RmTmSketch *b) {
+    RmTmSketchPair *pair = g_slice_new(RmTmSketchPair);
+    /* normalize, so (a, b) and (b, a) are the same pair */
+    pair->a = MIN(a, b);
+    pair->b = MAX(a, b);
+    return pair;
+}
+
+static bool rm_tm_node_is_below(RmNode *node, RmNode *ancestor) {
+    for(node = node->parent; node; node = node->parent) {
+        if(node == ancestor) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int rm_tm_collect_known_files(_UNUSED RmTrie *trie, RmNode *node,
+                                     _UNUSED int level, GQueue *files) {
+    RmDirectory *directory = node->data;
+    for(GList *iter = directory->known_files.head; iter; iter = iter->next) {
+        g_queue_push_tail(files, iter->data);
+    }
+    return 0;
+}
+
+typedef struct RmTmDiffer {
+    GHashTable *candidates; /* file_trie nodes of all duplicate candidates           */
+    GHashTable *matched;    /* file_trie nodes of files with a twin in the other dir */
+    GQueue *differing;      /* paths of all other candidates                         */
+    gint64 n_files;         /* all candidates below the directory                    */
+} RmTmDiffer;
+
+static int rm_tm_collect_differing(RmTrie *trie, RmNode *node, _UNUSED int level,
+                                   RmTmDiffer *differ) {
+    if(node->n_children > 0 || !g_hash_table_contains(differ->candidates, node)) {
+        /* a directory (its files are visited on their own), or other lint such
+         * as an empty directory */
+        return 0;
+    }
+
+    differ->n_files++;
+    if(!g_hash_table_contains(differ->matched, node)) {
+        char path[PATH_MAX];
+        rm_trie_build_path(trie, node, path, sizeof(path));
+        g_queue_push_tail(differ->differing, g_strdup(path));
+    }
+    return 0;
+}
+
+/* Exact comparison of two directories; returns NULL if they are not similar enough */
+static RmSimilarDirs *rm_tm_compare_similar(RmTreeMerger *self, RmTmSketch *a,
+                                            RmTmSketch *b) {
+    RmTrie *file_trie = &self->session->cfg->file_trie;
+    RmTmSketch *sketches[2] = {a, b};
+    RmNode *file_nodes[2] = {NULL, NULL};
+
+    RmSimilarDirs *result = g_slice_new0(RmSimilarDirs);
+    for(int i = 0; i < 2; ++i) {
+        char path[PATH_MAX] = "/";
+        rm_trie_build_path(&self->dir_tree, sketches[i]->node, path, sizeof(path));
+        result->paths[i] = g_strdup(path);
+        file_nodes[i] = rm_trie_search_node(file_trie, path);
+    }
+
+    /* Pair up the files of both sides by digest */
+    GQueue files_a = G_QUEUE_INIT, files_b = G_QUEUE_INIT;
+    rm_trie_iter(&self->dir_tree, a->node, true, false,
+                 (RmTrieIterCallback)rm_tm_collect_known_files, &files_a);
+    rm_trie_iter(&self->dir_tree, b->node, true, false,
+                 (RmTrieIterCallback)rm_tm_collect_known_files, &files_b);
+
+    GHashTable *by_digest =
+        g_hash_table_new_full((GHashFunc)rm_digest_hash, (GEqualFunc)rm_digest_equal,
+                              NULL, (GDestroyNotify)g_queue_free);
+    for(GList *iter = files_a.head; iter; iter = iter->next) {
+        RmFile *file = iter->data;
+        GQueue *twins =
+            rm_hash_table_setdefault(by_digest, file->digest, (RmNewFunc)g_queue_new);
+        g_queue_push_tail(twins, file);
+    }
+
+    GHashTable *matched = g_hash_table_new(NULL, NULL);
+    for(GList *iter = files_b.head; iter; iter = iter->next) {
+        RmFile *file = iter->data;
+        GQueue *twins = g_hash_table_lookup(by_digest, file->digest);
+        if(twins && twins->length > 0) {
+            RmFile *twin = g_queue_pop_head(twins);
+            g_hash_table_add(matched, twin->folder);
+            g_hash_table_add(matched, file->folder);
+            result->shared++;
+        }
+    }
+
+    g_hash_table_unref(by_digest);
+    g_queue_clear(&files_a);
+    g_queue_clear(&files_b);
+
+    /* All other candidates below them differ, unique files too */
+    gint64 n_files[2] = {0, 0};
+    for(int i = 0; i < 2 && file_nodes[0] && file_nodes[1]; ++i) {
+        RmTmDiffer differ = {self->candidate_nodes, matched, &result->differing[i], 0};
+        rm_trie_iter(file_trie, file_nodes[i], true, false,
+                     (RmTrieIterCallback)rm_tm_collect_differing, &differ);
+        n_files[i] = differ.n_files;
+    }
+    g_hash_table_unref(matched);
+
+    gint64 n_union = n_files[0] + n_files[1] - result->shared;
+    result->similarity = (n_union > 0) ? (gdouble)result->shared / n_union : 0;
+
+    if(result->similarity < self->session->cfg->similar_dirs_threshold ||
+       (result->differing[0].length == 0 && result->differing[1].length == 0)) {
+        /* not similar enough, or equal (reported as duplicate directory) */
+        rm_similar_dirs_free(result);
+        return NULL;
+    }
+
+    return result;
+}
+
+static gint rm_tm_cmp_similar_level(const RmTmSketchPair *x, const RmTmSketchPair *y) {
+    return (x->a->level + x->b->level) - (y->a->level + y->b->level);
+}
+
+static void rm_tm_find_similar_dirs(RmTreeMerger *self) {
+    RmCfg *cfg = self->session->cfg;
+
+    GHashTable *sketches =
+        g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)rm_tm_sketch_free);
+    rm_trie_iter(&self->dir_tree, NULL, false, true,
+                 (RmTrieIterCallback)rm_tm_sketch_callback, sketches);
+
+    /* Put every directory in one bucket per band */
+    GHashTable *buckets = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL,
+                                                (GDestroyNotify)g_queue_free);
+    GHashTableIter iter;
+    RmTmSketch *sketch = NULL;
+    g_hash_table_iter_init(&iter, sketches);
+    while(g_hash_table_iter_next(&iter, NULL, (gpointer *)&sketch)) {
+        char path[PATH_MAX] = "/";
+        rm_trie_build_path(&self->dir_tree, sketch->node, path, sizeof(path));
+        if(GPOINTER_TO_INT(rm_trie_search(&self->count_tree, path)) <= 0) {
+            /* above the given paths or not readable */
+            continue;
+        }
+
+        for(int b = 0; b < RM_TM_SKETCH_BANDS; ++b) {
+            guint64 band = b;
+            for(int r = 0; r < RM_TM_SKETCH_ROWS; ++r) {
+                band = band * 0x100000001B3ULL ^ sketch->minhash[b * RM_TM_SKETCH_ROWS + r];
+            }
+            sketch->bands[b] = band;
+
+            GQueue *bucket = rm_hash_table_setdefault(buckets, &sketch->bands[b],
+                                                      (RmNewFunc)g_queue_new);
+            g_queue_push_tail(bucket, sketch);
+        }
+    }
+
+    /* Compare each pair that shares a bucket once */
+    GHashTable *checked =
+        g_hash_table_new_full((GHashFunc)rm_tm_sketch_pair_hash,
+                              (GEqualFunc)rm_tm_sketch_pair_equal,
+                              (GDestroyNotify)rm_tm_sketch_pair_free, NULL);
+    GHashTable *found = g_hash_table_new(
+        (GHashFunc)rm_tm_sketch_pair_hash, (GEqualFunc)rm_tm_sketch_pair_equal);
+    GQueue *bucket = NULL;
+    g_hash_table_iter_init(&iter, buckets);
+    while(g_hash_table_iter_next(&iter, NULL, (gpointer *)&bucket)) {
+        if(bucket->length < 2 || bucket->length > RM_TM_SKETCH_MAX_BUCKET) {
+            continue;
+        }
+
+        for(GList *i = bucket->head; i; i = i->next) {
+            for(GList *j = i->next; j; j = j->next) {
+                RmTmSketch *a = i->data, *b = j->data;
+                if(rm_tm_node_is_below(a->node, b->node) ||
+                   rm_tm_node_is_below(b->node, a->node)) {
+                    continue;
+                }
+
+                RmTmSketchPair *pair = rm_tm_sketch_pair_new(a, b);
+                if(g_hash_table_contains(checked, pair)) {
+                    rm_tm_sketch_pair_free(pair);
+                    continue;
+                }
+                g_hash_table_add(checked, pair);
+
+                RmSimilarDirs *similar = rm_tm_compare_similar(self, pair->a, pair->b);
+                if(similar != NULL) {
+                    g_hash_table_insert(found, pair, similar);
+                }
+            }
+        }
+    }
+
+    /* Report the topmost pairs only; below two similar trees, most of
+     * the subdirectories are similar (or equal) too. */
+    GList *pairs = g_list_sort(g_hash_table_get_keys(found),
+                               (GCompareFunc)rm_tm_cmp_similar_level);
+    GHashTable *reported = g_hash_table_new(
+        (GHashFunc)rm_tm_sketch_pair_hash, (GEqualFunc)rm_tm_sketch_pair_equal);
+
+    for(GList *iter = pairs; iter; iter = iter->next) {
+        RmTmSketchPair *pair = iter->data;
+        RmSimilarDirs *similar = g_hash_table_lookup(found, pair);
+
+        RmTmSketch *parent_a = g_hash_table_lookup(sketches, pair->a->node->parent);
+        RmTmSketch *parent_b = g_hash_table_lookup(sketches, pair->b->node->parent);
+        if(parent_a && parent_b) {
+            RmTmSketchPair parents = {MIN(parent_a, parent_b), MAX(parent_a, parent_b)};
+            if(g_hash_table_contains(reported, &parents)) {
+                g_hash_table_add(reported, pair);
+                rm_similar_dirs_free(similar);
+                continue;
+            }
+        }
+
+        g_hash_table_add(reported, pair);
+        g_queue_push_tail(&self->similar_dirs, similar);
+    }
+
+    rm_log_debug_line("Found %u similar directories (threshold %.2f) in %u buckets",
+                      self->similar_dirs.length, cfg->similar_dirs_threshold,
+                      g_hash_table_size(buckets));
+
+    g_list_free(pairs);
+    g_hash_table_unref(reported);
+    g_hash_table_unref(found);
+    g_hash_table_unref(checked);
+    g_hash_table_unref(buckets);
+    g_hash_table_unref(sketches);
+}
+
 static void rm_tm_cluster_up(RmTreeMerger *self, RmDirectory *directory) {
     char *parent_dir = g_path_get_dirname(directory->dirname);
     bool is_root = strcmp(parent_dir, "/") == 0;
@@ -1008,6 +1666,9 @@ void rm_tm_finish(RmTreeMerger *self) {
     g_assert(self);
     g_assert(self->callback);
 
+    /* All groups that are left are handled by rm_tm_extract() */
+    g_queue_clear(&self->pending_groups);
+
     /* Iterate over all valid directories and try to level them all layers up.
      */
     g_queue_sort(&self->valid_dirs, (GCompareDataFunc)rm_tm_sort_paths_reverse, self);
@@ -1019,6 +1680,11 @@ void rm_tm_finish(RmTreeMerger *self) {
 #endif
     }
 
+    if(!rm_session_was_aborted() && self->session->cfg->find_similar_dirs) {
+        /* Needs all files; rm_tm_extract() hands them to the output */
+        rm_tm_find_similar_dirs(self);
+    }
+
     if(!rm_session_was_aborted()) {
         /* Recursively call self to march on */
         rm_tm_extract(self);
@@ -1031,6 +1697,14 @@ void rm_tm_destroy(RmTreeMerger *self) {
     g_hash_table_unref(self->known_hashs);
 
     g_queue_clear(&self->valid_dirs);
+    g_queue_clear(&self->pending_groups);
+
+    g_hash_table_unref(self->dir_states);
+    g_hash_table_unref(self->candidate_nodes);
+    g_mutex_clear(&self->dir_states_lock);
+
+    g_queue_foreach(&self->similar_dirs, (GFunc)rm_similar_dirs_free, NULL);
+    g_queue_clear(&self->similar_dirs);
 
     /* Kill all RmDirectories stored in the tree */
     rm_trie_iter(&self->dir_tree, NULL, true, false,
@@ -63,9 +63,37 @@ void rm_tm_set_callback(RmTreeMerger *self, RmTreeMergeOutputFunc callback, gpoi
 
 /**
  * @brief Add an RmFile to the pool of (to be) investigated files.
+ *
+ * Directories that are complete with this file are merged up into their
+ * parents right away, so feed while the shredder is still running.
  */
 void rm_tm_feed(RmTreeMerger *self, RmFile *file);
 
+/**
+ * @brief Register a file (and its bundled hardlinks) that entered the shredder.
+ *
+ * Only needed for rm_tm_emit(), which must know how many files
+ * of a directory may still be fed.
+ */
+void rm_tm_add_candidate(RmTreeMerger *self, RmFile *file);
+
+/**
+ * @brief Tell the tree merger that a registered file will never be fed.
+ *
+ * Only the file itself is rejected, not its bundled hardlinks.
+ * Threadsafe; call before the file is freed.
+ */
+void rm_tm_reject(RmTreeMerger *self, RmFile *file);
+
+/**
+ * @brief Output groups of equal directories that can not change anymore.
+ *
+ * Call from the thread that feeds, after feeding a group of files.
+ * Does nothing unless a callback was set; the scan is rate limited,
+ * everything that is left over is handled by rm_tm_finish().
+ */
+void rm_tm_emit(RmTreeMerger *self);
+
 /**
  * @brief Find duplicate directories through all fed RmFiles.
  */
@@ -76,6 +104,28 @@ void rm_tm_finish(RmTreeMerger *self);
  */
 void rm_tm_destroy(RmTreeMerger *self);
 
+/**
+ * A pair of directories that share most, but not all of their files.
+ */
+typedef struct RmSimilarDirs {
+    char *paths[2];      /* The two directories                         */
+    gdouble similarity;  /* Jaccard index of their files (0..1)         */
+    gint64 shared;       /* Number of file pairs with equal content     */
+    GQueue differing[2]; /* Paths (char *) of files without twin there  */
+} RmSimilarDirs;
+
+/**
+ * @brief Get the similar directories found by rm_tm_finish() (--similar-dirs).
+ *
+ * @return A queue of RmSimilarDirs, topmost pairs first. Owned by the RmTreeMerger.
+ */
+const GQueue *rm_tm_get_similar_dirs(RmTreeMerger *self);
+
+/**
+ * @brief Free a RmSimilarDirs and its paths.
+ */
+void rm_similar_dirs_free(RmSimilarDirs *self);
+
 /**
  * A duplicate directory.
  */
@@ -462,6 +462,7 @@ void rm_userlist_destroy(RmUserList *self) {
 typedef struct RmDiskInfo {
     char *name;
     bool is_rotational;
+    bool is_network;
 } RmDiskInfo;
 
 typedef struct RmPartitionInfo {
@@ -486,10 +487,11 @@ void rm_part_info_free(RmPartitionInfo *self) {
     g_free(self);
 }
 
-RmDiskInfo *rm_disk_info_new(char *name, char is_rotational) {
+RmDiskInfo *rm_disk_info_new(char *name, char is_rotational, bool is_network) {
     RmDiskInfo *self = g_new0(RmDiskInfo, 1);
     self->name = g_strdup(name);
     self->is_rotational = is_rotational;
+    self->is_network = is_network;
     return self;
 }
 
@@ -698,6 +700,23 @@ int rm_mounts_devno_to_wholedisk(_UNUSED RmMountEntry *entry, _UNUSED dev_t rdev
     return blkid_devno_to_wholedisk(rdev, disk, disk_size, result);
 }
 
+/* Network filesystems; their requests are bound by the round trip time
+ * rather than by seeks, no matter what the server stores them on. */
+static bool rm_mounts_is_network_fs(const char *fstype) {
+    static const char *network_types[] = {"nfs",   "nfs4",      "cifs",       "smb3",
+                                          "smbfs", "ncpfs",     "afs",        "ceph",
+                                          "9p",    "fuse.ceph", "fuse.sshfs", "lustre",
+                                          "glusterfs", "fuse.glusterfs", "fuse.s3fs",
+                                          NULL};
+
+    for(int i = 0; network_types[i]; ++i) {
+        if(strcmp(network_types[i], fstype) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
 static bool rm_mounts_create_tables(RmMountTable *self, bool force_fiemap) {
     /* partition dev_t to disk dev_t */
     self->part_table = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
@@ -728,11 +747,12 @@ static bool rm_mounts_create_tables(RmMountTable *self, bool force_fiemap) {
 
         dev_t whole_disk = 0;
         gchar is_rotational = true;
+        bool is_network = rm_mounts_is_network_fs(entry->type);
         char diskname[PATH_MAX];
         memset(diskname, 0, sizeof(diskname));
 
         RmStat stat_buf_dev;
-        if(rm_sys_stat(entry->fsname, &stat_buf_dev) == -1) {
+        if(is_network || rm_sys_stat(entry->fsname, &stat_buf_dev) == -1) {
             char *nfs_marker = NULL;
             /* folder rm_sys_stat() is ok but devname rm_sys_stat() is not; this happens
              * for example
@@ -742,11 +762,13 @@ static bool rm_mounts_create_tables(RmMountTable *self, bool force_fiemap) {
                 strncpy(diskname, entry->fsname, sizeof(diskname)-1);
                 is_rotational = false;
                 whole_disk = stat_buf_folder.st_dev;
-            } else if((nfs_marker = strstr(entry->fsname, ":/")) != NULL) {
-                size_t until_slash =
-                    MIN((int)sizeof(entry->fsname), nfs_marker - entry->fsname);
-                strncpy(diskname, entry->fsname, until_slash);
+            } else if((nfs_marker = strstr(entry->fsname, ":/")) != NULL || is_network) {
+                /* server:/export for nfs and sshfs, //server/share for cifs etc. */
+                size_t until_slash = (nfs_marker) ? (size_t)(nfs_marker - entry->fsname)
+                                                  : strlen(entry->fsname);
+                strncpy(diskname, entry->fsname, MIN(until_slash, sizeof(diskname) - 1));
                 is_rotational = true;
+                is_network = true;
 
                 /* Assign different dev ids (with major id 0) to different nfs servers */
                 if(!g_hash_table_contains(self->nfs_table, diskname)) {
@@ -804,14 +826,15 @@ static bool rm_mounts_create_tables(RmMountTable *self, bool force_fiemap) {
         if(!g_hash_table_contains(self->disk_table, GINT_TO_POINTER(whole_disk))) {
             g_hash_table_insert(self->disk_table,
                                 GINT_TO_POINTER(whole_disk),
-                                rm_disk_info_new(diskname, is_rotational));
+                                rm_disk_info_new(diskname, is_rotational, is_network));
         }
 
         rm_log_debug_line(
-            "%02u:%02u %50s -> %02u:%02u %-12s (underlying disk: %s; rotational: %3s)",
+            "%02u:%02u %50s -> %02u:%02u %-12s (underlying disk: %s; rotational: %3s; "
+            "network: %3s)",
             major(stat_buf_folder.st_dev), minor(stat_buf_folder.st_dev), entry->dir,
             major(whole_disk), minor(whole_disk), entry->fsname, diskname,
-            is_rotational ? "yes" : "no");
+            is_rotational ? "yes" : "no", is_network ? "yes" : "no");
     }
 
     rm_mount_list_close(mnt_entries);
@@ -853,6 +876,21 @@ void rm_mounts_table_destroy(_UNUSED RmMountTable *self) {
 
 #endif /* RM_MOUNTTABLE_IS_USABLE */
 
+bool rm_mounts_is_network(RmMountTable *self, dev_t device) {
+    if(self == NULL) {
+        return false;
+    }
+
+    RmPartitionInfo *part =
+        g_hash_table_lookup(self->part_table, GINT_TO_POINTER(device));
+    if(part) {
+        RmDiskInfo *disk =
+            g_hash_table_lookup(self->disk_table, GINT_TO_POINTER(part->disk));
+        return disk && disk->is_network;
+    }
+    return false;
+}
+
 bool rm_mounts_is_nonrotational(RmMountTable *self, dev_t device) {
     if(self == NULL) {
         return true;
@@ -121,6 +121,16 @@ static inline int rm_sys_open(const char *path, int mode) {
     return open(path, mode, (S_IRUSR | S_IWUSR));
 }
 
+static inline int rm_sys_openat(int dir_fd, const char *path, int mode) {
+#if HAVE_STAT64
+#ifdef O_LARGEFILE
+    mode |= O_LARGEFILE;
+#endif
+#endif
+
+    return openat(dir_fd, path, mode, (S_IRUSR | S_IWUSR));
+}
+
 static inline void rm_sys_close(int fd) {
     if(close(fd) == -1) {
         rm_log_perror("close(2) failed");
@@ -379,6 +389,19 @@ void rm_mounts_table_destroy(RmMountTable *self);
  */
 bool rm_mounts_is_nonrotational(RmMountTable *self, dev_t device);
 
+/**
+ * @brief Check if the device is a network filesystem (nfs, cifs, sshfs, ...).
+ *
+ * Those are classed as rotational, but reads on them are bound by the
+ * latency of each request rather than by seeks.
+ *
+ * @param self the table to lookup from.
+ * @param device the dev_t of a file or of its disk
+ *
+ * @return true if it is a network filesystem.
+ */
+bool rm_mounts_is_network(RmMountTable *self, dev_t device);
+
 /**
  * @brief Get the disk behind the partition.
  *
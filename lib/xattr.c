@@ -67,6 +67,10 @@ ssize_t rm_sys_setxattr(
     return setxattr(path, name, value, size, 0, flags);
 }
 
+ssize_t rm_sys_fsetxattr(int fd, const char *name, const void *value, size_t size, int flags) {
+    return fsetxattr(fd, name, value, size, 0, flags);
+}
+
 int rm_sys_removexattr(const char *path, const char *name, bool follow_link) {
     int flags = 0;
     if(!follow_link) {
@@ -108,6 +112,10 @@ ssize_t rm_sys_setxattr(
     return setxattr(path, name, value, size, flags);
 }
 
+ssize_t rm_sys_fsetxattr(int fd, const char *name, const void *value, size_t size, int flags) {
+    return fsetxattr(fd, name, value, size, flags);
+}
+
 int rm_sys_removexattr(const char *path, const char *name, bool follow_link) {
     if(!follow_link) {
     #if HAVE_LXATTR
@@ -174,11 +182,18 @@ static int rm_xattr_is_fail(const char *name, char *path, int rc) {
 }
 
 static int rm_xattr_set(RmFile *file,
+                        int fd,
                         const char *key,
                         const char *value,
                         size_t value_size,
                         bool follow_link) {
     RM_DEFINE_PATH(file);
+    if(fd != -1) {
+        /* Saves resolving the path again */
+        return rm_xattr_is_fail("fsetxattr", file_path,
+                                rm_sys_fsetxattr(fd, key, value, value_size, 0));
+    }
+
     return rm_xattr_is_fail("setxattr", file_path,
                             rm_sys_setxattr(file_path, key, value, value_size, 0, follow_link));
 }
@@ -207,7 +222,7 @@ static int rm_xattr_del(RmFile *file, const char *key, bool follow_link) {
 //  ACTUAL API FUNCTIONS  //
 ////////////////////////////
 
-int rm_xattr_write_hash(RmFile *file, RmSession *session) {
+int rm_xattr_write_hash(RmFile *file, RmSession *session, int fd) {
     g_assert(file);
     g_assert(file->digest);
     g_assert(session);
@@ -217,6 +232,11 @@ int rm_xattr_write_hash(RmFile *file, RmSession *session) {
         return EINVAL;
     }
 
+    if(file->is_symlink && !session->cfg->follow_symlinks) {
+        /* fd would refer to the target, not the link itself */
+        fd = -1;
+    }
+
     char cksum_key[64], mtime_key[64],
         cksum_hex_str[rm_digest_get_bytes(file->digest) * 2 + 1], timestamp[64] = {0};
 
@@ -226,10 +246,12 @@ int rm_xattr_write_hash(RmFile *file, RmSession *session) {
     if(rm_xattr_build_key(session, "cksum", cksum_key, sizeof(cksum_key)) ||
        rm_xattr_build_key(session, "mtime", mtime_key, sizeof(mtime_key)) ||
        rm_xattr_build_cksum(file, cksum_hex_str, sizeof(cksum_hex_str)) <= 0 ||
-       rm_xattr_set(file, cksum_key, cksum_hex_str, sizeof(cksum_hex_str), follow) ||
-       rm_xattr_set(file, mtime_key, timestamp, strlen(timestamp), follow)) {
+       rm_xattr_set(file, fd, cksum_key, cksum_hex_str, sizeof(cksum_hex_str), follow) ||
+       rm_xattr_set(file, fd, mtime_key, timestamp, strlen(timestamp), follow)) {
         return errno;
     }
+#else
+    (void)fd;
 #endif
     return 0;
 }
@@ -35,10 +35,11 @@
  *
  * @param session Session to validate cfg against.
  * @param file file to get data and write to.
+ * @param fd An open descriptor of file (used with fsetxattr) or -1.
  *
  * @return 0 on success, some errno on failure.
  */
-int rm_xattr_write_hash(RmFile *file, RmSession *session);
+int rm_xattr_write_hash(RmFile *file, RmSession *session, int fd);
 
 /**
  * @brief Read hash as hexstring from xattrs into file->ext_cksum.
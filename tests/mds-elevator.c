@@ -0,0 +1,89 @@
+/*
+ *  This file is part of rmlint.
+ *
+ *  rmlint is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  rmlint is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with rmlint.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *
+ *  - Christopher <sahib> Pahl 2010-2020 (https://github.com/sahib)
+ *  - Daniel <SeeSpotRun> T.   2014-2020 (https://github.com/SeeSpotRun)
+ *
+ * Hosted on http://github.com/sahib/rmlint
+ *
+ */
+
+/* Test driver for the RmMDS elevator, run by tests/test_mains/test_mds.py.
+ *
+ * Queues N_TASKS tasks with pseudo random offsets on one (fake) rotational
+ * disk before the scheduler is started, and makes every task take TASK_US.
+ * The queue takes longer to drain than a task deadline, so most tasks become
+ * overdue.  Prints the number of served tasks and how often the offset went
+ * backwards; a single elevator sweep would never go backwards.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "../lib/config.h"
+#include "../lib/md-scheduler.h"
+
+#define N_TASKS (250)
+#define TASK_US (6 * 1000)
+
+typedef struct RmMDSTestState {
+    GMutex lock;
+    guint64 served[N_TASKS];
+    guint n_served;
+} RmMDSTestState;
+
+static gint rm_mds_test_func(guint64 *offset, RmMDSTestState *state) {
+    g_usleep(TASK_US);
+
+    g_mutex_lock(&state->lock);
+    { state->served[state->n_served++] = *offset; }
+    g_mutex_unlock(&state->lock);
+    return 1;
+}
+
+int main(void) {
+    RmMDSTestState state;
+    memset(&state, 0, sizeof(state));
+    g_mutex_init(&state.lock);
+
+    /* fake disks: the device number is the disk, even ones are rotational */
+    RmMDS *mds = rm_mds_new(1, NULL, true);
+    rm_mds_configure(mds, (RmMDSFunc)rm_mds_test_func, &state, 0, 1,
+                     (RmMDSSortFunc)rm_mds_elevator_cmp);
+
+    guint64 offsets[N_TASKS];
+    guint32 seed = 42;
+    RmMDSDevice *disk = rm_mds_device_get(mds, NULL, 2);
+    for(int i = 0; i < N_TASKS; ++i) {
+        seed = seed * 1103515245 + 12345;
+        offsets[i] = seed >> 8;
+        rm_mds_push_task(disk, 2, offsets[i], NULL, &offsets[i]);
+    }
+
+    rm_mds_start(mds);
+    rm_mds_free(mds, FALSE);
+
+    guint descents = 0;
+    for(guint i = 1; i < state.n_served; ++i) {
+        descents += (state.served[i] < state.served[i - 1]);
+    }
+
+    printf("%u %u\n", state.n_served, descents);
+    g_mutex_clear(&state.lock);
+    return 0;
+}
@@ -225,3 +225,39 @@ def test_clone_handler():
     counts = pattern_count(sh_path, ["^clone *'", "^skip_reflink *'"])
     assert counts[0] == 0
     assert counts[1] == 1
+
+
+@needs_reflink_fs
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_dedupe_partial():
+    block = 16 * 1024
+    blocks = [chr(ord('a') + idx) * block for idx in range(20)]
+
+    # b has one different block in front, so no block is at the same offset.
+    data_a = ''.join(blocks)
+    data_b = 'X' * block + ''.join(blocks[:15]) + 'tail'
+    path_a = create_file(data_a, 'a')
+    path_b = create_file(data_b, 'b')
+
+    # plain --dedupe stops at the first difference
+    with assert_exit_code(1):
+        run_rmlint(
+            '--dedupe', path_a, path_b,
+            use_default_dir=False,
+            with_json=False,
+            verbosity=""
+        )
+
+    with assert_exit_code(0):
+        run_rmlint(
+            '--dedupe --dedupe-partial', path_a, path_b,
+            use_default_dir=False,
+            with_json=False,
+            verbosity=""
+        )
+
+    # content must not change
+    with open(path_a, 'r') as handle:
+        assert handle.read() == data_a
+    with open(path_b, 'r') as handle:
+        assert handle.read() == data_b
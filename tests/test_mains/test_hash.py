@@ -44,3 +44,39 @@ def test_hash_function(*pat):
     else:
         streaming_compliance_check(pat[1:])
 
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_hash_recursive_and_check():
+    create_file('xxx', 'd/b')
+    create_file('yyy', 'd/a')
+    create_file('zzz', 'd/sub/c')
+
+    cmd = './rmlint --hash -a sha256 -r {}'.format(os.path.join(TESTDIR_NAME, 'd'))
+    output = subprocess.check_output(cmd.split()).decode('utf-8')
+    paths = [line.split('  ', 1)[1] for line in output.splitlines()]
+    assert paths == [os.path.join(TESTDIR_NAME, p) for p in ['d/a', 'd/b', 'd/sub/c']]
+
+    check_path = os.path.join(TESTDIR_NAME, 'sums')
+    with open(check_path, 'w') as handle:
+        handle.write(output)
+
+    cmd = './rmlint --hash -a sha256 --check {}'.format(check_path)
+    output = subprocess.check_output(cmd.split()).decode('utf-8')
+    assert output.splitlines() == [p + ': OK' for p in paths]
+
+    create_file('changed', 'd/b')
+    proc = subprocess.run(cmd.split(), stdout=subprocess.PIPE)
+    assert proc.returncode != 0
+    assert proc.stdout.decode('utf-8').splitlines()[1] == paths[1] + ': FAILED'
+
+    # a directory in the check file can never verify
+    with open(check_path, 'a') as handle:
+        handle.write('{}  {}\n'.format('0' * 64, os.path.join(TESTDIR_NAME, 'd/sub')))
+
+    create_file('xxx', 'd/b')
+    proc = subprocess.run(cmd.split(), stdout=subprocess.PIPE)
+    assert proc.returncode != 0
+    lines = proc.stdout.decode('utf-8').splitlines()
+    assert lines[:3] == [p + ': OK' for p in paths]
+    assert lines[3] == os.path.join(TESTDIR_NAME, 'd/sub') + ': FAILED open or read'
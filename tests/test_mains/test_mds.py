@@ -0,0 +1,20 @@
+#!/usr/bin/env python3
+# encoding: utf-8
+
+from nose.plugins.skip import SkipTest
+from tests.utils import *
+
+
+def test_elevator_with_overdue_tasks():
+    # built by "scons test", see tests/SConscript
+    driver = os.path.join(RMLINT_BINARY_DIR, 'tests', 'mds-elevator')
+    if not os.path.exists(driver):
+        raise SkipTest("mds-elevator test driver not built")
+
+    # more than a task deadline (1s) worth of work is queued at once
+    output = subprocess.check_output([driver]).decode('utf-8')
+    served, descents = (int(word) for word in output.split())
+
+    assert served == 250
+    # a few overdue tasks may jump the queue, the rest is one sweep
+    assert descents <= served // 10
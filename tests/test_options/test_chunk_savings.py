@@ -0,0 +1,40 @@
+#!/usr/bin/env python3
+# encoding: utf-8
+from nose import with_setup
+from tests.utils import *
+
+import random
+
+
+def random_text(rng, size):
+    return ''.join(rng.choice('abcdefghijklmnopqrstuvwxyz\n') for _ in range(size))
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_chunk_savings():
+    rng = random.Random(42)
+    data = random_text(rng, 200 * 1024)
+
+    # b is a with a few bytes inserted; chunking must find the rest again.
+    create_file(data, 'a')
+    create_file(data[:100000] + 'inserted' + data[100000:], 'sub/b')
+    create_file(random_text(rng, 50 * 1024), 'c')
+
+    head, *data, footer = run_rmlint('')
+    assert 'chunk_savings' not in footer
+    assert len(data) == 0
+
+    head, *data, footer = run_rmlint('--chunk-savings')
+    savings = footer['chunk_savings']
+    assert savings['total_bytes'] == 2 * 200 * 1024 + 8 + 50 * 1024
+    assert savings['total_bytes'] == savings['unique_bytes'] + savings['dedupable_bytes']
+    assert savings['dedupable_bytes'] > 150 * 1024
+
+    assert len(savings['pairs']) == 1
+    pair = savings['pairs'][0]
+    assert pair['paths'][0].endswith('/a')
+    assert pair['paths'][1].endswith('/sub/b')
+    assert pair['shared_bytes'] == savings['dedupable_bytes']
+
+    assert len(savings['directories']) == 1
+    assert savings['directories'][0]['path'].endswith('/sub')
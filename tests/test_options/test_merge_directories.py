@@ -468,3 +468,160 @@ def test_nested_content_with_same_layout():
     # just check if those are duplicate files as expected.
     for point in data[2:]:
         assert point["type"] == "duplicate_file"
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_similar_dirs():
+    for idx in range(9):
+        create_file(str(idx) * 3, 'backup-a/{}'.format(idx))
+        create_file(str(idx) * 3, 'backup-b/{}'.format(idx))
+
+    create_file('only-a', 'backup-a/x')
+    create_file('only-b', 'backup-b/y')
+
+    # Without the option, the footer does not mention similar dirs
+    head, *data, footer = run_rmlint('-D')
+    assert 'similar_directories' not in footer
+    assert 0 == sum(find['type'] == 'duplicate_dir' for find in data)
+
+    # 9 shared files out of 11 in total
+    head, *data, footer = run_rmlint('-D --similar-dirs=0.8')
+    similar = footer['similar_directories']
+    assert len(similar) == 1
+    paths = sorted(similar[0]['paths'])
+    assert paths[0].endswith('backup-a')
+    assert paths[1].endswith('backup-b')
+    assert similar[0]['shared_files'] == 9
+    assert abs(similar[0]['similarity'] - 9 / 11) < 0.001
+
+    differing = sorted(path for side in similar[0]['differing'] for path in side)
+    assert differing[0].endswith('backup-a/x')
+    assert differing[1].endswith('backup-b/y')
+
+    head, *data, footer = run_rmlint('-D --similar-dirs=0.9')
+    assert footer['similar_directories'] == []
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_similar_dirs_spilled():
+    # equal dirs may go out (and get spilled) before the similar dirs are searched
+    for idx in range(5):
+        create_file(str(idx) * 5, 'equal-a/{}'.format(idx))
+        create_file(str(idx) * 5, 'equal-b/{}'.format(idx))
+    for idx in range(9):
+        create_file(str(idx) * 3, 'backup-a/{}'.format(idx))
+        create_file(str(idx) * 3, 'backup-b/{}'.format(idx))
+    create_file('only-a', 'backup-a/x')
+    create_file('only-b', 'backup-b/y')
+
+    options = '-D --similar-dirs=0.8 --write-unfinished'
+    head, *expected, expected_footer = run_rmlint(options)
+    head, *spilled, spilled_footer = run_rmlint(options + ' --spill-files 1')
+
+    assert len(expected_footer['similar_directories']) == 1
+    assert spilled_footer['similar_directories'] == expected_footer['similar_directories']
+    assert sorted(p['path'] for p in spilled) == sorted(p['path'] for p in expected)
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_similar_dirs_ignore_other_lint():
+    for idx in range(9):
+        create_file(str(idx) * 3, 'backup-a/{}'.format(idx))
+        create_file(str(idx) * 3, 'backup-b/{}'.format(idx))
+    create_file('only-a', 'backup-a/x')
+    create_file('only-b', 'backup-b/y')
+
+    # reported as emptydir, not as a differing file
+    create_dirs('backup-a/empty')
+
+    head, *data, footer = run_rmlint('-D --similar-dirs=0.8')
+    assert any(p['type'] == 'emptydir' for p in data)
+
+    similar = footer['similar_directories']
+    assert len(similar) == 1
+    assert similar[0]['shared_files'] == 9
+    assert abs(similar[0]['similarity'] - 9 / 11) < 0.001
+
+    differing = sorted(path for side in similar[0]['differing'] for path in side)
+    assert len(differing) == 2
+    assert differing[0].endswith('backup-a/x')
+    assert differing[1].endswith('backup-b/y')
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_early_emission_matches_replay():
+    # equal dirs with equal subdirs; the subdirs finish first, but may not
+    # go out on their own while their parents can still be merged up
+    for outer in ('outer_a', 'outer_b'):
+        create_file('x' * 4096, outer + '/sub/deep/1')
+        create_file('y', outer + '/sub/2')
+        create_file('z' * 100000, outer + '/3')
+
+    # equal dirs below parents that differ; these are final right away
+    for single in ('single_a', 'single_b'):
+        create_file('w' * 10, single + '/sub/1')
+        create_file('v' * 50000, single + '/sub/2')
+    create_file('unique', 'single_a/4')
+    create_file('another unique', 'single_b/4')
+
+    def summarize(data):
+        return sorted(
+            (entry['type'], entry['path'], entry['is_original'])
+            for entry in filter_part_of_directory(data)
+        )
+
+    replay_path = os.path.join(TESTDIR_NAME, 'replay.json')
+    head, *data, footer = run_rmlint('-o json:{p} -S a -D'.format(p=replay_path))
+
+    dirs = [entry['path'] for entry in data if entry['type'] == 'duplicate_dir']
+    assert sorted(dirs) == [
+        os.path.join(TESTDIR_NAME, p)
+        for p in ['outer_a', 'outer_b', 'single_a/sub', 'single_b/sub']
+    ]
+
+    # --replay never emits early, so it shows what the output would be
+    # with all groups held back until the end
+    head, *replayed, footer = run_rmlint('--replay {p} -S a -D'.format(p=replay_path))
+    assert summarize(data) == summarize(replayed)
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_same_files_different_multiplicity():
+    # same set of contents, but x twice in tree-a and y twice in tree-b
+    create_file('xxx', 'tree-a/x1')
+    create_file('xxx', 'tree-a/x2')
+    create_file('yyy', 'tree-a/y1')
+
+    create_file('xxx', 'tree-b/x1')
+    create_file('yyy', 'tree-b/y1')
+    create_file('yyy', 'tree-b/y2')
+
+    # same multiset as tree-a, partly in a subdirectory
+    create_file('xxx', 'tree-c/sub/x1')
+    create_file('xxx', 'tree-c/sub/x2')
+    create_file('yyy', 'tree-c/y1')
+
+    head, *data, footer = run_rmlint('-D -S a')
+
+    dirs = [e['path'] for e in data if e['type'] == 'duplicate_dir']
+    assert dirs == [os.path.join(TESTDIR_NAME, p) for p in ['tree-a', 'tree-c']]
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_output_independent_of_threads():
+    # several groups of equal dirs of equal depth, created out of name order,
+    # each with equal subdirs that have to be merged up
+    for group in range(10):
+        for name in ['c', 'a', 'b']:
+            base = 'g{}/{}'.format(group, name)
+            create_file('top {}'.format(group), base + '/file')
+            create_file('nested {}'.format(group), base + '/sub/file')
+
+    strip = lambda d: [(e['type'], e['path'], e['is_original']) for e in d]
+
+    head, *first, footer = run_rmlint('-D -t 1')
+    assert len([e for e in first if e['type'] == 'duplicate_dir']) == 30
+
+    for threads in [2, 8, 16]:
+        head, *data, footer = run_rmlint('-D -t {}'.format(threads))
+        assert strip(data) == strip(first)
@@ -40,3 +40,35 @@ def test_rankby_dirs():
     data = filter_part_of_directory(data)
     paths = [os.path.basename(p['path']) for p in data]
     assert paths == ['b', 'c', 'ax', 'ay', 'x', 'y', 'dx', 'dy']
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_rankby_spilled():
+    for idx in range(10):
+        create_file('x' * (idx + 1), 'a{}'.format(idx))
+        create_file('x' * (idx + 1), 'b{}'.format(idx))
+        create_file('y' * (idx + 1), 'c/{}'.format(idx))
+        create_file('y' * (idx + 1), 'd/{}'.format(idx))
+
+    for options in ['--sort-by s -S a', '--sort-by Sn -S A', '--sort-by s -S a -D']:
+        head, *expected, foot = run_rmlint(options)
+        head, *spilled, foot = run_rmlint(options + ' --spill-files 1')
+        assert len(expected) > 0
+        assert [p['path'] for p in expected] == [p['path'] for p in spilled]
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_rankby_spilled_hardlinks():
+    for idx in range(5):
+        create_file('x' * (idx + 1), 'a{}'.format(idx))
+        create_file('x' * (idx + 1), 'b{}'.format(idx))
+        create_link('a{}'.format(idx), 'c{}'.format(idx))
+        create_link('a{}'.format(idx), 'd{}'.format(idx))
+
+    def strip(data):
+        return [(p['path'], p.get('hardlink_of')) for p in data]
+
+    head, *expected, foot = run_rmlint('--sort-by s -S a')
+    head, *spilled, foot = run_rmlint('--sort-by s -S a --spill-files 1')
+    assert any(p.get('hardlink_of') for p in expected)
+    assert strip(expected) == strip(spilled)
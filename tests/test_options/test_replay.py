@@ -4,6 +4,7 @@ from nose import with_setup
 from nose.plugins.attrib import attr
 from tests.utils import *
 
+import struct
 import time
 
 from itertools import permutations, combinations
@@ -470,3 +471,124 @@ def test_replay_unpack_directories():
     expected["part_of_directory"] = EXPECTED_WITH_TREEMERGE["part_of_directory"]
 
     assert data_by_type(data) == expected
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_replay_binary():
+    create_file('xxx', 'a/1')
+    create_file('xxx', 'a/2')
+    create_file('xxx', 'b/1')
+    create_file('yyy', 'b/2')
+    create_file('yyy', 'c/2')
+
+    json_path = os.path.join(TESTDIR_NAME, 'replay.json')
+    binary_path = os.path.join(TESTDIR_NAME, 'replay.rmbin')
+    head, *data, footer = run_rmlint('-o json:{j} -o binary:{b} -S a'.format(
+        j=json_path, b=binary_path
+    ))
+    assert len(data) == 5
+
+    # The binary file should be noticeably smaller than the json one.
+    assert os.path.getsize(binary_path) < os.path.getsize(json_path)
+
+    _, *json_data, _ = run_rmlint('--replay {p} -S a'.format(p=json_path))
+    _, *bin_data, _ = run_rmlint('--replay {p} -S a'.format(p=binary_path))
+
+    strip = lambda d: [(e['path'], e['type'], e['is_original'], e['checksum']) for e in d]
+    assert strip(bin_data) == strip(json_data)
+    assert len(bin_data) == 5
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_replay_binary_corrupt_cksum_len():
+    create_file('xxx', 'a/1')
+    create_file('xxx', 'a/2')
+
+    binary_path = os.path.join(TESTDIR_NAME, 'replay.rmbin')
+    run_rmlint('-o binary:{b}'.format(b=binary_path))
+
+    with open(binary_path, 'rb') as handle:
+        blob = bytearray(handle.read())
+
+    # skip the header and the DIR/GROUP records up to the first FILE record
+    pos = 8 + 4 + 4 + 1
+    pos += 1 + blob[pos]
+    while chr(blob[pos]) != 'F':
+        if chr(blob[pos]) == 'D':
+            name_len, = struct.unpack_from('=H', blob, pos + 9)
+            pos += 9 + 2 + name_len
+        else:
+            pos += 1
+
+    name_len, = struct.unpack_from('=H', blob, pos + 5)
+    cksum_len_pos = pos + 5 + 2 + name_len + 1 + 1 + 8 + 8 + 8 + 8 + 2 + 8
+    struct.pack_into('=I', blob, cksum_len_pos, 0xfffffff0)
+
+    with open(binary_path, 'wb') as handle:
+        handle.write(blob)
+
+    # must be treated as corrupt instead of trying to allocate 4G
+    head, *data, footer = run_rmlint('--replay {p}'.format(p=binary_path))
+    assert data == []
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_replay_large_json_with_invalid_elements():
+    # enough entries for the json file to span several read buffers;
+    # names with json syntax in them must not confuse the element splitter
+    for idx in range(300):
+        name = 'dir/{i}_{{[\\"]}},'.format(i=idx) + 'x' * 100
+        create_file(str(idx), name + '_a')
+        create_file(str(idx), name + '_b')
+
+    replay_path = os.path.join(TESTDIR_NAME, 'replay.json')
+    head, *data, footer = run_rmlint('-o json:{p} -S a'.format(p=replay_path))
+    assert len(data) == 600
+    assert os.path.getsize(replay_path) > 2 * 64 * 1024
+
+    # a primitive and a broken element in the middle are skipped
+    with open(replay_path, 'r') as handle:
+        text = handle.read()
+
+    pos = text.index('\n}, {', len(text) // 2) + len('\n}, ')
+    text = text[:pos] + '42, {"broken": }, ' + text[pos:]
+
+    with open(replay_path, 'w') as handle:
+        handle.write(text)
+
+    head, *replayed, footer = run_rmlint('--replay {p} -S a'.format(p=replay_path))
+
+    strip = lambda d: [(e['path'], e['type'], e['is_original']) for e in d]
+    assert strip(replayed) == strip(data)
+
+
+@attr('slow')
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_replay_many_entries_and_similar_prefixes():
+    # more entries than are stat'ed in one batch; 'a' is a string prefix of
+    # 'ab', but not a parent directory of it
+    for idx in range(2500):
+        create_file(str(idx), 'a/{}'.format(idx))
+        create_file(str(idx), 'ab/{}'.format(idx))
+
+    replay_path = os.path.join(TESTDIR_NAME, 'replay.json')
+    head, *data, footer = run_rmlint(
+        '{t}/a {t}/ab -o json:{p} -S a'.format(t=TESTDIR_NAME, p=replay_path),
+        use_default_dir=False
+    )
+    assert len(data) == 5000
+
+    # entries of files that are gone are dropped, and so are their partners
+    os.remove(os.path.join(TESTDIR_NAME, 'a/7'))
+    os.remove(os.path.join(TESTDIR_NAME, 'ab/4444'))
+
+    head, *replayed, footer = run_rmlint(
+        '{t}/a {t}/ab --replay {p} -S a'.format(t=TESTDIR_NAME, p=replay_path),
+        use_default_dir=False
+    )
+
+    gone = [os.path.join(TESTDIR_NAME, p) for p in ['a/7', 'ab/7', 'a/4444', 'ab/4444']]
+    expected = [
+        (e['path'], e['type'], e['is_original']) for e in data if e['path'] not in gone
+    ]
+    assert [(e['path'], e['type'], e['is_original']) for e in replayed] == expected
@@ -25,3 +25,40 @@ def test_bigfiles():
     *_, footer = run_rmlint('')
     assert footer['duplicates'] == 1
 
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_fragmented_bigfiles():
+    # appending to all files in turn (and syncing) leaves them fragmented on
+    # most filesystems, so later increments lie in other extents than the start
+    names = ['slow/file{}'.format(i) for i in range(4)]
+    chunk_size = 64 * 1024
+    num_chunks = 64
+
+    handles = [open(create_file('', name), 'w') for name in names]
+    try:
+        for chunk in range(num_chunks):
+            for idx, handle in enumerate(handles):
+                data = str(chunk % 10) * chunk_size
+                if idx == 3 and chunk == num_chunks - 2:
+                    # differs in the second to last extent only
+                    data = 'y' + data[1:]
+                handle.write(data)
+                handle.flush()
+                os.fsync(handle.fileno())
+    finally:
+        for handle in handles:
+            handle.close()
+
+    create_dirs('fast')
+    paths = ' '.join(os.path.join(TESTDIR_NAME, d) for d in ['fast', 'slow'])
+    for options in ['', ' --fake-pathindex-as-disk']:
+        head, *data, footer = run_rmlint(paths + options, use_default_dir=False)
+        assert footer['duplicate_sets'] == 1
+        assert footer['duplicates'] == 2
+
+        dupes = sorted(
+            os.path.relpath(e['path'], TESTDIR_NAME) for e in data
+            if e['type'] == 'duplicate_file'
+        )
+        assert dupes == names[:3]
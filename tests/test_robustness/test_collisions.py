@@ -25,3 +25,45 @@ def test_collision_resistance():
         if algo not in BLACKLIST:
             *_, footer = run_rmlint('--read-buffer-len=4 -a {}'.format(algo))
             assert footer['duplicates'] == 0, 'Unexpected hash collision for hash type {}'.format(algo)
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_lockstep_paranoid():
+    # equal size, differing only in the last window
+    data = 'x' * (5 * 1024 * 1024)
+    create_file(data + 'a', 'a1')
+    create_file(data + 'a', 'a2')
+    create_file(data + 'b', 'b1')
+    create_file(data + 'b', 'b2')
+    create_file(data + 'c', 'c1')
+
+    head, *data, footer = run_rmlint('-pp --lockstep-paranoid')
+    assert footer['duplicates'] == 2
+    assert footer['duplicate_sets'] == 2
+
+    paths = sorted(os.path.basename(e['path']) for e in data if e['type'] == 'duplicate_file')
+    assert paths == ['a1', 'a2', 'b1', 'b2']
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_lockstep_paranoid_many_members():
+    # 33 members shrink the window to 1G / 2 / 16 threads / 33 (about 1M),
+    # below its 4M maximum; pairs differ from the rest in different windows
+    size = 2 * 1024 * 1024
+    for i in range(16):
+        pos = i * size // 16 + 7
+        data = 'x' * pos + 'y' + 'x' * (size - pos - 1)
+        create_file(data, 'pair{:02d}_a'.format(i))
+        create_file(data, 'pair{:02d}_b'.format(i))
+    create_file('x' * size, 'single')
+
+    head, *data, footer = run_rmlint('-pp --lockstep-paranoid --limit-mem 1G -t 16')
+    assert footer['duplicates'] == 16
+    assert footer['duplicate_sets'] == 16
+
+    # groups are output one after the other
+    paths = [os.path.basename(e['path']) for e in data if e['type'] == 'duplicate_file']
+    pairs = sorted(sorted(paths[i:i + 2]) for i in range(0, len(paths), 2))
+    assert pairs == [
+        ['pair{:02d}_a'.format(i), 'pair{:02d}_b'.format(i)] for i in range(16)
+    ]
@@ -4,6 +4,8 @@ from nose.plugins.attrib import attr
 from nose import with_setup
 from tests.utils import *
 
+import resource
+
 @attr('slow')
 @with_setup(usual_setup_func, usual_teardown_func)
 def test_manyfiles():
@@ -21,3 +23,263 @@ def test_manyfiles():
 
     head, *data, footer = run_rmlint('')
     assert len(data) == numfiles + numpairs * 2
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_small_files_fast_disks():
+    # small size groups are hashed in one pass before the shredder; with fake
+    # disks the first path is non-rotational and gets the extra workers
+    contents = {}
+    for i in range(300):
+        data = str(i) * (i % 40 + 1)
+        for name in ['a/{:03d}'.format(i), 'b/{:03d}'.format(i)]:
+            create_file(data, name)
+            contents.setdefault(data, []).append(name)
+        if i % 3 == 0:
+            create_file(data, 'a/copy{:03d}'.format(i))
+            contents[data].append('a/copy{:03d}'.format(i))
+
+    expected = sorted(sorted(names) for names in contents.values() if len(names) > 1)
+
+    paths = ' '.join(os.path.join(TESTDIR_NAME, d) for d in ['a', 'b'])
+    for options in ['', ' --fake-pathindex-as-disk']:
+        head, *data, footer = run_rmlint(paths + options, use_default_dir=False)
+        assert footer['duplicate_sets'] == len(expected)
+
+        groups = {}
+        for entry in data:
+            if entry['type'] == 'duplicate_file':
+                name = os.path.relpath(entry['path'], TESTDIR_NAME)
+                groups.setdefault(entry['checksum'], []).append(name)
+        assert sorted(sorted(names) for names in groups.values()) == expected
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_many_files_few_descriptors():
+    # more files than the descriptor cache may keep open, each read in
+    # several increments; the last member of every group differs at the end
+    size = 256 * 1024
+    for i in range(80):
+        data = '{:02d}'.format(i) * (size // 2)
+        create_file(data, 'g{:02d}/a'.format(i))
+        create_file(data, 'g{:02d}/b'.format(i))
+        create_file(data[:-1] + '!', 'g{:02d}/c'.format(i))
+
+    # leaves the cache 64 descriptors (half of the limit, minus the reserve)
+    soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+    resource.setrlimit(resource.RLIMIT_NOFILE, (256, hard))
+    try:
+        head, *data, footer = run_rmlint('-S a')
+    finally:
+        resource.setrlimit(resource.RLIMIT_NOFILE, (soft, hard))
+
+    assert footer['duplicate_sets'] == 80
+    assert footer['duplicates'] == 80
+
+    dupes = sorted(
+        os.path.relpath(e['path'], TESTDIR_NAME) for e in data
+        if e['type'] == 'duplicate_file'
+    )
+    assert dupes == sorted(
+        'g{:02d}/{}'.format(i, n) for i in range(80) for n in 'ab'
+    )
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_deferred_tasks_on_several_disks():
+    # paranoid groups wait for memory, so device workers run out of work they
+    # can do and have to be woken again by tasks pushed from other devices
+    dirs = ['a', 'b', 'c', 'd']
+    expected = []
+    for i in range(40):
+        data = '{:02d}'.format(i) * (64 * 1024 + i * 512)
+        names = ['{}/{:02d}'.format(dirs[(i + n) % 4], i) for n in range(3)]
+        for name in names[:2]:
+            create_file(data, name)
+        create_file(data[:-1] + '!', names[2])
+        expected.extend(names[:2])
+
+    paths = ' '.join(os.path.join(TESTDIR_NAME, d) for d in dirs)
+    for options in ['', ' -pp --limit-mem 1M', ' -pp --limit-mem 1M --fake-pathindex-as-disk -t 8']:
+        head, *data, footer = run_rmlint(paths + options, use_default_dir=False)
+        assert footer['duplicate_sets'] == 40
+
+        dupes = sorted(
+            os.path.relpath(e['path'], TESTDIR_NAME) for e in data
+            if e['type'] == 'duplicate_file'
+        )
+        assert dupes == sorted(expected)
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_disk_offsets_of_rotational_candidates():
+    # with fake disks the second path is rotational, so the disk offsets of
+    # its candidates are looked up before shredding; unique sizes and small
+    # groups are left out of that
+    expected = []
+    for i in range(100):
+        data = '{:03d}'.format(i) * (32 * 1024 + i)
+        names = [n.format(i) for n in ['fast/{:03d}', 'slow/{:03d}a', 'slow/{:03d}b']]
+        for name in names:
+            create_file(data, name)
+        expected.append(names)
+
+        create_file('u' * (200 * 1024 + i), 'slow/unique{:03d}'.format(i))
+        create_file(str(i), 'slow/small{:03d}a'.format(i))
+        create_file(str(i), 'slow/small{:03d}b'.format(i))
+        expected.append(['slow/small{:03d}a'.format(i), 'slow/small{:03d}b'.format(i)])
+
+    paths = ' '.join(os.path.join(TESTDIR_NAME, d) for d in ['fast', 'slow'])
+    for options in ['', ' --fake-pathindex-as-disk']:
+        head, *data, footer = run_rmlint(paths + options, use_default_dir=False)
+
+        groups = {}
+        for entry in data:
+            if entry['type'] == 'duplicate_file':
+                name = os.path.relpath(entry['path'], TESTDIR_NAME)
+                groups.setdefault(entry['checksum'], []).append(name)
+        assert sorted(sorted(names) for names in groups.values()) == sorted(expected)
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_mixed_fast_and_slow_members():
+    # with fake disks 'fast' is non-rotational and 'slow' rotational; the slow
+    # members of a group are only read after the fast ones are done, but must
+    # still be compared on their own content
+    expected = []
+    for i in range(30):
+        base = '{:02d}'.format(i) * (48 * 1024 + i)
+        other = base[:-1] + '!'
+        tag = '{:02d}'.format(i)
+
+        # fast pair, one slow partner and one slow member that differs
+        for name in ['fast/a' + tag, 'fast/b' + tag, 'slow/a' + tag]:
+            create_file(base, name)
+        create_file(other, 'slow/b' + tag)
+        expected.append(['fast/a' + tag, 'fast/b' + tag, 'slow/a' + tag])
+
+        # fast members differ; each has a slow twin
+        create_file(base + 'x', 'fast/c' + tag)
+        create_file(base + 'y', 'fast/d' + tag)
+        create_file(base + 'x', 'slow/c' + tag)
+        create_file(base + 'y', 'slow/d' + tag)
+        expected.append(['fast/c' + tag, 'slow/c' + tag])
+        expected.append(['fast/d' + tag, 'slow/d' + tag])
+
+    paths = ' '.join(os.path.join(TESTDIR_NAME, d) for d in ['fast', 'slow'])
+    for options in ['', ' --fake-pathindex-as-disk']:
+        head, *data, footer = run_rmlint(paths + options, use_default_dir=False)
+
+        groups = {}
+        for entry in data:
+            if entry['type'] == 'duplicate_file':
+                name = os.path.relpath(entry['path'], TESTDIR_NAME)
+                groups.setdefault(entry['checksum'], []).append(name)
+        assert sorted(sorted(names) for names in groups.values()) == sorted(expected)
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_wide_and_deep_directories():
+    # directories with few and many entries (the trie switches its child
+    # storage above 8), the same basenames in many places and deep nesting
+    expected = []
+    for width in [1, 8, 9, 100]:
+        for i in range(width):
+            data = 'w{}_{}'.format(width, i)
+            names = ['wide{}/dir_a/f{}'.format(width, i), 'wide{}/dir_b/f{}'.format(width, i)]
+            for name in names:
+                create_file(data, name)
+            expected.append(names)
+
+    deep = '/'.join('level{}'.format(i) for i in range(40))
+    create_file('deep content', 'deep_a/' + deep + '/file')
+    create_file('deep content', 'deep_b/' + deep + '/file')
+    expected.append(['deep_a/' + deep + '/file', 'deep_b/' + deep + '/file'])
+
+    for threads in [1, 8]:
+        head, *data, footer = run_rmlint('-t {}'.format(threads))
+
+        groups = {}
+        for entry in data:
+            if entry['type'] == 'duplicate_file':
+                name = os.path.relpath(entry['path'], TESTDIR_NAME)
+                groups.setdefault(entry['checksum'], []).append(name)
+        assert sorted(sorted(names) for names in groups.values()) == sorted(expected)
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_small_size_groups():
+    # small size groups are hashed whole in one pass and split by content
+    # right away; groups that can't qualify must come out as before
+    for i in range(50):
+        tag = '{:02d}'.format(i)
+        # all files have the same size: two pairs and a single file each
+        create_file('x' + tag, 'a/x' + tag)
+        create_file('x' + tag, 'b/x' + tag)
+        create_file('y' + tag, 'a/y' + tag)
+        create_file('y' + tag, 'b/other_y' + tag)
+        create_file('z' + tag, 'b/z' + tag)
+
+    pairs = lambda fmt: [sorted(n.format(i) for n in fmt) for i in range(50)]
+    def groups_of(data):
+        groups = {}
+        for entry in data:
+            if entry['type'] == 'duplicate_file':
+                name = os.path.relpath(entry['path'], TESTDIR_NAME)
+                groups.setdefault(entry['checksum'], []).append(name)
+        return sorted(sorted(names) for names in groups.values())
+
+    a_path, b_path = (os.path.join(TESTDIR_NAME, d) for d in 'ab')
+
+    head, *data, footer = run_rmlint()
+    assert groups_of(data) == sorted(
+        pairs(['a/x{:02d}', 'b/x{:02d}']) + pairs(['a/y{:02d}', 'b/other_y{:02d}'])
+    )
+
+    # only the pairs with different names are left
+    head, *data, footer = run_rmlint('-B')
+    assert groups_of(data) == pairs(['a/y{:02d}', 'b/other_y{:02d}'])
+
+    # all pairs have a tagged member
+    head, *data, footer = run_rmlint(
+        '{a} // {b} --must-match-tagged'.format(a=a_path, b=b_path),
+        use_default_dir=False
+    )
+    assert footer['duplicate_sets'] == 100
+
+    # no file below the tagged path; nothing can qualify
+    create_dirs('empty')
+    head, *data, footer = run_rmlint(
+        '{a} {b} // {e} --must-match-tagged'.format(
+            a=a_path, b=b_path, e=os.path.join(TESTDIR_NAME, 'empty')
+        ),
+        use_default_dir=False
+    )
+    assert footer['duplicate_sets'] == 0
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_prefetch_first_increment():
+    # with fake disks the second path is rotational, so the first increment of
+    # its candidates is read ahead in disk order; --limit-mem caps how much
+    expected = []
+    for i in range(60):
+        data = '{:02d}'.format(i) * (128 * 1024 + i)
+        names = ['slow/{:02d}a'.format(i), 'slow/{:02d}b'.format(i)]
+        for name in names:
+            create_file(data, name)
+        create_file(data[:-1] + '!', 'slow/{:02d}c'.format(i))
+        create_file('y' + data[1:], 'slow/{:02d}d'.format(i))
+        expected.append(names)
+
+    create_dirs('fast')
+    paths = ' '.join(os.path.join(TESTDIR_NAME, d) for d in ['fast', 'slow'])
+    for options in ['', ' --fake-pathindex-as-disk', ' --fake-pathindex-as-disk --limit-mem 1M']:
+        head, *data, footer = run_rmlint(paths + options, use_default_dir=False)
+
+        groups = {}
+        for entry in data:
+            if entry['type'] == 'duplicate_file':
+                name = os.path.relpath(entry['path'], TESTDIR_NAME)
+                groups.setdefault(entry['checksum'], []).append(name)
+        assert sorted(sorted(names) for names in groups.values()) == sorted(expected)
@@ -0,0 +1,322 @@
+#!/usr/bin/env python3
+# encoding: utf-8
+
+"""
+Offline benchmark for rmlint on a generated corpus.
+
+Unlike benchmark.py this does not need root, network access or any other
+duplicate finder. A synthetic tree is generated under a temporary directory
+from a seeded random generator (so two runs with the same parameters see the
+very same tree), rmlint is run on it with a matrix of options and the
+per-phase timings and peak memory of every run are written as json.
+
+Typical usage:
+
+    $ scons -j4 && scons bench
+    $ tests/test_speed/synthetic.py --files 20000 --dupe-ratio 0.3 -o bench.json
+    $ tests/test_speed/synthetic.py --compare old.json new.json
+"""
+
+import os
+import re
+import sys
+import json
+import time
+import random
+import shutil
+import argparse
+import platform
+import tempfile
+import subprocess
+
+
+# Debug lines rmlint prints when a phase is done (see -vvv output).
+# Each of them contains the elapsed seconds since the session started.
+PHASE_PATTERNS = [
+    ('traverse', re.compile(r'List build finished at ([0-9.]+)')),
+    ('preprocess', re.compile(r'other lint finished at ([0-9.]+)')),
+    ('shredder', re.compile(r'Dupe search finished at time ([0-9.]+)')),
+]
+
+SIZE_DISTRIBUTIONS = {
+    # Mostly small files, like a source tree or a mail spool.
+    'small': lambda rng: int(rng.lognormvariate(8, 1.5)),
+    # Mix of documents, pictures and a few large archives.
+    'mixed': lambda rng: int(rng.lognormvariate(11, 2.5)),
+    # Few, but large files, like a media collection.
+    'large': lambda rng: int(rng.lognormvariate(15, 1.0)),
+    # Every file has the same size; worst case for size grouping.
+    'fixed': lambda rng: 4096,
+}
+
+
+###########################
+# SYNTHETIC TREE CREATION #
+###########################
+
+class Corpus:
+    def __init__(self, root, args):
+        self.root = root
+        self.args = args
+        self.rng = random.Random(args.seed)
+        self.stats = {
+            'files': 0, 'dupes': 0, 'hardlinks': 0, 'sparse': 0, 'bytes': 0
+        }
+
+    def _random_dir(self):
+        depth = self.rng.randint(0, self.args.depth)
+        width = max(1, self.args.width)
+        parts = ['d{}'.format(self.rng.randrange(width)) for _ in range(depth)]
+        path = os.path.join(self.root, *parts)
+        os.makedirs(path, exist_ok=True)
+        return path
+
+    def _payload(self, size):
+        # Random data, but cheap to create: repeat a random block and
+        # make the last bytes unique so similar sizes are not equal files.
+        block = self.rng.getrandbits(8 * 4096).to_bytes(4096, 'little')
+        tail = self.rng.getrandbits(64).to_bytes(8, 'little')
+        data = (block * (size // len(block) + 1))[:max(0, size - len(tail))]
+        return (data + tail)[:size]
+
+    def _write(self, path, data, sparse=False):
+        with open(path, 'wb') as handle:
+            if sparse:
+                # Leave a hole in the middle of the file.
+                half = len(data) // 2
+                handle.write(data[:half // 2])
+                handle.seek(half + half // 2)
+                handle.write(data[half + half // 2:])
+                handle.truncate(len(data))
+            else:
+                handle.write(data)
+
+        self.stats['files'] += 1
+        self.stats['bytes'] += len(data)
+
+    def generate(self):
+        size_func = SIZE_DISTRIBUTIONS[self.args.size_dist]
+        originals = []
+
+        for idx in range(self.args.files):
+            path = os.path.join(self._random_dir(), 'f{}'.format(idx))
+            size = max(1, min(size_func(self.rng), self.args.max_size))
+
+            if originals and self.rng.random() < self.args.hardlink_ratio:
+                os.link(self.rng.choice(originals), path)
+                self.stats['hardlinks'] += 1
+                continue
+
+            if originals and self.rng.random() < self.args.dupe_ratio:
+                orig_path = self.rng.choice(originals)
+                with open(orig_path, 'rb') as handle:
+                    data = handle.read()
+                self._write(path, data)
+                self.stats['dupes'] += 1
+                continue
+
+            data = self._payload(size)
+            sparse = size > 3 * 4096 and self.rng.random() < self.args.sparse_ratio
+            self._write(path, data, sparse)
+            self.stats['sparse'] += sparse
+            originals.append(path)
+
+        return self.stats
+
+
+############################
+# RUNNING AND MEASUREMENTS #
+############################
+
+def build_matrix(args):
+    matrix = []
+    for fiemap in args.fiemap:
+        for algorithm in args.algorithms:
+            for threads in args.threads:
+                matrix.append({
+                    'fiemap': fiemap,
+                    'algorithm': algorithm,
+                    'threads': threads,
+                })
+    return matrix
+
+
+def run_rmlint(binary, root, variant):
+    cmd = [
+        binary, root, '-vvv', '-T', 'df', '-o', 'summary:/dev/null',
+        '--with-fiemap' if variant['fiemap'] else '--without-fiemap',
+        '-a', variant['algorithm'],
+        '--threads', str(variant['threads']),
+    ]
+
+    start = time.time()
+    proc = subprocess.Popen(
+        cmd, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE,
+        universal_newlines=True
+    )
+
+    # Read stderr before waiting, otherwise a chatty run could block on the pipe.
+    log = proc.stderr.read()
+    _, status, rusage = os.wait4(proc.pid, 0)
+    wall = time.time() - start
+
+    phases = {}
+    for name, pattern in PHASE_PATTERNS:
+        match = pattern.search(log)
+        if match is not None:
+            phases[name] = float(match.group(1))
+
+    # Convert cumulative timestamps to per-phase durations.
+    last, durations = 0.0, {}
+    for name, _ in PHASE_PATTERNS:
+        if name in phases:
+            durations[name] = round(phases[name] - last, 4)
+            last = phases[name]
+    durations['output'] = round(max(0.0, wall - last), 4)
+
+    return {
+        'cmd': ' '.join(cmd),
+        'exit_code': os.waitstatus_to_exitcode(status)
+        if hasattr(os, 'waitstatus_to_exitcode') else status >> 8,
+        'wall': round(wall, 4),
+        'user': round(rusage.ru_utime, 4),
+        'sys': round(rusage.ru_stime, 4),
+        # ru_maxrss is in kilobytes on linux.
+        'peak_rss_kb': rusage.ru_maxrss,
+        'phases': durations,
+    }
+
+
+def best_of(runs):
+    # Use the fastest run; it has the least noise from other processes.
+    return min(runs, key=lambda run: run['wall'])
+
+
+def run_benchmark(args):
+    root = tempfile.mkdtemp(prefix='rmlint-synthetic-', dir=args.tmpdir)
+    try:
+        print('-- Generating corpus in {}'.format(root))
+        start = time.time()
+        stats = Corpus(root, args).generate()
+        print('-- Generated {files} files ({bytes} bytes, {dupes} dupes, '
+              '{hardlinks} hardlinks, {sparse} sparse) in {t:.2f}s'.format(
+                  t=time.time() - start, **stats))
+
+        results = []
+        for variant in build_matrix(args):
+            # First run to warm the page cache, so all runs read from memory.
+            run_rmlint(args.binary, root, variant)
+            runs = [run_rmlint(args.binary, root, variant) for _ in range(args.runs)]
+            best = best_of(runs)
+            best['variant'] = variant
+            results.append(best)
+            print('== {v}: {w:.3f}s, {m} KB peak'.format(
+                v=variant, w=best['wall'], m=best['peak_rss_kb']
+            ))
+
+        return {
+            'rmlint': subprocess.check_output(
+                [args.binary, '--version'], stderr=subprocess.STDOUT
+            ).decode('utf-8').splitlines()[0],
+            'machine': platform.platform(),
+            'date': time.strftime('%FT%T%z', time.localtime()),
+            'corpus': {
+                'seed': args.seed,
+                'files': args.files,
+                'size_dist': args.size_dist,
+                'max_size': args.max_size,
+                'dupe_ratio': args.dupe_ratio,
+                'hardlink_ratio': args.hardlink_ratio,
+                'sparse_ratio': args.sparse_ratio,
+                'depth': args.depth,
+                'width': args.width,
+                'stats': stats,
+            },
+            'results': results,
+        }
+    finally:
+        shutil.rmtree(root, ignore_errors=True)
+
+
+def compare(old_path, new_path, threshold):
+    with open(old_path, 'r') as handle:
+        old = json.load(handle)
+    with open(new_path, 'r') as handle:
+        new = json.load(handle)
+
+    if old['corpus'] != new['corpus']:
+        print('!! Corpus parameters differ; comparison is meaningless.')
+        return 1
+
+    key = lambda r: json.dumps(r['variant'], sort_keys=True)
+    old_results = {key(r): r for r in old['results']}
+
+    regressions = 0
+    for result in new['results']:
+        prev = old_results.get(key(result))
+        if prev is None:
+            continue
+
+        for metric in ('wall', 'peak_rss_kb'):
+            a, b = prev[metric], result[metric]
+            change = (b - a) / a if a else 0
+            marker = ''
+            if change > threshold:
+                marker = '  <-- regression'
+                regressions += 1
+
+            print('{v} {m}: {a} -> {b} ({c:+.1%}){x}'.format(
+                v=result['variant'], m=metric, a=a, b=b, c=change, x=marker
+            ))
+
+    return 1 if regressions else 0
+
+
+def parse_arguments():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[1])
+    add = parser.add_argument
+    add('--binary', default='./rmlint', help='rmlint binary to benchmark')
+    add('--tmpdir', default=os.getenv('RM_TS_DIR'), help='where to create the corpus')
+    add('-o', '--output', default=None, help='write json results to this path')
+    add('--seed', type=int, default=42)
+    add('--runs', type=int, default=3, help='measured runs per variant')
+
+    add('--files', type=int, default=10000)
+    add('--size-dist', choices=sorted(SIZE_DISTRIBUTIONS), default='mixed')
+    add('--max-size', type=int, default=64 * 1024 * 1024)
+    add('--dupe-ratio', type=float, default=0.25)
+    add('--hardlink-ratio', type=float, default=0.02)
+    add('--sparse-ratio', type=float, default=0.02)
+    add('--depth', type=int, default=8, help='maximum directory nesting')
+    add('--width', type=int, default=4, help='subdirectories per level')
+
+    add('--algorithms', nargs='+', default=['blake2b', 'xxhash', 'paranoid'])
+    add('--threads', nargs='+', type=int, default=[1, 16])
+    add('--fiemap', nargs='+', type=int, choices=[0, 1], default=[1, 0])
+
+    add('--compare', nargs=2, metavar=('OLD', 'NEW'),
+        help='compare two result files instead of running')
+    add('--threshold', type=float, default=0.1,
+        help='relative slowdown reported as regression by --compare')
+    return parser.parse_args()
+
+
+def main():
+    args = parse_arguments()
+    if args.compare:
+        return compare(args.compare[0], args.compare[1], args.threshold)
+
+    report = run_benchmark(args)
+    dump = json.dumps(report, indent=2, sort_keys=True)
+    if args.output:
+        with open(args.output, 'w') as handle:
+            handle.write(dump + '\n')
+        print('-- Wrote results to ' + args.output)
+    else:
+        print(dump)
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())